@@ -96,6 +96,7 @@ LOCAL_ASFLAGS := -DOEM_KEYSTORE_FILE=\"$(PADDED_KEYSTORE)\" \
 	-DOEM_KEY_FILE=\"$(PADDED_OEM_CERT)\"
 LOCAL_STATIC_LIBRARIES += $(SHARED_STATIC_LIBRARIES)
 LOCAL_MODULE_STEM := kernelflinger
+LOCAL_C_INCLUDES := $(addprefix $(LOCAL_PATH)/,libfastboot)
 
 include $(BUILD_EFI_EXECUTABLE)
 
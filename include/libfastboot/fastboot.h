@@ -38,6 +38,7 @@
 #include <efidef.h>
 #include <lib.h>
 #include <vars.h>
+#include <storage.h>
 
 #define MAX_DOWNLOAD_SIZE (256 * 1024 * 1024)
 
@@ -56,6 +57,10 @@ typedef struct cmdlist *cmdlist_t;
 
 void fastboot_set_dlbuffer(void *buffer, unsigned size);
 
+/* Stage DATA, a pool allocated buffer, to be sent to the host by the
+ * next "upload" command.  The buffer is owned and freed by fastboot. */
+void fastboot_stage(void *data, UINTN size);
+
 struct fastboot_cmd *fastboot_get_root_cmd(const char *name);
 EFI_STATUS fastboot_register(struct fastboot_cmd *cmd);
 EFI_STATUS fastboot_register_into(cmdlist_t *list, struct fastboot_cmd *cmd);
@@ -63,7 +68,20 @@ void fastboot_cmdlist_unregister(cmdlist_t *list);
 void fastboot_run_cmd(cmdlist_t list, const char *name, INTN argc, CHAR8 **argv);
 void fastboot_run_root_cmd(const char *name, INTN argc, CHAR8 **argv);
 
+/* A fastboot variable either has a constant VALUE or a GET_VALUE
+ * function called each time the host requests the variable.  Getters
+ * must not access the firmware before they are called so that
+ * variables can be published without slowing down fastboot start. */
+struct fastboot_var_def {
+	const char *name;
+	const char *value;
+	char *(*get_value)(void);
+};
+
 EFI_STATUS fastboot_publish(const char *name, const char *value);
+EFI_STATUS fastboot_publish_dynamic(const char *name, char *(get_value)(void));
+EFI_STATUS fastboot_publish_table(const struct fastboot_var_def *table,
+				  UINTN count);
 void fastboot_okay(const char *fmt, ...);
 void fastboot_fail(const char *fmt, ...);
 void fastboot_info(const char *fmt, ...);
@@ -76,7 +94,31 @@ EFI_STATUS fastboot_stop(void *bootimage, void *efiimage, UINTN imagesize,
 			 enum boot_target target);
 void fastboot_free(void);
 EFI_STATUS refresh_partition_var(void);
+EFI_STATUS fastboot_switch_storage(enum storage_type type);
 
 void fastboot_reboot(enum boot_target target, CHAR16 *msg);
 
+/* Long running commands are run as jobs.  A job is made of steps,
+ * STEP returns EFI_NOT_READY until the job is complete.  Steps are
+ * scheduled from the fastboot main loop which keeps the UI alive and
+ * regularly reports the job progress to the host with INFO
+ * messages.  END is called once with the job result and must send
+ * the final OKAY or FAIL message.  It is called with EFI_ABORTED if
+ * fastboot exits before the job completion. */
+struct fastboot_job {
+	const char *name;
+	EFI_STATUS (*step)(struct fastboot_job *job);
+	void (*end)(struct fastboot_job *job, EFI_STATUS ret);
+	UINT64 done;		/* Progress, in bytes if BYTES is set */
+	UINT64 total;
+	BOOLEAN bytes;
+	void *context;
+};
+
+EFI_STATUS fastboot_run_job(struct fastboot_job *job);
+
+/* When background jobs are disabled, fastboot_run_job() runs the job
+ * to completion before returning. */
+void fastboot_set_background_jobs(BOOLEAN enable);
+
 #endif	/* _FASTBOOT_H_ */
@@ -137,6 +137,11 @@ EFI_STATUS write_bcb(
                 IN const CHAR16 *label,
                 IN struct bootloader_message *bcb);
 
+/* Return the reason of this boot: RSCI wake source, RSCI reset source
+ * or the reboot reason set by the OS, "unknown" otherwise.  It is
+ * resolved on the first call, do not free the returned string. */
+const CHAR16 *get_boot_reason(void);
+
 /* Perform a security  RAM wipe */
 EFI_STATUS android_clear_memory(void);
 
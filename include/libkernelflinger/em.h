@@ -33,6 +33,19 @@
 #ifndef _EM_H_
 #define _EM_H_
 
+struct battery_sample {
+        BOOLEAN battery_valid;          /* Battery fields are meaningful */
+        BOOLEAN capacity_readable;
+        UINTN voltage;                  /* mV */
+        UINTN capacity;                 /* % */
+        BOOLEAN charger_valid;          /* Charger field is meaningful */
+        BOOLEAN charger_plugged_in;
+        EFI_TIME timestamp;             /* When the sample was read */
+};
+
+/* Return the last battery and charger sample.  The hardware is only
+ * queried if FORCE is set or if the cached sample is outdated. */
+EFI_STATUS em_get_battery_sample(struct battery_sample *sample, BOOLEAN force);
 BOOLEAN is_charger_plugged_in(void);
 BOOLEAN is_battery_below_boot_OS_threshold(void);
 EFI_STATUS get_battery_voltage(UINTN *voltage);
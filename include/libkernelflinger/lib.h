@@ -134,8 +134,19 @@ VOID halt_system(VOID) __attribute__ ((noreturn));
 
 VOID pause(UINTN seconds);
 
+UINT64 get_time_us(VOID);
+
 VOID reboot(CHAR16 *target) __attribute__ ((noreturn));
 
-EFI_STATUS alloc_aligned(VOID **free_addr, VOID **aligned_addr,
-                         UINTN size, UINTN align);
+/* Page backed buffers for block I/O.  ALIGN is the IoAlign value of
+ * the target media, 0 or 1 meaning no alignment requirement.  The
+ * buffer content is only zeroed if ZERO is TRUE.  Freed buffers are
+ * kept for reuse until io_buffer_release_all() is called or memory
+ * runs short, io_buffer_release() gives a buffer back to the
+ * firmware right away.  */
+EFI_STATUS io_buffer_alloc(UINTN size, UINT32 align, BOOLEAN zero,
+                           VOID **buffer);
+void io_buffer_free(VOID *buffer);
+void io_buffer_release(VOID *buffer);
+void io_buffer_release_all(void);
 #endif
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2026, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _LOG_STORE_H_
+#define _LOG_STORE_H_
+
+#include <efi.h>
+
+/* Persistent log store layout.
+ *
+ * The store is either the "logs" partition or, when the device does
+ * not have one, the LOG_STORE_FILE file of the ESP.  It is split in
+ * LOG_STORE_BLOCK_SIZE blocks used as a ring.  Each block starts with
+ * a struct log_store_block header followed by records, each record
+ * being a struct log_store_record header followed by the message
+ * characters (not NUL terminated).  Blocks are written as a whole,
+ * the most recent block is the valid one with the highest sequence
+ * number.  All the fields are little endian.  */
+#define LOG_STORE_MAGIC		0x474f4c4b /* "KLOG" */
+#define LOG_STORE_VERSION	1
+#define LOG_STORE_BLOCK_SIZE	(64 * 1024)
+#define LOG_STORE_LABEL		L"logs"
+#define LOG_STORE_FILE		L"logs/kernelflinger.bin"
+#define LOG_STORE_FILE_SIZE	(4 * 1024 * 1024)
+
+struct log_store_block {
+	UINT32 magic;
+	UINT16 version;
+	UINT16 header_size;
+	UINT64 seq;		/* Block sequence number */
+	UINT64 boot_seq;	/* Sequence number of the first block
+				   written by this boot */
+	UINT32 used;		/* Bytes used, header included */
+	UINT32 reserved;
+} __attribute__((packed));
+
+struct log_store_record {
+	UINT16 size;		/* Record size, header included */
+	UINT16 reserved;
+	UINT32 reserved2;
+	UINT64 timestamp;	/* Microseconds since the platform reset */
+} __attribute__((packed));
+
+void log_store_append(CHAR8 *msg, UINTN length);
+EFI_STATUS log_store_flush(void);
+
+/* Raw access to the store content, as laid out on the storage.  */
+EFI_STATUS log_store_get_size(UINT64 *size);
+EFI_STATUS log_store_read(UINT64 offset, VOID *data, UINTN size);
+
+#endif	/* _LOG_STORE_H_ */
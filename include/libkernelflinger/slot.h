@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2026, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _SLOT_H_
+#define _SLOT_H_
+
+#include <efi.h>
+#include <targets.h>
+
+/* A/B slots.
+ *
+ * A device supports slots when its partition table has "_a" and "_b"
+ * suffixed partitions (boot_a, boot_b, system_a, ...).  The slot
+ * metadata lives in the misc partition at SLOT_METADATA_OFFSET, right
+ * after the bootloader message.  The layout is the AOSP struct
+ * bootloader_control so that the Android boot_control HAL can mark a
+ * slot successful or switch the active slot before a reboot.  */
+#define SLOT_METADATA_OFFSET	2048
+#define SLOT_MAGIC		0x42414342 /* "BCAB" */
+#define SLOT_VERSION		1
+#define SLOT_COUNT		2
+#define SLOT_MAX_PRIORITY	15
+#define SLOT_MAX_RETRY		7
+#define SLOT_SUFFIX_LEN		2
+
+struct slot_info {
+	UINT8 priority:4;
+	UINT8 retry_count:3;
+	UINT8 successful:1;
+	UINT8 verity_corrupted:1;
+	UINT8 reserved:7;
+} __attribute__((packed));
+
+struct slot_metadata {
+	CHAR8 suffix[4];
+	UINT32 magic;
+	UINT8 version;
+	UINT8 nb_slot:3;
+	UINT8 recovery_retry_count:3;
+	UINT8 reserved0:2;
+	UINT8 reserved1[2];
+	struct slot_info slots[4];
+	UINT8 reserved2[8];
+	UINT32 crc32;
+} __attribute__((packed));
+
+/* Return TRUE if the partition table has A/B slots.  */
+BOOLEAN use_slot(void);
+
+/* Return the "_a" like suffix of the active slot, NULL if the device
+ * does not support slots.  */
+const CHAR16 *slot_get_active(void);
+
+/* Return the suffixes of the SLOT_COUNT slots.  */
+const CHAR16 **slot_get_suffixes(void);
+
+/* Return the label of the partition to use for BASE: BASE itself if
+ * this partition exists or if the device does not support slots,
+ * BASE followed by the active slot suffix otherwise.  The returned
+ * string is only valid until the next call.  */
+const CHAR16 *slot_label(const CHAR16 *base);
+
+/* Make SUFFIX ("_a", "a", ...) the active slot.  The slot gets the
+ * highest priority and a full retry count.  */
+EFI_STATUS slot_set_active(const CHAR16 *suffix);
+
+/* Select the slot to boot TARGET from.  For a NORMAL_BOOT, a slot
+ * that has not been marked successful by the OS yet consumes one of
+ * its retries; once the retries are exhausted, the slot is no longer
+ * bootable and the next slot by priority is selected.  Return
+ * EFI_NOT_FOUND if no slot is bootable.  */
+EFI_STATUS slot_boot(enum boot_target target);
+
+/* Drop the cached slot metadata.  It must be called when the misc
+ * partition is written by other means than the slot functions.  */
+void slot_invalidate_metadata(void);
+
+/* Slot properties, for the fastboot variables.  */
+BOOLEAN slot_is_successful(const CHAR16 *suffix);
+BOOLEAN slot_is_bootable(const CHAR16 *suffix);
+UINTN slot_retry_count(const CHAR16 *suffix);
+
+#endif	/* _SLOT_H_ */
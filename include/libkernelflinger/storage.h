@@ -58,11 +58,14 @@ struct storage {
 
 EFI_STATUS identify_boot_device(enum storage_type type);
 PCI_DEVICE_PATH *get_boot_device(void);
+EFI_STATUS get_boot_device_type(enum storage_type *type);
 EFI_STATUS storage_set_boot_device(EFI_HANDLE device);
 EFI_STATUS storage_check_logical_unit(EFI_DEVICE_PATH *p, logical_unit_t log_unit);
 EFI_STATUS storage_erase_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, UINT64 start, UINT64 end);
 EFI_STATUS fill_with(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end,
 		     VOID *pattern, UINTN pattern_blocks);
+EFI_STATUS fill_zero_with(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end,
+			  VOID *buffer, UINTN buffer_blocks, UINT64 *skipped);
 EFI_STATUS fill_zero(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end);
 
 #endif	/* _STORAGE_H_ */
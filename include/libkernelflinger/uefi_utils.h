@@ -56,4 +56,14 @@ EFI_STATUS find_device_partition(const EFI_GUID *guid, EFI_HANDLE **handles, UIN
 EFI_STATUS uefi_create_directory(EFI_FILE *parent, CHAR16 *dirname);
 EFI_STATUS uefi_create_directory_root(EFI_FILE_IO_INTERFACE *io, CHAR16 *dirname);
 
+/* Streaming file access with caller supplied buffers */
+EFI_STATUS uefi_file_open(EFI_FILE_IO_INTERFACE *io, CHAR16 *filename,
+			  UINT64 mode, EFI_FILE **file);
+EFI_STATUS uefi_file_get_size(EFI_FILE *file, UINT64 *size);
+EFI_STATUS uefi_file_preallocate(EFI_FILE *file, UINT64 size);
+EFI_STATUS uefi_file_read_chunk(EFI_FILE *file, void *data, UINTN *size);
+EFI_STATUS uefi_file_write_chunk(EFI_FILE *file, void *data, UINTN size);
+EFI_STATUS uefi_file_close(EFI_FILE *file);
+void uefi_dir_cache_flush(void);
+
 #endif /* __UEFI_UTILS_H__ */
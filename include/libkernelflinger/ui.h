@@ -146,6 +146,7 @@ typedef struct ui_boot_menu {
 	UINTN cur;
 	UINTN x;
 	UINTN y;
+	UINTN y_end;
 	UINTN max_width;
 } ui_boot_menu_t;
 ui_boot_menu_t *ui_boot_menu_create(ui_boot_action_t *actions);
@@ -181,4 +182,16 @@ void ui_bilinear_scale(unsigned char *s, unsigned char *d,
 		       int sx, int sy, int dx, int dy,
 		       int depth);
 
+/* Off-screen framebuffer.  Between ui_fb_begin() and ui_fb_end(), the
+ * drawing functions render into an off-screen framebuffer and
+ * ui_fb_flush() blits the modified area to the screen.  The base is
+ * a saved framebuffer, identified by ID, to restore a background
+ * shared by several screens.  */
+EFI_STATUS ui_fb_begin(void);
+EFI_STATUS ui_fb_flush(void);
+EFI_STATUS ui_fb_end(void);
+void ui_fb_save_base(const void *id);
+const void *ui_fb_base_id(void);
+void ui_fb_restore_base_area(UINTN x, UINTN y, UINTN width, UINTN height);
+
 #endif  /* _UI_H_ */
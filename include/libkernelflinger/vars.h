@@ -106,9 +106,8 @@ EFI_STATUS set_user_keystore(VOID *keystore, UINTN size);
 EFI_STATUS get_user_keystore(VOID **keystorep, UINTN *sizep);
 BOOLEAN device_is_provisioning(void);
 EFI_STATUS get_watchdog_status(UINT8 *counter, EFI_TIME *time);
+EFI_STATUS set_watchdog_status(UINT8 counter, EFI_TIME *time);
 EFI_STATUS reset_watchdog_status(VOID);
-EFI_STATUS set_watchdog_counter(UINT8 counter);
-EFI_STATUS set_watchdog_time_reference(EFI_TIME *time);
 char *get_serial_number(void);
 BOOLEAN get_display_splash(void);
 char *get_property_bootloader(void);
@@ -83,7 +83,7 @@ static EFI_STATUS read_file(EFI_FILE *file, UINTN size, void *data)
 	EFI_STATUS ret;
 	UINTN nsize = size;
 
-	ret = uefi_call_wrapper(file->Read, 3, file, &nsize, data);
+	ret = uefi_file_read_chunk(file, data, &nsize);
 	if (EFI_ERROR(ret)) {
 		inst_perror(ret, "Failed to read file");
 		return ret;
@@ -121,18 +121,18 @@ static void installer_split_and_flash(CHAR16 *filename, UINTN size,
 
 	ret = read_file(file, sizeof(sph), &sph);
 	if (EFI_ERROR(ret))
-		return;
+		goto close;
 	remaining_data -= sizeof(sph);
 
 	if (!is_sparse_image((void *) &sph, sizeof(sph))) {
 		fastboot_fail("sparse file expected");
-		return;
+		goto close;
 	}
 
 	buf = AllocatePool(MAX_DOWNLOAD_SIZE);
 	if (!buf) {
 		fastboot_fail("Failed to allocate %d bytes", MAX_DOWNLOAD_SIZE);
-		return;
+		goto close;
 	}
 	data = buf;
 
@@ -215,6 +215,8 @@ static void installer_split_and_flash(CHAR16 *filename, UINTN size,
 
 exit:
 	FreePool(buf);
+close:
+	uefi_file_close(file);
 }
 
 static void installer_flash_cmd(INTN argc, CHAR8 **argv)
@@ -289,6 +291,34 @@ static CHAR16 *get_format_image_filename(CHAR8 *label)
 	return filename16;
 }
 
+/* Generate an empty ext4 filesystem on the device, for partitions
+   the batch file asks to format without providing an image. */
+static void installer_format_empty(INTN argc, CHAR8 **argv)
+{
+	EFI_STATUS ret;
+	CHAR16 *label;
+
+	if (argc != 2) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	label = stra_to_str(argv[1]);
+	if (!label) {
+		fastboot_fail("Failed to convert CHAR8 label to CHAR16");
+		return;
+	}
+
+	ret = format_by_label(label);
+	FreePool(label);
+	if (EFI_ERROR(ret)) {
+		inst_perror(ret, "Failed to format %a", argv[1]);
+		return;
+	}
+
+	fastboot_okay("");
+}
+
 /* Simulate the fastboot host format command:
    1. get a filesystem image from a file;
    2. erase the partition;
@@ -330,6 +360,7 @@ free_filename:
 static char **commands;
 static UINTN command_nb;
 static UINTN current_command;
+static UINT64 command_start;
 
 static void free_commands(void)
 {
@@ -423,6 +454,7 @@ static void usage(__attribute__((__unused__)) INTN argc,
 	Print(L"Usage: installer [OPTIONS | COMMANDS]\n");
 	Print(L"  installer is an EFI application acting like the fastboot command.\n\n");
 	Print(L" COMMANDS               fastboot commands (cf. the fastboot manual page)\n");
+	Print(L"   format-empty LABEL   write an empty ext4 filesystem on LABEL\n");
 	Print(L" --help, -h             print this help and exit\n");
 	Print(L" --batch, -b FILE       run all the fastboot commands of FILE\n");
 	Print(L"If no option is provided, the installer assumes '%a'\n", DEFAULT_OPTIONS);
@@ -444,6 +476,7 @@ static struct replacements {
 	/* Fastboot changes. */
 	{ { "flash",	UNKNOWN_STATE,	installer_flash_cmd },	&fastboot_flash_cmd },
 	{ { "format",	VERIFIED,	installer_format    },	NULL },
+	{ { "format-empty", VERIFIED,	installer_format_empty }, NULL },
 	/* Unsupported commands. */
 	{ { "update",	UNKNOWN_STATE, unsupported_cmd	    },	NULL },
 	{ { "flashall",	UNKNOWN_STATE, unsupported_cmd	    },	NULL },
@@ -528,7 +561,9 @@ EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *_table)
 	store_command(*options != '\0' ? (char *)options : (char *)DEFAULT_OPTIONS,
 		      NULL);
 
-	/* Run the fastboot library. */
+	/* Run the fastboot library.  Commands are chained by the
+	   batch, they must complete before returning.  */
+	fastboot_set_background_jobs(FALSE);
 	ret = fastboot_start(&bootimage, &efiimage, &imagesize, &target);
 	if (EFI_ERROR(ret))
 		goto exit;
@@ -598,7 +633,8 @@ EFI_STATUS fastboot_usb_run(void)
 		flush_tx_buffer();
 		if (!last_cmd_succeeded)
 			goto stop;
-		Print(L"Command successfully executed\n");
+		Print(L"Command successfully executed (%ld us)\n",
+		      get_time_us() - command_start);
 	}
 
 	cmd = next_command();
@@ -615,6 +651,7 @@ EFI_STATUS fastboot_usb_run(void)
 	memcpy(fastboot_cmd_buf, cmd, cmd_len);
 
 	Print(L"Starting command: '%a'\n", cmd);
+	command_start = get_time_us();
 	fastboot_rx_cb(fastboot_cmd_buf, cmd_len);
 
 	return EFI_SUCCESS;
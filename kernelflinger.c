@@ -55,6 +55,8 @@
 #include "blobstore.h"
 #endif
 #include "oemvars.h"
+#include "slot.h"
+#include "log_store.h"
 
 /* Ensure this is embedded in the EFI binary somewhere */
 static const char __attribute__((used)) magic[] = "### KERNELFLINGER ###";
@@ -385,22 +387,16 @@ static enum boot_target check_watchdog(VOID)
                         counter = 0;
         }
 
-        if (counter == 0) {
+        if (counter == 0)
                 time_ref = now;
-                ret = set_watchdog_time_reference(&now);
-                if (EFI_ERROR(ret)) {
-                        efi_perror(ret, L"Failed to set the watchdog time reference");
-                        goto error;
-                }
-        }
 
         counter++;
         debug(L"Reset source = %d : incrementing watchdog counter (%d)", reset_source, counter);
 
         if (counter <= WATCHDOG_COUNTER_MAX) {
-                        ret = set_watchdog_counter(counter);
+                        ret = set_watchdog_status(counter, &time_ref);
                         if (EFI_ERROR(ret))
-                                efi_perror(ret, L"Failed to set the watchdog counter");
+                                efi_perror(ret, L"Failed to set the watchdog status");
                         goto error;
         }
 
@@ -505,13 +501,105 @@ static enum boot_target check_charge_mode()
         return NORMAL_BOOT;
 }
 
+/* Charge in the bootloader until the battery reaches the boot OS
+ * threshold.  The CPU sleeps in WaitForEvent() between two frames of
+ * the dimmed charging animation and the fuel gauge, slow to query,
+ * is only sampled every CHARGING_SAMPLE_FRAMES frames.  A key press
+ * restores the full brightness for CHARGING_WAKE_FRAMES frames.
+ *
+ * Return NORMAL_BOOT once the threshold is reached, POWER_OFF if the
+ * charger is unplugged and CHARGER if the loop cannot run.  */
+#define CHARGING_FRAME_PERIOD   (1 * 1000 * 1000 * 10) /* 100ns unit, 1 second */
+#define CHARGING_SAMPLE_FRAMES  30
+#define CHARGING_WAKE_FRAMES    10
+#define CHARGING_LEVEL_UNKNOWN  ((UINTN)-1)
+
+static enum boot_target charging_loop(VOID)
+{
+        struct battery_sample sample;
+        enum boot_target target;
+        EFI_INPUT_KEY key;
+        EFI_EVENT events[2];
+        EFI_STATUS ret;
+        UINTN index, frame = 0, next_sample = 0;
+        UINTN level = CHARGING_LEVEL_UNKNOWN, wake = CHARGING_WAKE_FRAMES;
+
+        /* Charging can take hours, do not let the boot manager
+         * watchdog reset the device */
+        ret = uefi_call_wrapper(BS->SetWatchdogTimer, 4, 0, 0, 0, NULL);
+        if (EFI_ERROR(ret) && ret != EFI_UNSUPPORTED)
+                efi_perror(ret, L"Couldn't disable watchdog timer");
+
+        ret = uefi_call_wrapper(BS->CreateEvent, 5, EVT_TIMER, 0, NULL,
+                                NULL, &events[0]);
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Failed to create the charging timer");
+                return CHARGER;
+        }
+
+        ret = uefi_call_wrapper(BS->SetTimer, 3, events[0], TimerPeriodic,
+                                CHARGING_FRAME_PERIOD);
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Failed to arm the charging timer");
+                target = CHARGER;
+                goto out;
+        }
+        events[1] = ST->ConIn->WaitForKey;
+
+        for (;;) {
+                if (frame == next_sample) {
+                        next_sample = frame + CHARGING_SAMPLE_FRAMES;
+                        ret = em_get_battery_sample(&sample, TRUE);
+                        if (sample.charger_valid && !sample.charger_plugged_in) {
+                                debug(L"Charger unplugged");
+                                target = POWER_OFF;
+                                break;
+                        }
+                        if (!is_battery_below_boot_OS_threshold()) {
+                                debug(L"Battery reached the boot OS threshold");
+                                target = NORMAL_BOOT;
+                                break;
+                        }
+                        level = !EFI_ERROR(ret) && sample.capacity_readable ?
+                                sample.capacity : CHARGING_LEVEL_UNKNOWN;
+                }
+
+                ux_display_charging(level, frame, wake == 0);
+
+                ret = uefi_call_wrapper(BS->WaitForEvent, 3, 2, events, &index);
+                if (EFI_ERROR(ret)) {
+                        efi_perror(ret, L"Failed to wait for charging events");
+                        target = CHARGER;
+                        break;
+                }
+
+                if (index == 0) {
+                        frame++;
+                        if (wake)
+                                wake--;
+                        continue;
+                }
+
+                while (uefi_call_wrapper(ST->ConIn->ReadKeyStroke, 2,
+                                         ST->ConIn, &key) == EFI_SUCCESS)
+                        ;
+                wake = CHARGING_WAKE_FRAMES;
+        }
+
+out:
+        uefi_call_wrapper(BS->CloseEvent, 1, events[0]);
+        return target;
+}
+
 enum boot_target check_battery()
 {
         if (is_battery_below_boot_OS_threshold()) {
                 BOOLEAN charger_plugged = is_charger_plugged_in();
                 debug(L"Battery is below boot OS threshold");
                 debug(L"Charger is%s plugged", charger_plugged ? L"" : L" not");
-                return charger_plugged ? CHARGER : POWER_OFF;
+                if (!charger_plugged)
+                        return POWER_OFF;
+                return charging_loop();
         }
 
         return NORMAL_BOOT;
@@ -670,7 +758,8 @@ static EFI_STATUS validate_bootimage(
  * against it.
  *
  * boot_target - Boot image to load. Values supported are NORMAL_BOOT, RECOVERY,
- *               and ESP_BOOTIMAGE (for 'fastboot boot')
+ *               and ESP_BOOTIMAGE (for 'fastboot boot').  On A/B devices,
+ *               the partition of the selected slot is used.
  * keystore    - Keystore to validate image with. If null, no validation
  *               done.
  * keystore_size - Size of keystore in bytes
@@ -699,10 +788,15 @@ static EFI_STATUS load_boot_image(
         switch (boot_target) {
         case NORMAL_BOOT:
         case CHARGER:
-                ret = android_image_load_partition(BOOT_LABEL, bootimage);
-                break;
         case RECOVERY:
-                ret = android_image_load_partition(RECOVERY_LABEL, bootimage);
+                *bootimage = NULL;
+                ret = slot_boot(boot_target);
+                if (EFI_ERROR(ret))
+                        return ret;
+                ret = android_image_load_partition(
+                        slot_label(boot_target == RECOVERY ?
+                                   RECOVERY_LABEL : BOOT_LABEL),
+                        bootimage);
                 break;
         case ESP_BOOTIMAGE:
                 /* "fastboot boot" case */
@@ -749,6 +843,7 @@ static EFI_STATUS enter_efi_binary(CHAR16 *path, BOOLEAN delete)
                         if (EFI_ERROR(ret))
                                 efi_perror(ret, L"Couldn't delete %s", path);
                 }
+                log_store_flush();
                 ret = uefi_call_wrapper(BS->StartImage, 3, image, NULL, NULL);
                 uefi_call_wrapper(BS->UnloadImage, 1, image);
         }
@@ -972,6 +1067,7 @@ static VOID enter_fastboot_mode(UINT8 boot_state, VOID *bootimage)
                                 efi_perror(ret, L"Unable to load the received EFI image");
                                 continue;
                         }
+                        log_store_flush();
                         ret = uefi_call_wrapper(BS->StartImage, 3, image, NULL, NULL);
                         if (EFI_ERROR(ret))
                                 efi_perror(ret, L"Unable to start the received EFI image");
@@ -1132,8 +1228,10 @@ EFI_STATUS efi_main(EFI_HANDLE image, EFI_SYSTEM_TABLE *sys_table)
         /* No UX prompts before this point, do not want to interfere
          * with magic key detection */
         boot_target = choose_boot_target(&target_address, &target_path, &oneshot);
-        if (boot_target == EXIT_SHELL)
+        if (boot_target == EXIT_SHELL) {
+                log_store_flush();
                 return EFI_SUCCESS;
+        }
 
         if (boot_target == POWER_OFF)
                 halt_system();
@@ -13,6 +13,7 @@ SHARED_SRC_FILES := \
 	fastboot_oem.c \
 	flash.c \
 	sparse.c \
+	ext4.c \
 	info.c \
 	intel_variables.c \
 	bootmgr.c \
@@ -44,49 +44,85 @@ typedef struct {
 	EFI_DEVICE_PATH file_path_list[1]; /* variable length field */
 } __attribute__((packed)) EFI_LOAD_OPTION;
 
-static EFI_STATUS find_free_entry(UINT16 *entry)
+/* Index of the existing load options and of the boot order, built in
+ * a single pass over the variable store.  Existing load options are
+ * looked up by description and new entries are allocated from the
+ * USED bitmap instead of probing each Boot#### variable.  */
+struct load_option_entry {
+	UINT16 number;
+	EFI_LOAD_OPTION *data;
+	UINTN size;
+};
+
+static struct {
+	struct load_option_entry *entries;
+	UINTN entry_nb;
+	UINT8 used[(0xFFFF + 1) / 8];
+	UINT16 *boot_order;
+	UINTN boot_order_size;
+} lo_index;
+
+static BOOLEAN is_load_option_name(CHAR16 *name)
 {
-	EFI_STATUS ret;
-	CHAR8 data;
-	CHAR16 name[BOOTOPTION_LEN + 1];
-	UINTN i, len, size;
-        UINT32 flags;
-
-	for (i = 0; i <= 0xFFFF; i++) {
-		len = SPrint(name, sizeof(name), VarBootOption, i);
-		if (len != BOOTOPTION_LEN) {
-			error(L"Failed to format load option variable name");
-			return EFI_UNSUPPORTED;
-		}
-		size = sizeof(data);
-		ret = uefi_call_wrapper(RT->GetVariable, 5, name, &EfiGlobalVariable,
-					&flags, &size, &data);
-		if (ret == EFI_NOT_FOUND) {
-			*entry = i;
-			return EFI_SUCCESS;
-		}
-		if (ret == EFI_BUFFER_TOO_SMALL)
-			continue;
-		if (EFI_ERROR(ret)) {
-			efi_perror(ret, L"Failed to read '%s' variable", name);
-			return ret;
-		}
-	}
+	UINTN i;
 
-	return EFI_NOT_FOUND;
+	if (StrLen(name) != BOOTOPTION_LEN ||
+	    memcmp(L"Boot", name, StrLen(L"Boot") * sizeof(CHAR16)))
+		return FALSE;
+
+	for (i = StrLen(L"Boot"); i < BOOTOPTION_LEN; i++)
+		if (!((name[i] >= '0' && name[i] <= '9') ||
+		      (name[i] >= 'A' && name[i] <= 'F')))
+			return FALSE;
+
+	return TRUE;
+}
+
+static void index_free(void)
+{
+	UINTN i;
+
+	for (i = 0; i < lo_index.entry_nb; i++)
+		FreePool(lo_index.entries[i].data);
+	if (lo_index.entries)
+		FreePool(lo_index.entries);
+	if (lo_index.boot_order)
+		FreePool(lo_index.boot_order);
+	memset(&lo_index, 0, sizeof(lo_index));
+}
+
+static EFI_STATUS index_add(UINT16 number, EFI_LOAD_OPTION *data, UINTN size)
+{
+	struct load_option_entry *entries;
+
+	entries = ReallocatePool(lo_index.entries,
+				 lo_index.entry_nb * sizeof(*entries),
+				 (lo_index.entry_nb + 1) * sizeof(*entries));
+	if (!entries)
+		return EFI_OUT_OF_RESOURCES;
+
+	entries[lo_index.entry_nb].number = number;
+	entries[lo_index.entry_nb].data = data;
+	entries[lo_index.entry_nb].size = size;
+	lo_index.entries = entries;
+	lo_index.entry_nb++;
+	lo_index.used[number / 8] |= 1 << (number % 8);
+
+	return EFI_SUCCESS;
 }
 
-static EFI_STATUS find_load_option_entry(CHAR16 *description, UINT16 *entry)
+static EFI_STATUS index_build(void)
 {
 	EFI_STATUS ret;
 	UINTN bufsize, namesize;
 	CHAR16 *name;
 	EFI_GUID guid;
-	CHAR8 number[5];
 	UINTN size;
-	EFI_LOAD_OPTION *load_option;
+	VOID *data;
 	UINT32 flags;
 
+	index_free();
+
 	bufsize = 64;		/* Initial size large enough to handle
 				   usual variable names length and
 				   avoid the ReallocatePool as much as
@@ -101,13 +137,16 @@ static EFI_STATUS find_load_option_entry(CHAR16 *description, UINT16 *entry)
 		namesize = bufsize;
 		ret = uefi_call_wrapper(RT->GetNextVariableName, 3, &namesize,
 					name, &guid);
-		if (ret == EFI_NOT_FOUND)
+		if (ret == EFI_NOT_FOUND) {
+			ret = EFI_SUCCESS;
 			break;
+		}
 		if (ret == EFI_BUFFER_TOO_SMALL) {
 			name = ReallocatePool(name, bufsize, namesize);
 			if (!name) {
 				error(L"Failed to re-allocate variable name buffer");
-				return EFI_OUT_OF_RESOURCES;
+				ret = EFI_OUT_OF_RESOURCES;
+				goto exit;
 			}
 			bufsize = namesize;
 			continue;
@@ -118,38 +157,85 @@ static EFI_STATUS find_load_option_entry(CHAR16 *description, UINT16 *entry)
 		}
 		if (memcmp(&EfiGlobalVariable, &guid, sizeof(guid)))
 			continue;
-		if (!(StrLen(name) == StrLen(L"Boot0000") &&
-		      !memcmp(L"Boot", name, StrLen(L"Boot") * sizeof(CHAR16)) &&
-		      isalnum(name[4]) && isalnum(name[5]) &&
-		      isalnum(name[6]) && isalnum(name[7])))
+
+		if (!StrCmp(name, VarBootOrder)) {
+			ret = get_efi_variable(&guid, name, &lo_index.boot_order_size,
+					       (VOID **)&lo_index.boot_order, &flags);
+			if (EFI_ERROR(ret)) {
+				efi_perror(ret, L"Failed to read '%s' variable", name);
+				goto exit;
+			}
+			continue;
+		}
+
+		if (!is_load_option_name(name))
 			continue;
 
-		ret = get_efi_variable(&guid, name, &size, (VOID **)&load_option, &flags);
+		ret = get_efi_variable(&guid, name, &size, &data, &flags);
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, L"Failed to read '%s' variable", name);
 			goto exit;
 		}
 
-		if (size < sizeof(EFI_LOAD_OPTION) + StrSize(description) ||
-		    StrCmp(load_option->description, description)) {
-			FreePool(load_option);
-			continue;
-		}
-		FreePool(load_option);
-
-		ret = str_to_stra(number, &name[StrLen(L"Boot")], sizeof(number));
-		if (EFI_ERROR(ret))
+		ret = index_add(strtoul16(&name[StrLen(L"Boot")], NULL, 16),
+				data, size);
+		if (EFI_ERROR(ret)) {
+			FreePool(data);
 			goto exit;
-
-		*entry = strtoul((char *)number, NULL, 16);
-		return EFI_SUCCESS;
+		}
 	}
 
 exit:
 	FreePool(name);
+	if (EFI_ERROR(ret))
+		index_free();
 	return ret;
 }
 
+static struct load_option_entry *index_find(CHAR16 *description)
+{
+	struct load_option_entry *entry;
+	UINTN i;
+
+	for (i = 0; i < lo_index.entry_nb; i++) {
+		entry = &lo_index.entries[i];
+		if (entry->size >= sizeof(EFI_LOAD_OPTION) + StrSize(description) &&
+		    !StrCmp(entry->data->description, description))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static EFI_STATUS index_find_free_entry(UINT16 *entry)
+{
+	UINTN i;
+
+	for (i = 0; i <= 0xFFFF; i++)
+		if (!(lo_index.used[i / 8] & (1 << (i % 8)))) {
+			*entry = i;
+			return EFI_SUCCESS;
+		}
+
+	return EFI_NOT_FOUND;
+}
+
+/* Take ownership of DATA as the new content of the NUMBER entry.  */
+static EFI_STATUS index_update(UINT16 number, EFI_LOAD_OPTION *data, UINTN size)
+{
+	UINTN i;
+
+	for (i = 0; i < lo_index.entry_nb; i++)
+		if (lo_index.entries[i].number == number) {
+			FreePool(lo_index.entries[i].data);
+			lo_index.entries[i].data = data;
+			lo_index.entries[i].size = size;
+			return EFI_SUCCESS;
+		}
+
+	return index_add(number, data, size);
+}
+
 static UINTN buf_size;
 static CHAR8 *buffer;
 
@@ -179,6 +265,7 @@ static void free_buffer()
 {
 	if (buffer)
 		FreePool(buffer);
+	buffer = NULL;
 	buf_size = 0;
 }
 
@@ -239,7 +326,7 @@ static EFI_STATUS set_device_path(CHAR16 *part_label, CHAR16 *bootloader_path)
 }
 
 static EFI_STATUS create_load_option(CHAR16 *part_label, load_option_t *load_option,
-				     UINT16 entry)
+				     struct load_option_entry *cur, UINT16 entry)
 {
 	EFI_STATUS ret;
 	EFI_LOAD_OPTION *efi_load_option;
@@ -276,10 +363,25 @@ static EFI_STATUS create_load_option(CHAR16 *part_label, load_option_t *load_opt
 	efi_load_option = (EFI_LOAD_OPTION *)buffer;
 	efi_load_option->attributes = LOAD_OPTION_ACTIVE;
 	efi_load_option->file_path_list_length = buf_size - header_size;
+
+	if (cur && cur->size == buf_size && !memcmp(cur->data, buffer, buf_size)) {
+		debug(L"'%s' load option is up to date", varname);
+		goto exit;
+	}
+
 	ret = set_efi_variable(&EfiGlobalVariable, varname, buf_size,
 			       efi_load_option, TRUE, TRUE);
-	if (EFI_ERROR(ret))
+	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to write '%s' variable", varname);
+		goto exit;
+	}
+
+	/* The index takes the buffer ownership */
+	ret = index_update(entry, efi_load_option, buf_size);
+	if (!EFI_ERROR(ret)) {
+		buffer = NULL;
+		buf_size = 0;
+	}
 
 exit:
 	free_buffer();
@@ -300,23 +402,15 @@ static BOOLEAN is_in_set(UINT16 value, UINT16 *set, UINTN set_length)
 static EFI_STATUS install_in_boot_order(UINT16 *entries, UINTN entry_nb)
 {
 	EFI_STATUS ret;
-	UINT16 *old_entries = NULL;
+	UINT16 *old_entries = lo_index.boot_order;
 	UINT16 *new_entries;
-	UINTN size = 0;
+	UINTN size = lo_index.boot_order_size;
 	UINTN new_size, i, j;
-	UINT32 flags;
 	UINTN missing = entry_nb;
 
-	ret = get_efi_variable(&EfiGlobalVariable, VarBootOrder, &size,
-			       (VOID **)&old_entries, &flags);
-	if (EFI_ERROR(ret) && ret != EFI_NOT_FOUND) {
-		efi_perror(ret, L"Failed to read '%s' variable", VarBootOrder);
-		return ret;
-	}
-
 	if (size >= (entry_nb * sizeof(*old_entries)) &&
 	    !memcmp(entries, old_entries, entry_nb * sizeof(*old_entries)))
-		goto exit;
+		return EFI_SUCCESS;
 
 	for (i = 0; i < entry_nb; i++)
 		if (is_in_set(entries[i], old_entries, size / sizeof(*old_entries)))
@@ -330,8 +424,7 @@ static EFI_STATUS install_in_boot_order(UINT16 *entries, UINTN entry_nb)
 	new_entries = AllocatePool(new_size);
 	if (!new_entries) {
 		error(L"Failed to allocate new entries for '%s'", VarBootOrder);
-		ret = EFI_OUT_OF_RESOURCES;
-		goto exit;
+		return EFI_OUT_OF_RESOURCES;
 	}
 
 	memcpy(new_entries, entries, entry_nb * sizeof(*entries));
@@ -343,15 +436,18 @@ static EFI_STATUS install_in_boot_order(UINT16 *entries, UINTN entry_nb)
 
 	ret = set_efi_variable(&EfiGlobalVariable, VarBootOrder, new_size, new_entries,
 			       TRUE, TRUE);
-	if (EFI_ERROR(ret))
+	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to set '%s' variable", VarBootOrder);
+		FreePool(new_entries);
+		return ret;
+	}
 
-	FreePool(new_entries);
-
-exit:
 	if (old_entries)
 		FreePool(old_entries);
-	return ret;
+	lo_index.boot_order = new_entries;
+	lo_index.boot_order_size = new_size;
+
+	return EFI_SUCCESS;
 }
 
 EFI_STATUS bootmgr_register_entries(CHAR16 *part_label,
@@ -370,22 +466,27 @@ EFI_STATUS bootmgr_register_entries(CHAR16 *part_label,
 	if (!entries)
 		return EFI_OUT_OF_RESOURCES;
 
+	ret = index_build();
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to index the existing load options");
+		goto exit;
+	}
+
 	for (i = 0; i < load_option_nb; i++) {
-		ret = find_load_option_entry(load_options[i].description, &entries[i]);
-		if (EFI_ERROR(ret) && ret != EFI_NOT_FOUND) {
-			efi_perror(ret, L"Failed to Look up for the existant load option");
-			goto exit;
-		}
+		struct load_option_entry *cur;
 
-		if (ret == EFI_NOT_FOUND) {
-			ret = find_free_entry(&entries[i]);
+		cur = index_find(load_options[i].description);
+		if (cur)
+			entries[i] = cur->number;
+		else {
+			ret = index_find_free_entry(&entries[i]);
 			if (EFI_ERROR(ret)) {
 				efi_perror(ret, L"Failed to find a new free load option entry");
 				goto exit;
 			}
 		}
 
-		ret = create_load_option(part_label, &load_options[i], entries[i]);
+		ret = create_load_option(part_label, &load_options[i], cur, entries[i]);
 		if (EFI_ERROR(ret)) {
 			efi_perror(ret, L"Failed to create/update the load option");
 			goto exit;
@@ -397,6 +498,7 @@ EFI_STATUS bootmgr_register_entries(CHAR16 *part_label,
 		efi_perror(ret, L"Failed to set the boot order");
 
 exit:
+	index_free();
 	FreePool(entries);
 	return ret;
 }
@@ -0,0 +1,710 @@
+/*
+ * Copyright (c) 2026, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+#include <lib.h>
+
+#include "sparse_format.h"
+#include "ext4.h"
+
+/* Minimal ext4 layout, close to what mke2fs generates with the
+ * "uninit_bg" feature: 4 KiB blocks, no flex_bg and no resize inode.
+ * Only the first block group holds initialized inodes and blocks
+ * (root directory, lost+found and journal), the other groups are
+ * flagged uninitialized so that neither their bitmaps nor their inode
+ * tables need to be written.  */
+#define BLOCK_SIZE		4096
+#define LOG_BLOCK_SIZE		2	/* 1024 << 2 */
+#define BLOCKS_PER_GROUP	(BLOCK_SIZE * 8)
+#define INODE_SIZE		256
+#define INODES_PER_BLOCK	(BLOCK_SIZE / INODE_SIZE)
+#define INODE_RATIO		16384
+#define DESC_SIZE		32
+#define MIN_BLOCKS		64
+#define MAX_JOURNAL_BLOCKS	16384
+
+#define EXT4_SUPER_MAGIC	0xEF53
+#define EXT4_EXT_MAGIC		0xF30A
+#define JBD2_MAGIC		0xC03B3998
+#define JBD2_SUPERBLOCK_V2	4
+
+#define ROOT_INO		2
+#define JOURNAL_INO		8
+#define FIRST_INO		11	/* lost+found */
+#define DIR_BLOCKS		2	/* root and lost+found */
+
+#define COMPAT_HAS_JOURNAL	0x0004
+#define COMPAT_EXT_ATTR		0x0008
+#define COMPAT_DIR_INDEX	0x0020
+#define INCOMPAT_FILETYPE	0x0002
+#define INCOMPAT_EXTENTS	0x0040
+#define RO_COMPAT_SPARSE_SUPER	0x0001
+#define RO_COMPAT_LARGE_FILE	0x0002
+#define RO_COMPAT_HUGE_FILE	0x0008
+#define RO_COMPAT_GDT_CSUM	0x0010
+#define RO_COMPAT_DIR_NLINK	0x0020
+#define RO_COMPAT_EXTRA_ISIZE	0x0040
+
+#define BG_INODE_UNINIT		0x0001
+#define BG_BLOCK_UNINIT		0x0002
+#define BG_INODE_ZEROED		0x0004
+
+#define DEFM_XATTR_USER		0x0004
+#define DEFM_ACL		0x0008
+#define FLAGS_SIGNED_HASH	0x0001
+#define HASH_HALF_MD4		1
+#define JNL_BACKUP_BLOCKS	1
+
+#define EXTENTS_FL		0x00080000
+#define S_IFDIR			0040000
+#define S_IFREG			0100000
+#define FT_DIR			2
+
+struct ext4_super_block {
+	UINT32 s_inodes_count;
+	UINT32 s_blocks_count_lo;
+	UINT32 s_r_blocks_count_lo;
+	UINT32 s_free_blocks_count_lo;
+	UINT32 s_free_inodes_count;
+	UINT32 s_first_data_block;
+	UINT32 s_log_block_size;
+	UINT32 s_log_cluster_size;
+	UINT32 s_blocks_per_group;
+	UINT32 s_clusters_per_group;
+	UINT32 s_inodes_per_group;
+	UINT32 s_mtime;
+	UINT32 s_wtime;
+	UINT16 s_mnt_count;
+	UINT16 s_max_mnt_count;
+	UINT16 s_magic;
+	UINT16 s_state;
+	UINT16 s_errors;
+	UINT16 s_minor_rev_level;
+	UINT32 s_lastcheck;
+	UINT32 s_checkinterval;
+	UINT32 s_creator_os;
+	UINT32 s_rev_level;
+	UINT16 s_def_resuid;
+	UINT16 s_def_resgid;
+	UINT32 s_first_ino;
+	UINT16 s_inode_size;
+	UINT16 s_block_group_nr;
+	UINT32 s_feature_compat;
+	UINT32 s_feature_incompat;
+	UINT32 s_feature_ro_compat;
+	UINT8 s_uuid[16];
+	char s_volume_name[16];
+	char s_last_mounted[64];
+	UINT32 s_algorithm_usage_bitmap;
+	UINT8 s_prealloc_blocks;
+	UINT8 s_prealloc_dir_blocks;
+	UINT16 s_reserved_gdt_blocks;
+	UINT8 s_journal_uuid[16];
+	UINT32 s_journal_inum;
+	UINT32 s_journal_dev;
+	UINT32 s_last_orphan;
+	UINT32 s_hash_seed[4];
+	UINT8 s_def_hash_version;
+	UINT8 s_jnl_backup_type;
+	UINT16 s_desc_size;
+	UINT32 s_default_mount_opts;
+	UINT32 s_first_meta_bg;
+	UINT32 s_mkfs_time;
+	UINT32 s_jnl_blocks[17];
+	UINT32 s_blocks_count_hi;
+	UINT32 s_r_blocks_count_hi;
+	UINT32 s_free_blocks_count_hi;
+	UINT16 s_min_extra_isize;
+	UINT16 s_want_extra_isize;
+	UINT32 s_flags;
+	UINT8 s_reserved[0x400 - 0x164];
+} __attribute__((packed));
+
+struct ext4_group_desc {
+	UINT32 bg_block_bitmap;
+	UINT32 bg_inode_bitmap;
+	UINT32 bg_inode_table;
+	UINT16 bg_free_blocks_count;
+	UINT16 bg_free_inodes_count;
+	UINT16 bg_used_dirs_count;
+	UINT16 bg_flags;
+	UINT32 bg_exclude_bitmap;
+	UINT16 bg_block_bitmap_csum;
+	UINT16 bg_inode_bitmap_csum;
+	UINT16 bg_itable_unused;
+	UINT16 bg_checksum;
+} __attribute__((packed));
+
+struct ext4_extent_header {
+	UINT16 eh_magic;
+	UINT16 eh_entries;
+	UINT16 eh_max;
+	UINT16 eh_depth;
+	UINT32 eh_generation;
+} __attribute__((packed));
+
+struct ext4_extent {
+	UINT32 ee_block;
+	UINT16 ee_len;
+	UINT16 ee_start_hi;
+	UINT32 ee_start_lo;
+} __attribute__((packed));
+
+struct ext4_inode {
+	UINT16 i_mode;
+	UINT16 i_uid;
+	UINT32 i_size_lo;
+	UINT32 i_atime;
+	UINT32 i_ctime;
+	UINT32 i_mtime;
+	UINT32 i_dtime;
+	UINT16 i_gid;
+	UINT16 i_links_count;
+	UINT32 i_blocks_lo;
+	UINT32 i_flags;
+	UINT32 i_osd1;
+	union {
+		UINT32 i_block[15];
+		struct {
+			struct ext4_extent_header hdr;
+			struct ext4_extent extent[4];
+		} tree;
+	};
+	UINT32 i_generation;
+	UINT32 i_file_acl_lo;
+	UINT32 i_size_high;
+	UINT32 i_obso_faddr;
+	UINT8 i_osd2[12];
+	UINT16 i_extra_isize;
+	UINT8 i_reserved[INODE_SIZE - 0x82];
+} __attribute__((packed));
+
+struct ext4_dir_entry {
+	UINT32 inode;
+	UINT16 rec_len;
+	UINT8 name_len;
+	UINT8 file_type;
+	char name[];
+} __attribute__((packed));
+
+struct ext4_layout {
+	UINT32 blocks_count;
+	UINT32 groups;
+	UINT32 gdt_blocks;
+	UINT32 inodes_per_group;
+	UINT32 itable_blocks;
+	UINT32 journal_blocks;
+	UINT32 free_blocks;
+	UINT32 free_inodes;
+	const UINT8 *uuid;
+	const UINT8 *hash_seed;
+	struct ext4_group_desc *gdt;
+};
+
+/* Sparse image writer.  When DATA is NULL, it only computes the size
+ * of the image.  */
+struct sparse_writer {
+	UINT8 *data;
+	UINTN size;
+	UINT32 block;
+	UINT32 chunks;
+	struct chunk_header *last;
+	UINT16 last_type;
+};
+
+static UINT16 crc16(UINT16 crc, const UINT8 *data, UINTN len)
+{
+	UINTN i;
+
+	while (len--) {
+		crc ^= *data++;
+		for (i = 0; i < 8; i++)
+			crc = crc & 1 ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+
+	return crc;
+}
+
+static BOOLEAN is_power_of(UINT32 n, UINT32 base)
+{
+	while (n > 1 && n % base == 0)
+		n /= base;
+	return n == 1;
+}
+
+static BOOLEAN group_has_super(UINT32 group)
+{
+	return group <= 1 || ((group & 1) && (is_power_of(group, 3) ||
+					      is_power_of(group, 5) ||
+					      is_power_of(group, 7)));
+}
+
+static UINT32 group_blocks(struct ext4_layout *l, UINT32 group)
+{
+	if (group == l->groups - 1)
+		return l->blocks_count - group * BLOCKS_PER_GROUP;
+	return BLOCKS_PER_GROUP;
+}
+
+static UINT32 group_overhead(struct ext4_layout *l, UINT32 group)
+{
+	return (group_has_super(group) ? 1 + l->gdt_blocks : 0) +
+		2 + l->itable_blocks;
+}
+
+static UINT32 default_journal_blocks(UINT32 blocks)
+{
+	if (blocks < 2048)
+		return 0;
+	if (blocks < 32768)
+		return 1024;
+	if (blocks < 256 * 1024)
+		return 4096;
+	if (blocks < 512 * 1024)
+		return 8192;
+	return MAX_JOURNAL_BLOCKS;
+}
+
+static EFI_STATUS compute_layout(struct ext4_layout *l, UINT64 size)
+{
+	UINT64 blocks = size / BLOCK_SIZE;
+	UINT32 last, ipg;
+
+	if (blocks < MIN_BLOCKS || blocks > 0xFFFFFFFF) {
+		error(L"Unsupported ext4 filesystem size %ld", size);
+		return EFI_UNSUPPORTED;
+	}
+	l->blocks_count = blocks;
+
+	for (;;) {
+		l->groups = (l->blocks_count + BLOCKS_PER_GROUP - 1) / BLOCKS_PER_GROUP;
+		l->gdt_blocks = (l->groups * DESC_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+		ipg = ((UINT64)l->blocks_count * BLOCK_SIZE / INODE_RATIO +
+		       l->groups - 1) / l->groups;
+		ipg = (ipg + INODES_PER_BLOCK - 1) & ~(INODES_PER_BLOCK - 1);
+		l->inodes_per_group = min(max(ipg, (UINT32)INODES_PER_BLOCK),
+					  (UINT32)BLOCKS_PER_GROUP);
+		l->itable_blocks = l->inodes_per_group / INODES_PER_BLOCK;
+
+		/* Like mke2fs, drop a last group too small to be useful */
+		last = l->groups - 1;
+		if (last == 0 || group_blocks(l, last) >= group_overhead(l, last) + 50)
+			break;
+		l->blocks_count = last * BLOCKS_PER_GROUP;
+	}
+
+	l->journal_blocks = default_journal_blocks(l->blocks_count);
+	if (group_overhead(l, 0) + DIR_BLOCKS + l->journal_blocks >
+	    group_blocks(l, 0)) {
+		error(L"ext4 filesystem too small");
+		return EFI_UNSUPPORTED;
+	}
+
+	return EFI_SUCCESS;
+}
+
+static void init_group_desc(struct ext4_layout *l, UINT32 group)
+{
+	struct ext4_group_desc *desc = &l->gdt[group];
+	UINT32 base, used, used_inodes = 0;
+	UINT16 crc;
+
+	base = group * BLOCKS_PER_GROUP +
+		(group_has_super(group) ? 1 + l->gdt_blocks : 0);
+	desc->bg_block_bitmap = base;
+	desc->bg_inode_bitmap = base + 1;
+	desc->bg_inode_table = base + 2;
+
+	used = group_overhead(l, group);
+	if (group == 0) {
+		used += DIR_BLOCKS + l->journal_blocks;
+		used_inodes = FIRST_INO;
+		desc->bg_used_dirs_count = 2;
+		desc->bg_flags = BG_INODE_ZEROED;
+	} else {
+		desc->bg_flags = BG_INODE_UNINIT;
+		if (group != l->groups - 1)
+			desc->bg_flags |= BG_BLOCK_UNINIT;
+	}
+
+	desc->bg_free_blocks_count = group_blocks(l, group) - used;
+	desc->bg_free_inodes_count = l->inodes_per_group - used_inodes;
+	desc->bg_itable_unused = l->inodes_per_group - used_inodes;
+
+	crc = crc16(0xFFFF, l->uuid, 16);
+	crc = crc16(crc, (UINT8 *)&group, sizeof(group));
+	desc->bg_checksum = crc16(crc, (UINT8 *)desc,
+				  sizeof(*desc) - sizeof(desc->bg_checksum));
+
+	l->free_blocks += desc->bg_free_blocks_count;
+	l->free_inodes += desc->bg_free_inodes_count;
+}
+
+static void set_extent(struct ext4_inode *inode, UINT32 start, UINT32 len)
+{
+	inode->i_flags = EXTENTS_FL;
+	inode->tree.hdr.eh_magic = EXT4_EXT_MAGIC;
+	inode->tree.hdr.eh_entries = 1;
+	inode->tree.hdr.eh_max = ARRAY_SIZE(inode->tree.extent);
+	inode->tree.extent[0].ee_len = len;
+	inode->tree.extent[0].ee_start_lo = start;
+	inode->i_size_lo = len * BLOCK_SIZE;
+	inode->i_blocks_lo = len * (BLOCK_SIZE / 512);
+	inode->i_extra_isize = 32;
+}
+
+static UINT32 root_block(struct ext4_layout *l)
+{
+	return l->gdt[0].bg_inode_table + l->itable_blocks;
+}
+
+static UINT32 journal_block(struct ext4_layout *l)
+{
+	return root_block(l) + DIR_BLOCKS;
+}
+
+static void make_inode_table(struct ext4_layout *l, UINT8 *block)
+{
+	struct ext4_inode *inodes = (struct ext4_inode *)block;
+	struct ext4_inode *inode;
+
+	inode = &inodes[ROOT_INO - 1];
+	inode->i_mode = S_IFDIR | 0755;
+	inode->i_links_count = 3;
+	set_extent(inode, root_block(l), 1);
+
+	inode = &inodes[FIRST_INO - 1];
+	inode->i_mode = S_IFDIR | 0700;
+	inode->i_links_count = 2;
+	set_extent(inode, root_block(l) + 1, 1);
+
+	if (!l->journal_blocks)
+		return;
+
+	inode = &inodes[JOURNAL_INO - 1];
+	inode->i_mode = S_IFREG | 0600;
+	inode->i_links_count = 1;
+	set_extent(inode, journal_block(l), l->journal_blocks);
+}
+
+static UINTN add_dir_entry(UINT8 *block, UINTN offset, UINT32 ino,
+			   const char *name, UINT16 rec_len)
+{
+	struct ext4_dir_entry *entry = (struct ext4_dir_entry *)(block + offset);
+
+	entry->inode = ino;
+	entry->rec_len = rec_len;
+	entry->name_len = strlen((CHAR8 *)name);
+	entry->file_type = FT_DIR;
+	memcpy(entry->name, name, entry->name_len);
+
+	return offset + rec_len;
+}
+
+static void make_dir(UINT8 *block, UINT32 ino, UINT32 parent,
+		     const char *child, UINT32 child_ino)
+{
+	UINTN offset;
+
+	offset = add_dir_entry(block, 0, ino, ".", 12);
+	if (!child) {
+		add_dir_entry(block, offset, parent, "..", BLOCK_SIZE - offset);
+		return;
+	}
+
+	offset = add_dir_entry(block, offset, parent, "..", 12);
+	add_dir_entry(block, offset, child_ino, child, BLOCK_SIZE - offset);
+}
+
+static void put_be32(UINT8 *p, UINT32 value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+static void make_journal_super(struct ext4_layout *l, UINT8 *block)
+{
+	put_be32(block + 0x00, JBD2_MAGIC);
+	put_be32(block + 0x04, JBD2_SUPERBLOCK_V2);
+	put_be32(block + 0x0C, BLOCK_SIZE);		/* s_blocksize */
+	put_be32(block + 0x10, l->journal_blocks);	/* s_maxlen */
+	put_be32(block + 0x14, 1);			/* s_first */
+	put_be32(block + 0x18, 1);			/* s_sequence */
+	put_be32(block + 0x40, 1);			/* s_nr_users */
+	memcpy(block + 0x100, l->uuid, 16);		/* s_users[0] */
+}
+
+static void make_super(struct ext4_layout *l, struct ext4_super_block *sb,
+		       UINT32 group)
+{
+	struct ext4_inode journal;
+
+	sb->s_inodes_count = l->inodes_per_group * l->groups;
+	sb->s_blocks_count_lo = l->blocks_count;
+	sb->s_free_blocks_count_lo = l->free_blocks;
+	sb->s_free_inodes_count = l->free_inodes;
+	sb->s_log_block_size = LOG_BLOCK_SIZE;
+	sb->s_log_cluster_size = LOG_BLOCK_SIZE;
+	sb->s_blocks_per_group = BLOCKS_PER_GROUP;
+	sb->s_clusters_per_group = BLOCKS_PER_GROUP;
+	sb->s_inodes_per_group = l->inodes_per_group;
+	sb->s_max_mnt_count = 0xFFFF;
+	sb->s_magic = EXT4_SUPER_MAGIC;
+	sb->s_state = 1;		/* Cleanly unmounted */
+	sb->s_errors = 1;		/* Continue */
+	sb->s_rev_level = 1;		/* Dynamic inode sizes */
+	sb->s_first_ino = FIRST_INO;
+	sb->s_inode_size = INODE_SIZE;
+	sb->s_block_group_nr = group;
+	sb->s_feature_compat = COMPAT_EXT_ATTR | COMPAT_DIR_INDEX;
+	sb->s_feature_incompat = INCOMPAT_FILETYPE | INCOMPAT_EXTENTS;
+	sb->s_feature_ro_compat = RO_COMPAT_SPARSE_SUPER | RO_COMPAT_LARGE_FILE |
+		RO_COMPAT_HUGE_FILE | RO_COMPAT_GDT_CSUM | RO_COMPAT_DIR_NLINK |
+		RO_COMPAT_EXTRA_ISIZE;
+	memcpy(sb->s_uuid, l->uuid, sizeof(sb->s_uuid));
+	memcpy(sb->s_hash_seed, l->hash_seed, sizeof(sb->s_hash_seed));
+	sb->s_def_hash_version = HASH_HALF_MD4;
+	sb->s_default_mount_opts = DEFM_XATTR_USER | DEFM_ACL;
+	sb->s_min_extra_isize = 32;
+	sb->s_want_extra_isize = 32;
+	sb->s_flags = FLAGS_SIGNED_HASH;
+
+	if (!l->journal_blocks)
+		return;
+
+	sb->s_feature_compat |= COMPAT_HAS_JOURNAL;
+	sb->s_journal_inum = JOURNAL_INO;
+	sb->s_jnl_backup_type = JNL_BACKUP_BLOCKS;
+	memset(&journal, 0, sizeof(journal));
+	set_extent(&journal, journal_block(l), l->journal_blocks);
+	memcpy(sb->s_jnl_blocks, journal.i_block, sizeof(journal.i_block));
+	sb->s_jnl_blocks[16] = journal.i_size_lo;
+}
+
+/* Set the bits [START, END[ of a bitmap block */
+static void set_bits(UINT8 *bitmap, UINT32 start, UINT32 end)
+{
+	for (; start < end; start++)
+		bitmap[start / 8] |= 1 << (start % 8);
+}
+
+static void sparse_chunk(struct sparse_writer *w, UINT16 type, UINT32 blocks,
+			 const VOID *payload, UINT32 payload_size)
+{
+	struct chunk_header *ckh = (struct chunk_header *)(w->data + w->size);
+
+	/* Consecutive raw blocks are merged in a single chunk */
+	if (type == CHUNK_TYPE_RAW && w->last_type == CHUNK_TYPE_RAW) {
+		if (w->data) {
+			memcpy(w->data + w->size, payload, payload_size);
+			w->last->chunk_sz += blocks;
+			w->last->total_sz += payload_size;
+		}
+		w->size += payload_size;
+		w->block += blocks;
+		return;
+	}
+
+	if (w->data) {
+		ckh->chunk_type = type;
+		ckh->reserved1 = 0;
+		ckh->chunk_sz = blocks;
+		ckh->total_sz = sizeof(*ckh) + payload_size;
+		memcpy(ckh + 1, payload, payload_size);
+		w->last = ckh;
+	}
+	w->size += sizeof(*ckh) + payload_size;
+	w->block += blocks;
+	w->chunks++;
+	w->last_type = type;
+}
+
+static void sparse_skip_to(struct sparse_writer *w, UINT32 block)
+{
+	if (block > w->block)
+		sparse_chunk(w, CHUNK_TYPE_DONT_CARE, block - w->block, NULL, 0);
+}
+
+static void sparse_raw(struct sparse_writer *w, UINT32 block, const VOID *data)
+{
+	sparse_skip_to(w, block);
+	sparse_chunk(w, CHUNK_TYPE_RAW, 1, data, BLOCK_SIZE);
+}
+
+static void sparse_zero(struct sparse_writer *w, UINT32 block, UINT32 count)
+{
+	UINT32 zero = 0;
+
+	if (!count)
+		return;
+	sparse_skip_to(w, block);
+	sparse_chunk(w, CHUNK_TYPE_FILL, count, &zero, sizeof(zero));
+}
+
+static void write_group(struct ext4_layout *l, struct sparse_writer *w,
+			UINT32 group, UINT8 *block)
+{
+	struct ext4_group_desc *desc = &l->gdt[group];
+	UINT32 first = group * BLOCKS_PER_GROUP;
+	UINT32 i;
+
+	if (group_has_super(group)) {
+		memset(block, 0, BLOCK_SIZE);
+		make_super(l, (struct ext4_super_block *)
+			   (block + (group == 0 ? 1024 : 0)), group);
+		sparse_raw(w, first, block);
+		for (i = 0; i < l->gdt_blocks; i++)
+			sparse_raw(w, first + 1 + i,
+				   (UINT8 *)l->gdt + i * BLOCK_SIZE);
+	}
+
+	if (group != 0 && group != l->groups - 1)
+		return;
+
+	/* Block bitmap, the metadata and the group 0 content are
+	 * contiguous at the beginning of the group */
+	memset(block, 0, BLOCK_SIZE);
+	set_bits(block, 0, group_blocks(l, group) - desc->bg_free_blocks_count);
+	set_bits(block, group_blocks(l, group), BLOCKS_PER_GROUP);
+	sparse_raw(w, desc->bg_block_bitmap, block);
+
+	if (group != 0)
+		return;
+
+	memset(block, 0, BLOCK_SIZE);
+	set_bits(block, 0, FIRST_INO);
+	set_bits(block, l->inodes_per_group, BLOCK_SIZE * 8);
+	sparse_raw(w, desc->bg_inode_bitmap, block);
+
+	memset(block, 0, BLOCK_SIZE);
+	make_inode_table(l, block);
+	sparse_raw(w, desc->bg_inode_table, block);
+	sparse_zero(w, desc->bg_inode_table + 1, l->itable_blocks - 1);
+
+	memset(block, 0, BLOCK_SIZE);
+	make_dir(block, ROOT_INO, ROOT_INO, "lost+found", FIRST_INO);
+	sparse_raw(w, root_block(l), block);
+
+	memset(block, 0, BLOCK_SIZE);
+	make_dir(block, FIRST_INO, ROOT_INO, NULL, 0);
+	sparse_raw(w, root_block(l) + 1, block);
+
+	if (!l->journal_blocks)
+		return;
+
+	memset(block, 0, BLOCK_SIZE);
+	make_journal_super(l, block);
+	sparse_raw(w, journal_block(l), block);
+	sparse_zero(w, journal_block(l) + 1, l->journal_blocks - 1);
+}
+
+static void write_image(struct ext4_layout *l, struct sparse_writer *w,
+			UINT8 *block)
+{
+	struct sparse_header *sph = (struct sparse_header *)w->data;
+	UINT32 group;
+
+	w->size = sizeof(*sph);
+	for (group = 0; group < l->groups; group++)
+		write_group(l, w, group, block);
+	sparse_skip_to(w, l->blocks_count);
+
+	if (!sph)
+		return;
+
+	sph->magic = SPARSE_HEADER_MAGIC;
+	sph->major_version = 1;
+	sph->minor_version = 0;
+	sph->file_hdr_sz = sizeof(*sph);
+	sph->chunk_hdr_sz = sizeof(struct chunk_header);
+	sph->blk_sz = BLOCK_SIZE;
+	sph->total_blks = w->block;
+	sph->total_chunks = w->chunks;
+	sph->image_checksum = 0;
+}
+
+EFI_STATUS ext4_sparse_image(UINT64 size, const UINT8 *uuid,
+			     const UINT8 *hash_seed,
+			     VOID **image, UINTN *image_size)
+{
+	EFI_STATUS ret;
+	struct ext4_layout layout;
+	struct sparse_writer writer;
+	UINT8 *block = NULL;
+	UINT32 group;
+
+	memset(&layout, 0, sizeof(layout));
+	layout.uuid = uuid;
+	layout.hash_seed = hash_seed;
+
+	ret = compute_layout(&layout, size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	layout.gdt = AllocateZeroPool(layout.gdt_blocks * BLOCK_SIZE);
+	block = AllocatePool(BLOCK_SIZE);
+	if (!layout.gdt || !block) {
+		ret = EFI_OUT_OF_RESOURCES;
+		goto out;
+	}
+
+	for (group = 0; group < layout.groups; group++)
+		init_group_desc(&layout, group);
+
+	/* First pass to compute the image size, second to write it */
+	memset(&writer, 0, sizeof(writer));
+	write_image(&layout, &writer, block);
+
+	*image_size = writer.size;
+	memset(&writer, 0, sizeof(writer));
+	writer.data = AllocatePool(*image_size);
+	if (!writer.data) {
+		ret = EFI_OUT_OF_RESOURCES;
+		goto out;
+	}
+	write_image(&layout, &writer, block);
+
+	debug(L"ext4: %d blocks, %d groups, %d inodes, %d journal blocks",
+	      layout.blocks_count, layout.groups,
+	      layout.groups * layout.inodes_per_group, layout.journal_blocks);
+	*image = writer.data;
+	ret = EFI_SUCCESS;
+
+out:
+	if (layout.gdt)
+		FreePool(layout.gdt);
+	if (block)
+		FreePool(block);
+	return ret;
+}
@@ -37,8 +37,13 @@
 #include <lib.h>
 #include <vars.h>
 #include <string.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
 #include <ui.h>
 #include <em.h>
+#include <android.h>
+#include <slot.h>
+#include <log_store.h>
 
 #include "uefi_utils.h"
 #include "gpt.h"
@@ -83,6 +88,9 @@ enum fastboot_states {
 	STATE_STOPPING,
 	STATE_STOPPED,
 	STATE_ERROR,
+	STATE_JOB,
+	STATE_START_UPLOAD,
+	STATE_UPLOAD,
 };
 
 EFI_GUID guid_linux_data = {0x0fc63daf, 0x8483, 0x4772, {0x8e, 0x79, 0x3d, 0x69, 0xd8, 0x47, 0x7d, 0xe4}};
@@ -95,6 +103,39 @@ static struct fastboot_tx_buffer *txbuf_head;
 static enum fastboot_states fastboot_state;
 static enum fastboot_states next_state;
 
+/* The USB device mode protocol does not provide any completion
+ * event: transfers only complete from fastboot_usb_run().  Once the
+ * USB link has been idle for FASTBOOT_IDLE_DELAY, the main loop
+ * sleeps until the next FASTBOOT_POLL_PERIOD tick or a key press
+ * instead of spinning, USB is then polled at this period.
+ *
+ * The cost is a latency of at most one FASTBOOT_POLL_PERIOD on the
+ * first command following an idle period.  It is well below the
+ * fastboot host timeouts and not noticeable by the user, while
+ * back-to-back commands and data transfers never wait as they keep
+ * the link active.  Background jobs never wait either: the loop only
+ * sleeps in STATE_COMPLETE, the job completion is handled by the loop
+ * itself.  */
+#define FASTBOOT_IDLE_DELAY	(100 * 1000)		/* microseconds */
+#define FASTBOOT_POLL_PERIOD	(10 * 1000 * 10)	/* 100ns unit, 10 ms */
+
+static EFI_EVENT poll_timer;
+static UINT64 last_activity;
+
+/* Jobs are given FASTBOOT_JOB_SLICE of processing time per main loop
+ * iteration and report their progress every
+ * FASTBOOT_JOB_PROGRESS_PERIOD. */
+#define FASTBOOT_JOB_SLICE		(100 * 1000)		/* microseconds */
+#define FASTBOOT_JOB_PROGRESS_PERIOD	(1000 * 1000)		/* microseconds */
+
+static BOOLEAN background_jobs = TRUE;
+static struct fastboot_job *current_job;
+static BOOLEAN job_complete;
+static EFI_STATUS job_ret;
+static BOOLEAN job_tx_pending;
+static UINT64 job_start;
+static UINT64 job_last_progress;
+
 /* Download buffer and size, for download and flash commands */
 static void *dlbuffer;
 static unsigned dlsize, bufsize;
@@ -218,15 +259,31 @@ static struct fastboot_var *fastboot_getvar_or_create(const char *name)
 	return var;
 }
 
+/* partition- variables of the boot devices which are not the current
+ * one, see fastboot_switch_storage() */
+static struct fastboot_var *partition_vars[STORAGE_ALL];
+
+static void free_var_list(struct fastboot_var *list)
+{
+	struct fastboot_var *next, *var;
+
+	for (var = list; var; var = next) {
+		next = var->next;
+		FreePool(var);
+	}
+}
+
 /*
- * remove all fastboot variable which starts with partition-
+ * remove all fastboot variable which starts with partition- and
+ * return them as a list
  */
 #define MATCH_PART "partition-"
-static void clean_partition_var(void)
+static struct fastboot_var *detach_partition_var(void)
 {
 	struct fastboot_var *var;
 	struct fastboot_var *old_varlist;
 	struct fastboot_var *next;
+	struct fastboot_var *detached = NULL;
 
 	old_varlist = varlist;
 	varlist = NULL;
@@ -234,24 +291,44 @@ static void clean_partition_var(void)
 	for (var = old_varlist; var; var = next) {
 		next = var->next;
 		if (!memcmp(MATCH_PART, var->name, strlena((CHAR8 *) MATCH_PART))) {
-			FreePool(var);
+			var->next = detached;
+			detached = var;
 		} else {
 			var->next = varlist;
 			varlist = var;
 		}
 	}
+
+	return detached;
 }
 
-static void fastboot_unpublish_all()
+static void attach_partition_var(struct fastboot_var *list)
 {
 	struct fastboot_var *next, *var;
 
-	for (var = varlist; var; var = next) {
+	for (var = list; var; var = next) {
 		next = var->next;
-		FreePool(var);
+		var->next = varlist;
+		varlist = var;
 	}
+}
+
+static void clean_partition_var(void)
+{
+	free_var_list(detach_partition_var());
+}
 
+static void fastboot_unpublish_all()
+{
+	UINTN i;
+
+	free_var_list(varlist);
 	varlist = NULL;
+
+	for (i = 0; i < ARRAY_SIZE(partition_vars); i++) {
+		free_var_list(partition_vars[i]);
+		partition_vars[i] = NULL;
+	}
 }
 
 EFI_STATUS fastboot_publish_dynamic(const char *name, char *(get_value)(void))
@@ -288,6 +365,29 @@ EFI_STATUS fastboot_publish(const char *name, const char *value)
 		return EFI_INVALID_PARAMETER;
 
 	CopyMem(var->value, value, valuelen);
+	var->get_value = NULL;
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS fastboot_publish_table(const struct fastboot_var_def *table,
+				  UINTN count)
+{
+	EFI_STATUS ret;
+	UINTN i;
+
+	for (i = 0; i < count; i++) {
+		if (table[i].get_value)
+			ret = fastboot_publish_dynamic(table[i].name,
+						       table[i].get_value);
+		else
+			ret = fastboot_publish(table[i].name, table[i].value);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to publish '%a' variable",
+				   table[i].name);
+			return ret;
+		}
+	}
 
 	return EFI_SUCCESS;
 }
@@ -374,6 +474,131 @@ static EFI_STATUS publish_partsize(void)
 	return EFI_SUCCESS;
 }
 
+/* The slot state variables are computed on each getvar so that they
+ * reflect the slot metadata changes made by set_active or by a flash
+ * of misc.  */
+static char *get_slot_successful(UINTN slot)
+{
+	return slot_is_successful(slot_get_suffixes()[slot]) ? "yes" : "no";
+}
+
+static char *get_slot_unbootable(UINTN slot)
+{
+	return slot_is_bootable(slot_get_suffixes()[slot]) ? "no" : "yes";
+}
+
+static char *get_slot_retry_count(UINTN slot)
+{
+	static char value[MAX_VARIABLE_LENGTH];
+
+	snprintf((CHAR8 *)value, sizeof(value), (CHAR8 *)"%d",
+		 (int)slot_retry_count(slot_get_suffixes()[slot]));
+	return value;
+}
+
+static char *get_slot_successful_a(void) { return get_slot_successful(0); }
+static char *get_slot_successful_b(void) { return get_slot_successful(1); }
+static char *get_slot_unbootable_a(void) { return get_slot_unbootable(0); }
+static char *get_slot_unbootable_b(void) { return get_slot_unbootable(1); }
+static char *get_slot_retry_count_a(void) { return get_slot_retry_count(0); }
+static char *get_slot_retry_count_b(void) { return get_slot_retry_count(1); }
+
+static struct fastboot_var_def SLOT_VARIABLES[] = {
+	{ "slot-successful:a",	NULL,	get_slot_successful_a },
+	{ "slot-successful:b",	NULL,	get_slot_successful_b },
+	{ "slot-unbootable:a",	NULL,	get_slot_unbootable_a },
+	{ "slot-unbootable:b",	NULL,	get_slot_unbootable_b },
+	{ "slot-retry-count:a",	NULL,	get_slot_retry_count_a },
+	{ "slot-retry-count:b",	NULL,	get_slot_retry_count_b }
+};
+
+/* Publish the A/B slot variables: the number of slots, the state of
+ * each slot and the has-slot:<partition> variables.  */
+static EFI_STATUS publish_slots(void)
+{
+	EFI_STATUS ret;
+	struct gpt_partition_interface *gparti;
+	UINTN part_count, i, len;
+	const CHAR16 **suffixes;
+	CHAR16 base[ARRAY_SIZE(gparti->part.name)];
+	char name[MAX_VARIABLE_LENGTH];
+	char value[MAX_VARIABLE_LENGTH];
+
+	if (!use_slot())
+		return EFI_SUCCESS;
+
+	snprintf((CHAR8 *)value, sizeof(value), (CHAR8 *)"%d", SLOT_COUNT);
+	ret = fastboot_publish("slot-count", value);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = fastboot_publish_table(SLOT_VARIABLES, ARRAY_SIZE(SLOT_VARIABLES));
+	if (EFI_ERROR(ret))
+		return ret;
+
+	suffixes = slot_get_suffixes();
+	ret = gpt_list_partition(&gparti, &part_count, LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret) || part_count == 0)
+		return EFI_SUCCESS;
+
+	for (i = 0; i < part_count; i++) {
+		len = StrLen(gparti[i].part.name);
+		if (len <= SLOT_SUFFIX_LEN ||
+		    StrCmp(&gparti[i].part.name[len - SLOT_SUFFIX_LEN],
+			   suffixes[0]))
+			continue;
+
+		StrCpy(base, gparti[i].part.name);
+		base[len - SLOT_SUFFIX_LEN] = L'\0';
+		snprintf((CHAR8 *)name, sizeof(name),
+			 (CHAR8 *)"has-slot:%s", base);
+		ret = fastboot_publish(name, "yes");
+		if (EFI_ERROR(ret))
+			break;
+	}
+
+	FreePool(gparti);
+	return ret;
+}
+
+static char *get_current_slot_var(void)
+{
+	static char current_slot[SLOT_SUFFIX_LEN];
+	const CHAR16 *suffix;
+	EFI_STATUS ret;
+
+	suffix = slot_get_active();
+	if (!suffix)
+		return NULL;
+
+	/* Slot name without the '_' */
+	ret = str_to_stra((CHAR8 *)current_slot, (CHAR16 *)suffix + 1,
+			  sizeof(current_slot));
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to convert the current slot");
+		return NULL;
+	}
+
+	return current_slot;
+}
+
+static char *get_max_download_size_var(void)
+{
+	static char download_max_str[30];
+
+	if (download_max_str[0] != '\0')
+		return download_max_str;
+
+	if (snprintf((CHAR8 *)download_max_str, sizeof(download_max_str),
+		     (CHAR8 *)"0x%lX", MAX_DOWNLOAD_SIZE) < 0) {
+		error(L"Failed to set download_max_str string");
+		download_max_str[0] = '\0';
+		return NULL;
+	}
+
+	return download_max_str;
+}
+
 static char *get_battery_voltage_var()
 {
 	EFI_STATUS ret;
@@ -395,6 +620,30 @@ static char *get_battery_voltage_var()
 	return battery_voltage;
 }
 
+static char *get_boot_reason_var(void)
+{
+	static char boot_reason[64];
+	const CHAR16 *reason;
+	EFI_STATUS ret;
+
+	if (boot_reason[0] != '\0')
+		return boot_reason;
+
+	reason = get_boot_reason();
+	if (!reason)
+		return NULL;
+
+	ret = str_to_stra((CHAR8 *)boot_reason, (CHAR16 *)reason,
+			  sizeof(boot_reason));
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to convert the boot reason");
+		boot_reason[0] = '\0';
+		return NULL;
+	}
+
+	return boot_reason;
+}
+
 static EFI_STATUS fastboot_build_ack_msg(char *msg, const char *code, const char *fmt, va_list ap)
 {
 	char *response;
@@ -515,6 +764,9 @@ static void flush_tx_buffer(void)
 	if (!txbuf_head)
 		fastboot_state = next_state;
 
+	if (current_job)
+		job_tx_pending = TRUE;
+
 	if (usb_write(msg->msg, sizeof(msg->msg)) < 0)
 		fastboot_state = STATE_ERROR;
 
@@ -533,10 +785,99 @@ static BOOLEAN is_in_white_list(const CHAR8 *key, const char **white_list)
 
 EFI_STATUS refresh_partition_var(void)
 {
+	EFI_STATUS ret;
+
 	clean_partition_var();
+	ret = publish_partsize();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return publish_slots();
+}
+
+/* Make the TYPE storage the boot device.  The partition variables of
+ * the previous boot device are kept aside and published again if it
+ * is selected back, the GPT caches are per boot device as well.  If
+ * the TYPE storage cannot be used, the previous boot device remains
+ * selected along with its partition variables.  */
+EFI_STATUS fastboot_switch_storage(enum storage_type type)
+{
+	EFI_STATUS ret;
+	enum storage_type cur, prev;
+	BOOLEAN has_prev;
+	struct fastboot_var *vars;
+
+	has_prev = !EFI_ERROR(get_boot_device_type(&prev));
+
+	ret = identify_boot_device(type);
+	if (!EFI_ERROR(ret))
+		ret = get_boot_device_type(&cur);
+	if (EFI_ERROR(ret)) {
+		if (has_prev && EFI_ERROR(identify_boot_device(prev)))
+			error(L"Failed to restore the previous boot device");
+		return ret;
+	}
+
+	/* Each boot device has its own misc partition */
+	slot_invalidate_metadata();
+
+	vars = detach_partition_var();
+	if (has_prev && !partition_vars[prev])
+		partition_vars[prev] = vars;
+	else
+		free_var_list(vars);
+
+	if (partition_vars[cur]) {
+		attach_partition_var(partition_vars[cur]);
+		partition_vars[cur] = NULL;
+		return EFI_SUCCESS;
+	}
+
 	return publish_partsize();
 }
 
+static EFI_STATUS storage_job_run_step(struct fastboot_job *job)
+{
+	return storage_job_step(&job->done, &job->total);
+}
+
+static void cmd_flash_complete(EFI_STATUS ret)
+{
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Flash failure: %r", ret);
+		return;
+	}
+
+	gpt_sync();
+
+	/* update partition variable in case it has changed */
+	if (ret & REFRESH_PARTITION_VAR) {
+		ret = refresh_partition_var();
+		if (EFI_ERROR(ret)) {
+			fastboot_fail("Failed to publish partition variables, %r", ret);
+			return;
+		}
+	}
+
+	ui_print(L"Flash done.");
+	fastboot_okay("");
+}
+
+static void flash_job_end(__attribute__((__unused__)) struct fastboot_job *job,
+			  EFI_STATUS ret)
+{
+	if (ret == EFI_ABORTED)
+		storage_job_abort();
+	cmd_flash_complete(ret);
+}
+
+static struct fastboot_job flash_job = {
+	.name = "flash",
+	.step = storage_job_run_step,
+	.end = flash_job_end,
+	.bytes = TRUE
+};
+
 static void cmd_flash(INTN argc, CHAR8 **argv)
 {
 	EFI_STATUS ret;
@@ -562,28 +903,51 @@ static void cmd_flash(INTN argc, CHAR8 **argv)
 	}
 	ui_print(L"Flashing %s ...", label);
 
+	if (flash_is_resumable(label)) {
+		ret = flash_partition_begin(dlbuffer, dlsize, label);
+		FreePool(label);
+		if (!EFI_ERROR(ret))
+			ret = fastboot_run_job(&flash_job);
+		if (EFI_ERROR(ret))
+			fastboot_fail("Flash failure: %r", ret);
+		return;
+	}
+
 	ret = flash(dlbuffer, dlsize, label);
 	FreePool(label);
+	cmd_flash_complete(ret);
+}
+
+static void cmd_erase_complete(EFI_STATUS ret)
+{
 	if (EFI_ERROR(ret)) {
-		fastboot_fail("Flash failure: %r", ret);
+		fastboot_fail("Erase failure: %r", ret);
 		return;
 	}
 
-	gpt_sync();
-
-	/* update partition variable in case it has changed */
-	if (ret & REFRESH_PARTITION_VAR) {
-		ret = refresh_partition_var();
-		if (EFI_ERROR(ret)) {
-			fastboot_fail("Failed to publish partition variables, %r", ret);
-			return;
-		}
-	}
+	if (erase_skipped_bytes())
+		fastboot_info("Skipped %ld bytes already zero",
+			      erase_skipped_bytes());
 
-	ui_print(L"Flash done.");
+	ui_print(L"Erase done.");
 	fastboot_okay("");
 }
 
+static void erase_job_end(__attribute__((__unused__)) struct fastboot_job *job,
+			  EFI_STATUS ret)
+{
+	if (ret == EFI_ABORTED)
+		storage_job_abort();
+	cmd_erase_complete(ret);
+}
+
+static struct fastboot_job erase_job = {
+	.name = "erase",
+	.step = storage_job_run_step,
+	.end = erase_job_end,
+	.bytes = TRUE
+};
+
 static void cmd_erase(INTN argc, CHAR8 **argv)
 {
 	EFI_STATUS ret;
@@ -608,15 +972,20 @@ static void cmd_erase(INTN argc, CHAR8 **argv)
 		return;
 	}
 	ui_print(L"Erasing %s ...", label);
-	ret = erase_by_label(label);
-	FreePool(label);
-	if (EFI_ERROR(ret)) {
-		fastboot_fail("Erase failure: %r", ret);
+
+	if (erase_is_resumable(label)) {
+		ret = erase_by_label_begin(label);
+		FreePool(label);
+		if (!EFI_ERROR(ret))
+			ret = fastboot_run_job(&erase_job);
+		if (EFI_ERROR(ret))
+			fastboot_fail("Erase failure: %r", ret);
 		return;
 	}
 
-	ui_print(L"Erase done.");
-	fastboot_okay("");
+	ret = erase_by_label(label);
+	FreePool(label);
+	cmd_erase_complete(ret);
 }
 
 static void cmd_boot(__attribute__((__unused__)) INTN argc,
@@ -677,6 +1046,38 @@ static void cmd_getvar(INTN argc, CHAR8 **argv)
 	fastboot_okay("%a", var ? fastboot_var_value(var) : "");
 }
 
+static void cmd_set_active(INTN argc, CHAR8 **argv)
+{
+	EFI_STATUS ret;
+	CHAR16 *suffix;
+
+	if (argc != 2) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	if (!use_slot()) {
+		fastboot_fail("Slots are not supported");
+		return;
+	}
+
+	suffix = stra_to_str(argv[1]);
+	if (!suffix) {
+		fastboot_fail("Allocation error");
+		return;
+	}
+
+	ret = slot_set_active(suffix);
+	FreePool(suffix);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Failed to set the active slot, %r", ret);
+		return;
+	}
+
+	ui_print(L"Slot %a is now active.", argv[1]);
+	fastboot_okay("");
+}
+
 void fastboot_reboot(enum boot_target target, CHAR16 *msg)
 {
 	EFI_STATUS ret = fastboot_stop(NULL, NULL, 0, target);
@@ -755,6 +1156,50 @@ static void fastboot_read_command(void)
 }
 #define BLK_DOWNLOAD (8*1024*1024)
 
+/* SHA-256 digest of the last downloaded payload, computed block by
+ * block as the payload is received.  It is published base64 encoded
+ * as the "download-sha256" variable since the hexadecimal form does
+ * not fit in a fastboot response.  */
+static EVP_MD_CTX dl_mdctx;
+static BOOLEAN dl_digesting;
+static char dl_digest[((SHA256_DIGEST_LENGTH + 2) / 3) * 4 + 1];
+
+static void download_digest_start(void)
+{
+	if (dl_digesting)
+		EVP_MD_CTX_cleanup(&dl_mdctx);
+
+	dl_digest[0] = '\0';
+	EVP_MD_CTX_init(&dl_mdctx);
+	dl_digesting = EVP_DigestInit_ex(&dl_mdctx, EVP_sha256(), NULL);
+	if (!dl_digesting)
+		error(L"Failed to initialize the download digest");
+}
+
+static void download_digest_update(void *data, unsigned len)
+{
+	if (dl_digesting)
+		EVP_DigestUpdate(&dl_mdctx, data, len);
+}
+
+static void download_digest_end(void)
+{
+	unsigned char md[SHA256_DIGEST_LENGTH];
+
+	if (!dl_digesting)
+		return;
+
+	if (EVP_DigestFinal_ex(&dl_mdctx, md, NULL))
+		EVP_EncodeBlock((unsigned char *)dl_digest, md, sizeof(md));
+	EVP_MD_CTX_cleanup(&dl_mdctx);
+	dl_digesting = FALSE;
+}
+
+static char *get_download_digest_var(void)
+{
+	return dl_digest;
+}
+
 static void cmd_download(INTN argc, CHAR8 **argv)
 {
 	int len;
@@ -778,10 +1223,11 @@ static void cmd_download(INTN argc, CHAR8 **argv)
 	}
 
 	if (newdlsize > bufsize) {
-		if (dlbuffer)
-			FreePool(dlbuffer);
-		dlbuffer = AllocatePool(newdlsize);
-		if (!dlbuffer) {
+		/* Do not keep the old buffer pinned in the pool while
+		 * the larger one is allocated */
+		io_buffer_release(dlbuffer);
+		if (EFI_ERROR(io_buffer_alloc(newdlsize, 0, FALSE, &dlbuffer))) {
+			dlbuffer = NULL;
 			error(L"Failed to allocate download buffer (0x%x bytes)",
 			      newdlsize);
 			fastboot_fail("Memory allocation failure");
@@ -791,6 +1237,7 @@ static void cmd_download(INTN argc, CHAR8 **argv)
 		bufsize = newdlsize;
 	}
 	dlsize = newdlsize;
+	download_digest_start();
 
 	len = snprintf(response, sizeof(response), (CHAR8 *)"DATA%08x", dlsize);
 	if (len < 0) {
@@ -806,6 +1253,75 @@ static void cmd_download(INTN argc, CHAR8 **argv)
 	}
 }
 
+/* Data staged by a command to be sent to the host by the next
+ * "upload" command. */
+static void *upload_buffer;
+static UINTN upload_size, upload_sent;
+
+void fastboot_stage(void *data, UINTN size)
+{
+	if (upload_buffer)
+		FreePool(upload_buffer);
+	upload_buffer = data;
+	upload_size = size;
+}
+
+static void cmd_upload(INTN argc, __attribute__((__unused__)) CHAR8 **argv)
+{
+	int len;
+	CHAR8 response[MAGIC_LENGTH];
+
+	if (argc != 1) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	if (!upload_buffer) {
+		fastboot_fail("No data staged");
+		return;
+	}
+
+	if (upload_size > MAX_DOWNLOAD_SIZE) {
+		fastboot_fail("Staged data too large");
+		return;
+	}
+
+	len = snprintf(response, sizeof(response), (CHAR8 *)"DATA%08x",
+		       (UINT32)upload_size);
+	if (len < 0) {
+		error(L"Failed to format DATA response");
+		fastboot_fail("Failed to format DATA response");
+		return;
+	}
+
+	upload_sent = 0;
+	fastboot_state = STATE_START_UPLOAD;
+	if (usb_write(response, strlen((CHAR8 *)response)) < 0) {
+		fastboot_state = STATE_ERROR;
+		return;
+	}
+}
+
+static void worker_upload(void)
+{
+	UINTN len;
+
+	if (upload_sent == upload_size) {
+		fastboot_stage(NULL, 0);
+		fastboot_state = STATE_COMMAND;
+		fastboot_okay("");
+		return;
+	}
+
+	len = min(upload_size - upload_sent, (UINTN)BLK_DOWNLOAD);
+	fastboot_state = STATE_UPLOAD;
+	if (usb_write((CHAR8 *)upload_buffer + upload_sent, len) < 0) {
+		fastboot_state = STATE_ERROR;
+		return;
+	}
+	upload_sent += len;
+}
+
 static void worker_download(void)
 {
 	int len;
@@ -826,6 +1342,8 @@ static void worker_download(void)
 static void fastboot_process_tx(__attribute__((__unused__)) void *buf,
 				__attribute__((__unused__)) unsigned len)
 {
+	last_activity = get_time_us();
+
 	switch (fastboot_state) {
 	case STATE_STOPPING:
 		fastboot_state = STATE_STOPPED;
@@ -839,6 +1357,13 @@ static void fastboot_process_tx(__attribute__((__unused__)) void *buf,
 	case STATE_START_DOWNLOAD:
 		worker_download();
 		break;
+	case STATE_START_UPLOAD:
+	case STATE_UPLOAD:
+		worker_upload();
+		break;
+	case STATE_JOB:
+		job_tx_pending = FALSE;
+		break;
 	default:
 		error(L"Unexpected tx event while in state %d", fastboot_state);
 		break;
@@ -884,8 +1409,12 @@ static void fastboot_process_rx(void *buf, unsigned len)
 	CHAR8 *s;
 	int req_len;
 
+	last_activity = get_time_us();
+
 	switch (fastboot_state) {
 	case STATE_DOWNLOAD:
+		if (received_len + len > dlsize)
+			len = dlsize - received_len;
 		received_len += len;
 		if (dlsize > MiB)
 			debug(L"\rRX %d MiB / %d MiB", received_len/MiB, dlsize / MiB);
@@ -897,7 +1426,11 @@ static void fastboot_process_rx(void *buf, unsigned len)
 			if (req_len > BLK_DOWNLOAD)
 				req_len = BLK_DOWNLOAD;
 			usb_read(&s[len], req_len);
+			/* Digest this block while the next one is received */
+			download_digest_update(buf, len);
 		} else {
+			download_digest_update(buf, len);
+			download_digest_end();
 			fastboot_state = STATE_COMMAND;
 			fastboot_okay("");
 		}
@@ -918,28 +1451,154 @@ static void fastboot_process_rx(void *buf, unsigned len)
 	}
 }
 
+void fastboot_set_background_jobs(BOOLEAN enable)
+{
+	background_jobs = enable;
+}
+
+EFI_STATUS fastboot_run_job(struct fastboot_job *job)
+{
+	EFI_STATUS ret;
+
+	if (!job || !job->step || !job->end)
+		return EFI_INVALID_PARAMETER;
+
+	if (current_job)
+		return EFI_ALREADY_STARTED;
+
+	job->done = 0;
+	job->total = 0;
+
+	if (!background_jobs) {
+		do {
+			ret = job->step(job);
+		} while (ret == EFI_NOT_READY);
+		job->end(job, ret);
+		return EFI_SUCCESS;
+	}
+
+	current_job = job;
+	job_complete = FALSE;
+	job_tx_pending = FALSE;
+	job_start = job_last_progress = get_time_us();
+
+	/* Messages queued by the command handler are flushed first */
+	if (fastboot_state != STATE_TX)
+		fastboot_state = STATE_JOB;
+	next_state = STATE_JOB;
+
+	return EFI_SUCCESS;
+}
+
+static void fastboot_job_progress(struct fastboot_job *job)
+{
+	UINT64 elapsed = get_time_us() - job_start;
+
+	if (!job->bytes) {
+		fastboot_info("%a: %ld/%ld", job->name, job->done, job->total);
+		return;
+	}
+
+	/* Bytes per microsecond is MB/s */
+	fastboot_info("%a: %ld/%ld MiB, %ld MB/s", job->name,
+		      job->done / MiB, job->total / MiB,
+		      elapsed ? job->done / elapsed : 0);
+}
+
+static void fastboot_run_job_slice(void)
+{
+	struct fastboot_job *job = current_job;
+	EFI_STATUS ret;
+	UINT64 start;
+
+	if (!job)
+		return;
+
+	if (!job_complete) {
+		start = get_time_us();
+		do {
+			ret = job->step(job);
+		} while (ret == EFI_NOT_READY &&
+			 get_time_us() - start < FASTBOOT_JOB_SLICE);
+
+		if (ret != EFI_NOT_READY) {
+			job_complete = TRUE;
+			job_ret = ret;
+		}
+	}
+
+	/* One message at a time on the USB link */
+	if (job_tx_pending)
+		return;
+
+	if (fastboot_state == STATE_TX) {
+		flush_tx_buffer();
+		return;
+	}
+
+	if (job_complete) {
+		current_job = NULL;
+		next_state = STATE_COMPLETE;
+		job->end(job, job_ret);
+		if (fastboot_state == STATE_TX)
+			flush_tx_buffer();
+		return;
+	}
+
+	if (get_time_us() - job_last_progress >= FASTBOOT_JOB_PROGRESS_PERIOD) {
+		job_last_progress = get_time_us();
+		fastboot_job_progress(job);
+		flush_tx_buffer();
+	}
+}
+
+static void fastboot_abort_job(void)
+{
+	struct fastboot_job *job = current_job;
+
+	if (!job)
+		return;
+
+	debug(L"Aborting the '%a' job", job->name);
+	current_job = NULL;
+	next_state = STATE_COMPLETE;
+	job->end(job, EFI_ABORTED);
+}
+
 static void fastboot_start_callback(void)
 {
+	last_activity = get_time_us();
 	fastboot_state = next_state;
 	fastboot_read_command();
 }
 
 static struct fastboot_cmd COMMANDS[] = {
 	{ "download",		VERIFIED,	cmd_download },
+	{ "upload",		LOCKED,		cmd_upload },
 	{ "flash",		VERIFIED,	cmd_flash },
 	{ "erase",		VERIFIED,	cmd_erase },
 	{ "getvar",		LOCKED,		cmd_getvar },
 	{ "boot",		UNLOCKED,	cmd_boot },
 	{ "continue",		LOCKED,		cmd_continue },
 	{ "reboot",		LOCKED,		cmd_reboot },
-	{ "reboot-bootloader",	LOCKED,		cmd_reboot_bootloader }
+	{ "reboot-bootloader",	LOCKED,		cmd_reboot_bootloader },
+	{ "set_active",		VERIFIED,	cmd_set_active }
+};
+
+static struct fastboot_var_def VARIABLES[] = {
+	{ "product",		NULL,	info_product },
+	{ "version-bootloader",	NULL,	info_bootloader_version },
+	{ "battery-voltage",	NULL,	get_battery_voltage_var },
+	{ "boot-reason",	NULL,	get_boot_reason_var },
+	{ "max-download-size",	NULL,	get_max_download_size_var },
+	{ "current-slot",	NULL,	get_current_slot_var },
+	{ "download-sha256",	NULL,	get_download_digest_var }
 };
 
 static EFI_STATUS fastboot_init()
 {
 	EFI_STATUS ret;
 	UINTN i;
-	char download_max_str[30];
 	static char default_command_buffer[MAGIC_LENGTH];
 
 	ret = fastboot_set_command_buffer(default_command_buffer,
@@ -955,30 +1614,15 @@ static EFI_STATUS fastboot_init()
 		/* Might as well continue even though this failed ... */
 	}
 
-	ret = fastboot_publish("product", info_product());
-	if (EFI_ERROR(ret))
-		goto error;
-
-	ret = fastboot_publish("version-bootloader", info_bootloader_version());
+	ret = fastboot_publish_table(VARIABLES, ARRAY_SIZE(VARIABLES));
 	if (EFI_ERROR(ret))
 		goto error;
 
-	ret = fastboot_publish_dynamic("battery-voltage", get_battery_voltage_var);
+	ret = publish_partsize();
 	if (EFI_ERROR(ret))
 		goto error;
 
-	if (snprintf((CHAR8 *)download_max_str, sizeof(download_max_str),
-		     (CHAR8 *)"0x%lX", MAX_DOWNLOAD_SIZE) < 0) {
-		error(L"Failed to set download_max_str string");
-		ret = EFI_INVALID_PARAMETER;
-		goto error;
-	} else {
-		ret = fastboot_publish("max-download-size", download_max_str);
-		if (EFI_ERROR(ret))
-			goto error;
-	}
-
-	ret = publish_partsize();
+	ret = publish_slots();
 	if (EFI_ERROR(ret))
 		goto error;
 
@@ -1007,6 +1651,66 @@ error:
 	return ret;
 }
 
+static EFI_STATUS fastboot_create_poll_timer(void)
+{
+	EFI_STATUS ret;
+
+	ret = uefi_call_wrapper(BS->CreateEvent, 5, EVT_TIMER, 0, NULL, NULL,
+				&poll_timer);
+	if (EFI_ERROR(ret))
+		goto error;
+
+	ret = uefi_call_wrapper(BS->SetTimer, 3, poll_timer, TimerPeriodic,
+				FASTBOOT_POLL_PERIOD);
+	if (EFI_ERROR(ret)) {
+		uefi_call_wrapper(BS->CloseEvent, 1, poll_timer);
+		goto error;
+	}
+
+	return EFI_SUCCESS;
+
+error:
+	poll_timer = NULL;
+	efi_perror(ret, L"Failed to create the fastboot poll timer");
+	return ret;
+}
+
+static void fastboot_destroy_poll_timer(void)
+{
+	if (!poll_timer)
+		return;
+
+	uefi_call_wrapper(BS->SetTimer, 3, poll_timer, TimerCancel, 0);
+	uefi_call_wrapper(BS->CloseEvent, 1, poll_timer);
+	poll_timer = NULL;
+}
+
+/* Block until the poll timer expires or a key is pressed.  Only done
+ * while we are waiting for a command and the link has been idle for
+ * a while, so that the command latency and the transfer rate are
+ * preserved during a fastboot session. */
+static void fastboot_wait_for_event(void)
+{
+	EFI_EVENT events[2];
+	UINTN index;
+	EFI_STATUS ret;
+
+	if (!poll_timer)
+		return;
+
+	if (fastboot_state != STATE_COMPLETE ||
+	    get_time_us() - last_activity < FASTBOOT_IDLE_DELAY)
+		return;
+
+	events[0] = poll_timer;
+	events[1] = ST->ConIn->WaitForKey;
+
+	ret = uefi_call_wrapper(BS->WaitForEvent, 3, ARRAY_SIZE(events),
+				events, &index);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"WaitForEvent failed");
+}
+
 static void *fastboot_bootimage;
 static void *fastboot_efiimage;
 static UINTN fastboot_imagesize;
@@ -1039,6 +1743,9 @@ EFI_STATUS fastboot_start(void **bootimage, void **efiimage, UINTN *imagesize,
 		goto exit;
 	}
 
+	fastboot_create_poll_timer();
+	last_activity = get_time_us();
+
 	for (;;) {
 		*target = fastboot_ui_event_handler();
 		if (*target != UNKNOWN_TARGET)
@@ -1055,11 +1762,15 @@ EFI_STATUS fastboot_start(void **bootimage, void **efiimage, UINTN *imagesize,
 		}
 
 		fastboot_run_command();
+		fastboot_run_job_slice();
 
 		if (fastboot_state == STATE_STOPPED)
 			break;
+
+		fastboot_wait_for_event();
 	}
 
+	fastboot_abort_job();
 	fastboot_usb_stop();
 
 	if (fastboot_target != UNKNOWN_TARGET)
@@ -1074,7 +1785,10 @@ EFI_STATUS fastboot_start(void **bootimage, void **efiimage, UINTN *imagesize,
 	*imagesize = fastboot_imagesize;
 
 exit:
+	fastboot_abort_job();
+	fastboot_destroy_poll_timer();
 	fastboot_free();
+	log_store_flush();
 	return ret;
 }
 
@@ -1109,14 +1823,16 @@ EFI_STATUS fastboot_stop(void *bootimage, void *efiimage, UINTN imagesize,
 void fastboot_free()
 {
 	if (dlbuffer) {
-		FreePool(dlbuffer);
+		io_buffer_free(dlbuffer);
 		dlbuffer = NULL;
 		bufsize = dlsize = 0;
 	}
+	fastboot_stage(NULL, 0);
 
 	fastboot_unpublish_all();
 	fastboot_cmdlist_unregister(&cmdlist);
 	fastboot_oem_free();
 	fastboot_ui_destroy();
 	gpt_free_cache();
+	io_buffer_release_all();
 }
@@ -36,6 +36,7 @@
 #include <lib.h>
 #include <vars.h>
 #include <storage.h>
+#include <string.h>
 
 #include "uefi_utils.h"
 #include "flash.h"
@@ -47,25 +48,42 @@
 #include "fastboot_oem.h"
 #include "intel_variables.h"
 #include "text_parser.h"
+#include "lz4.h"
+#include "log_store.h"
 
 #define OFF_MODE_CHARGE		"off-mode-charge"
 #define CRASH_EVENT_MENU	"crash-event-menu"
 
 static cmdlist_t cmdlist;
 
-static EFI_STATUS fastboot_oem_publish(void)
+static char *get_secure(void)
 {
-	EFI_STATUS ret;
+	return device_is_locked() ? "yes" : "no";
+}
 
-	ret = fastboot_publish("secure", device_is_locked() ? "yes" : "no");
-	if (EFI_ERROR(ret))
-		return ret;
+static char *get_unlocked(void)
+{
+	return device_is_unlocked() ? "yes" : "no";
+}
 
-	ret = fastboot_publish("unlocked", device_is_unlocked() ? "yes" : "no");
-	if (EFI_ERROR(ret))
-		return ret;
+static char *get_off_mode_charge(void)
+{
+	return get_current_off_mode_charge() ? "1" : "0";
+}
 
-	ret = fastboot_publish(OFF_MODE_CHARGE, get_current_off_mode_charge() ? "1" : "0");
+/* These variables are evaluated on request so that they always
+ * reflect the state changes made by the OEM commands.  */
+static struct fastboot_var_def VARIABLES[] = {
+	{ "secure",		NULL,	get_secure },
+	{ "unlocked",		NULL,	get_unlocked },
+	{ OFF_MODE_CHARGE,	NULL,	get_off_mode_charge }
+};
+
+static EFI_STATUS fastboot_oem_publish(void)
+{
+	EFI_STATUS ret;
+
+	ret = fastboot_publish_table(VARIABLES, ARRAY_SIZE(VARIABLES));
 	if (EFI_ERROR(ret))
 		return ret;
 
@@ -117,15 +135,10 @@ static void change_device_state(enum device_state new_state)
 	}
 
 	fastboot_ui_refresh();
-	ret = fastboot_oem_publish();
-	if (EFI_ERROR(ret))
-		fastboot_fail("Failed to publish OEM variables");
-	else {
-		fastboot_okay("");
-		/* Ensure logs variable is deleted on a successful
-		   state transition.  */
-		del_efi_variable(&loader_guid, LOG_VAR);
-	}
+	fastboot_okay("");
+	/* Ensure logs variable is deleted on a successful state
+	   transition.  */
+	del_efi_variable(&loader_guid, LOG_VAR);
 }
 
 static void cmd_oem_lock(__attribute__((__unused__)) INTN argc,
@@ -217,11 +230,7 @@ static void cmd_oem_off_mode_charge(__attribute__((__unused__)) INTN argc,
 		return;
 	}
 
-	ret = fastboot_oem_publish();
-	if (EFI_ERROR(ret))
-		fastboot_fail("Failed to publish OEM variables");
-	else
-		fastboot_okay("");
+	fastboot_okay("");
 }
 
 static void cmd_oem_crash_event_menu(__attribute__((__unused__)) INTN argc,
@@ -246,11 +255,7 @@ static void cmd_oem_crash_event_menu(__attribute__((__unused__)) INTN argc,
 		return;
 	}
 
-	ret = fastboot_oem_publish();
-	if (EFI_ERROR(ret))
-		fastboot_fail("Failed to publish OEM variables");
-	else
-		fastboot_okay("");
+	fastboot_okay("");
 }
 
 static void cmd_oem_setvar(INTN argc, CHAR8 **argv)
@@ -309,10 +314,16 @@ static void cmd_oem_reboot(INTN argc, CHAR8 **argv)
 	fastboot_reboot(bt, L"Rebooting to requested target ...");
 }
 
-static void cmd_oem_garbage_disk(__attribute__((__unused__)) INTN argc,
-				 __attribute__((__unused__)) CHAR8 **argv)
+static EFI_STATUS garbage_disk_step(struct fastboot_job *job)
+{
+	return storage_job_step(&job->done, &job->total);
+}
+
+static void garbage_disk_end(__attribute__((__unused__)) struct fastboot_job *job,
+			     EFI_STATUS ret)
 {
-	EFI_STATUS ret = garbage_disk();
+	if (ret == EFI_ABORTED)
+		storage_job_abort();
 
 	if (ret == EFI_SUCCESS)
 		fastboot_okay("");
@@ -320,9 +331,126 @@ static void cmd_oem_garbage_disk(__attribute__((__unused__)) INTN argc,
 		fastboot_fail("Garbage disk failed, %r", ret);
 }
 
+static struct fastboot_job garbage_disk_job = {
+	.name = "garbage-disk",
+	.step = garbage_disk_step,
+	.end = garbage_disk_end,
+	.bytes = TRUE
+};
+
+static void cmd_oem_garbage_disk(__attribute__((__unused__)) INTN argc,
+				 __attribute__((__unused__)) CHAR8 **argv)
+{
+	EFI_STATUS ret;
+
+	ret = garbage_disk_begin();
+	if (!EFI_ERROR(ret))
+		ret = fastboot_run_job(&garbage_disk_job);
+	if (EFI_ERROR(ret))
+		fastboot_fail("Garbage disk failed, %r", ret);
+}
+
+static void cmd_oem_format(INTN argc, CHAR8 **argv)
+{
+	EFI_STATUS ret;
+	CHAR16 *label;
+
+	if (argc != 2) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	label = stra_to_str(argv[1]);
+	if (!label) {
+		error(L"Failed to get label %a", argv[1]);
+		fastboot_fail("Allocation error");
+		return;
+	}
+
+	ui_print(L"Formatting %s ...", label);
+	ret = format_by_label(label);
+	FreePool(label);
+	if (EFI_ERROR(ret)) {
+		fastboot_fail("Format failure: %r", ret);
+		return;
+	}
+
+	ui_print(L"Format done.");
+	fastboot_okay("");
+}
+
+/* One hash computed per get-hashes job step, the system hash is
+ * computed over several steps */
+static struct get_hashes_context {
+	EFI_STATUS ret;
+	BOOLEAN hashing;
+} get_hashes_ctx;
+
+static EFI_STATUS get_hashes_step(struct fastboot_job *job)
+{
+	struct get_hashes_context *ctx = job->context;
+	EFI_STATUS ret;
+
+	job->total = 4;
+	switch (job->done) {
+	case 0:
+		ctx->ret |= get_boot_image_hash(L"boot");
+		break;
+	case 1:
+		ctx->ret |= get_boot_image_hash(L"recovery");
+		break;
+	case 2:
+		ctx->ret |= get_esp_hash();
+		break;
+	case 3:
+		if (!ctx->hashing) {
+			ret = get_ext4_hash_begin(L"system");
+			if (EFI_ERROR(ret)) {
+				ctx->ret |= ret;
+				break;
+			}
+			ctx->hashing = TRUE;
+		}
+		ret = get_ext4_hash_step();
+		if (ret == EFI_NOT_READY)
+			return EFI_NOT_READY;
+		ctx->hashing = FALSE;
+		ctx->ret |= ret;
+		break;
+	}
+
+	job->done++;
+	return job->done < job->total ? EFI_NOT_READY : EFI_SUCCESS;
+}
+
+static void get_hashes_end(struct fastboot_job *job, EFI_STATUS ret)
+{
+	struct get_hashes_context *ctx = job->context;
+
+	if (ctx->hashing) {
+		get_ext4_hash_abort();
+		ctx->hashing = FALSE;
+	}
+
+	if (EFI_ERROR(ret) || EFI_ERROR(ctx->ret)) {
+		fastboot_fail("Fail to get hash for system image, %r",
+			      EFI_ERROR(ret) ? ret : ctx->ret);
+		return;
+	}
+
+	fastboot_okay("");
+}
+
+static struct fastboot_job get_hashes_job = {
+	.name = "get-hashes",
+	.step = get_hashes_step,
+	.end = get_hashes_end,
+	.context = &get_hashes_ctx
+};
+
 static void cmd_oem_gethashes(INTN argc, CHAR8 **argv)
 {
-	EFI_STATUS ret = EFI_SUCCESS;
+	EFI_STATUS ret;
 
 	if (argc == 2) {
 		ret = set_hash_algorithm(argv[1]);
@@ -332,17 +460,10 @@ static void cmd_oem_gethashes(INTN argc, CHAR8 **argv)
 		}
 	}
 
-	ret |= get_boot_image_hash(L"boot");
-	ret |= get_boot_image_hash(L"recovery");
-	ret |= get_esp_hash();
-	ret |= get_ext4_hash(L"system");
-
-	if (EFI_ERROR(ret)) {
+	get_hashes_ctx.ret = EFI_SUCCESS;
+	ret = fastboot_run_job(&get_hashes_job);
+	if (EFI_ERROR(ret))
 		fastboot_fail("Fail to get hash for system image, %r", ret);
-		return;
-	}
-
-	fastboot_okay("");
 }
 
 #ifndef USER
@@ -368,21 +489,9 @@ static void cmd_oem_set_storage(INTN argc,
 	fastboot_fail("Unsupported storage");
 	return;
 set:
-	ret = identify_boot_device(type);
-	if (EFI_ERROR(ret)) {
-		fastboot_fail("Failed to set storage: %r", ret);
-		return;
-	}
-
-	ret = gpt_refresh();
-	if (EFI_ERROR(ret)) {
-		fastboot_fail("Failed to refresh partition table: %r", ret);
-		return;
-	}
-
-	ret = refresh_partition_var();
+	ret = fastboot_switch_storage(type);
 	if (EFI_ERROR(ret))
-		fastboot_fail("Failed to refresh partition vars: %r", ret);
+		fastboot_fail("Failed to set storage: %r", ret);
 	else
 		fastboot_okay("");
 }
@@ -474,6 +583,97 @@ static void cmd_oem_get_logs(__attribute__((__unused__)) INTN argc,
 	fastboot_okay("");
 }
 
+/* Stage the logs for the "upload" command, starting at byte OFFSET
+ * of the log payload and optionally compressed in the LZ4 legacy
+ * format.  The payload is the persistent log store when available,
+ * the provisioning logs otherwise.  At most MAX_DOWNLOAD_SIZE bytes
+ * are staged at once, half of it when compressing so that the LZ4
+ * expansion of uncompressible data still fits.  The total payload
+ * size is reported so that the host can retrieve the rest, or resume
+ * an interrupted retrieval, from a later offset.  */
+static void cmd_oem_stage_logs(INTN argc, CHAR8 **argv)
+{
+	EFI_STATUS ret;
+	UINT32 flags;
+	UINT64 store_size, offset = 0;
+	BOOLEAN compress = FALSE;
+	VOID *buf = NULL, *data, *compressed;
+	UINTN size, len, max_len;
+	CHAR8 *end;
+	INTN i;
+
+	if (argc > 3) {
+		fastboot_fail("Invalid parameter");
+		return;
+	}
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], (CHAR8 *)"lz4"))
+			compress = TRUE;
+		else {
+			offset = strtoul((const char *)argv[i], (char **)&end, 10);
+			if (end == argv[i] || *end != '\0') {
+				fastboot_fail("Invalid offset '%a'", argv[i]);
+				return;
+			}
+		}
+	}
+
+	max_len = compress ? MAX_DOWNLOAD_SIZE / 2 : MAX_DOWNLOAD_SIZE;
+
+	ret = log_store_get_size(&store_size);
+	if (!EFI_ERROR(ret)) {
+		size = store_size;
+		if (offset > size) {
+			fastboot_fail("Offset beyond the %ld bytes of logs", size);
+			return;
+		}
+		len = min(size - offset, max_len);
+		buf = data = AllocatePool(len ? len : 1);
+		if (!buf) {
+			fastboot_fail("Failed to allocate %ld bytes", len);
+			return;
+		}
+		ret = log_store_read(offset, data, len);
+		if (EFI_ERROR(ret)) {
+			fastboot_fail("Failed to read the log store, %r", ret);
+			goto out;
+		}
+	} else {
+		ret = get_efi_variable(&loader_guid, LOG_VAR, &size, &buf, &flags);
+		if (EFI_ERROR(ret)) {
+			fastboot_fail("failed to get log buffer from variable, %r", ret);
+			return;
+		}
+		if (offset > size) {
+			fastboot_fail("Offset beyond the %ld bytes of logs", size);
+			goto out;
+		}
+		data = (CHAR8 *)buf + offset;
+		len = min(size - offset, max_len);
+	}
+
+	if (compress) {
+		ret = lz4_compress(data, len, &compressed, &len);
+		if (EFI_ERROR(ret)) {
+			fastboot_fail("Failed to compress the logs, %r", ret);
+			goto out;
+		}
+		FreePool(buf);
+		buf = data = compressed;
+	} else if (data != buf)
+		CopyMem(buf, data, len);	/* Overlapping copy */
+
+	fastboot_stage(buf, len);
+	buf = NULL;
+	fastboot_info("total %ld", size);
+	fastboot_okay("");
+
+out:
+	if (buf)
+		FreePool(buf);
+}
+
 static void cmd_oem(INTN argc, CHAR8 **argv)
 {
 	if (argc < 2) {
@@ -495,6 +695,7 @@ static struct fastboot_cmd COMMANDS[] = {
 	{ CRASH_EVENT_MENU,		LOCKED,		cmd_oem_crash_event_menu  },
 	{ "setvar",			UNLOCKED,	cmd_oem_setvar  },
 	{ "garbage-disk",		UNLOCKED,	cmd_oem_garbage_disk  },
+	{ "format",			UNLOCKED,	cmd_oem_format  },
 	{ "reboot",			LOCKED,		cmd_oem_reboot  },
 #ifndef USER
 	{ "set-storage",		LOCKED,		cmd_oem_set_storage  },
@@ -502,7 +703,8 @@ static struct fastboot_cmd COMMANDS[] = {
 	{ "rm",				LOCKED,		cmd_oem_rm },
 #endif
 	{ "get-hashes",			LOCKED,		cmd_oem_gethashes  },
-	{ "get-provisioning-logs",	LOCKED,		cmd_oem_get_logs }
+	{ "get-provisioning-logs",	LOCKED,		cmd_oem_get_logs },
+	{ "stage-logs",			LOCKED,		cmd_oem_stage_logs }
 };
 
 static struct fastboot_cmd oem = { "oem", LOCKED, cmd_oem };
@@ -48,6 +48,8 @@
 #include "oemvars.h"
 #include "vars.h"
 #include "bootloader.h"
+#include "ext4.h"
+#include "slot.h"
 
 static struct gpt_partition_interface gparti;
 static UINT64 cur_offset;
@@ -95,15 +97,15 @@ EFI_STATUS flash_fill(UINT32 pattern, UINTN size)
 	UINTN i;
 	EFI_STATUS ret;
 
-	buf = AllocatePool(size);
-	if (!buf)
-		return EFI_OUT_OF_RESOURCES;
+	ret = io_buffer_alloc(size, 0, FALSE, (VOID **)&buf);
+	if (EFI_ERROR(ret))
+		return ret;
 
 	for (i = 0; i < size / sizeof(*buf); i++)
 		buf[i] = pattern;
 
 	ret = flash_write(buf, size);
-	FreePool(buf);
+	io_buffer_free(buf);
 	return ret;
 }
 
@@ -140,6 +142,9 @@ static EFI_STATUS _flash_gpt(VOID *data, UINTN size, logical_unit_t log_unit)
 	if (EFI_ERROR(ret))
 		return ret;
 
+	/* The misc partition may have moved */
+	slot_invalidate_metadata();
+
 	return (EFI_SUCCESS | REFRESH_PARTITION_VAR);
 }
 
@@ -211,7 +216,8 @@ static EFI_STATUS flash_zimage(VOID *data, UINTN size)
 	UINTN new_size, partlen;
 	EFI_STATUS ret;
 
-	ret = gpt_get_partition_by_label(L"boot", &gparti, LOGICAL_UNIT_USER);
+	ret = gpt_get_partition_by_label(slot_label(BOOT_LABEL), &gparti,
+					 LOGICAL_UNIT_USER);
 	if (EFI_ERROR(ret)) {
 		error(L"Unable to get information on the boot partition");
 		return ret;
@@ -282,30 +288,199 @@ static EFI_STATUS flash_zimage(VOID *data, UINTN size)
 	return ret;
 }
 
-EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label)
+/* Flash, erase and garbage-disk operations are split in steps of at
+ * most JOB_SLICE_SIZE bytes so that they can be run as background
+ * fastboot jobs.  Only one operation can be in progress at a time. */
+static struct storage_job {
+	EFI_STATUS (*step)(void);
+	UINT64 done;
+	UINT64 total;
+	BOOLEAN refresh_gpt;
+	BOOLEAN slot_metadata;	/* Overwrites the slot metadata */
+	/* Raw flash */
+	VOID *data;
+	/* Erase and fill */
+	EFI_HANDLE handle;
+	EFI_BLOCK_IO *bio;
+	UINT64 lba;
+	UINT64 end_lba;
+	VOID *pattern;
+	BOOLEAN zero;
+	UINT64 skipped;
+} job;
+
+/* Bytes left untouched by the last zero fill because they were
+ * already zero */
+static UINT64 zero_fill_skipped;
+
+static EFI_STATUS flash_raw_step(void)
+{
+	UINTN len;
+	EFI_STATUS ret;
+
+	len = min(job.total - job.done, (UINT64)JOB_SLICE_SIZE);
+	ret = flash_write(job.data + job.done, len);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	job.done += len;
+	return job.done < job.total ? EFI_NOT_READY : EFI_SUCCESS;
+}
+
+static EFI_STATUS flash_sparse_job_step(void)
+{
+	return flash_sparse_step(&job.done);
+}
+
+static EFI_STATUS fill_step(void)
+{
+	UINT64 end;
+	EFI_STATUS ret;
+
+	end = min(job.lba + JOB_SLICE_SIZE / job.bio->Media->BlockSize - 1,
+		  job.end_lba);
+	if (job.zero)
+		ret = fill_zero_with(job.bio, job.lba, end, job.pattern,
+				     N_BLOCK, &job.skipped);
+	else
+		ret = fill_with(job.bio, job.lba, end, job.pattern, N_BLOCK);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	job.done += (end + 1 - job.lba) * job.bio->Media->BlockSize;
+	job.lba = end + 1;
+	return job.lba <= job.end_lba ? EFI_NOT_READY : EFI_SUCCESS;
+}
+
+static EFI_STATUS storage_job_fill(VOID *pattern)
+{
+	job.pattern = pattern;
+	job.step = fill_step;
+	return EFI_SUCCESS;
+}
+
+/* Erase steps end on a JOB_SLICE_SIZE boundary of the disk so that
+ * they do not split the erase groups of the device.  */
+static EFI_STATUS erase_step(void)
 {
 	EFI_STATUS ret;
+	VOID *emptyblock;
+	UINT64 blocks, end;
+
+	blocks = JOB_SLICE_SIZE / job.bio->Media->BlockSize;
+	end = min((job.lba / blocks + 1) * blocks - 1, job.end_lba);
+
+	ret = storage_erase_blocks(job.handle, job.bio, job.lba, end);
+	if (ret == EFI_SUCCESS) {
+		job.done += (end + 1 - job.lba) * job.bio->Media->BlockSize;
+		job.lba = end + 1;
+		return job.lba <= job.end_lba ? EFI_NOT_READY : EFI_SUCCESS;
+	}
+
+	debug(L"Fallbacking to filling with zeros");
+	ret = io_buffer_alloc(job.bio->Media->BlockSize * N_BLOCK,
+			      job.bio->Media->IoAlign, TRUE, &emptyblock);
+	if (EFI_ERROR(ret))
+		return ret;
 
-	ret = gpt_get_partition_by_label(label, &gparti, LOGICAL_UNIT_USER);
+	job.zero = TRUE;
+	storage_job_fill(emptyblock);
+	return EFI_NOT_READY;
+}
+
+void storage_job_abort(void)
+{
+	if (job.slot_metadata)
+		slot_invalidate_metadata();
+	if (job.step == flash_sparse_job_step)
+		flash_sparse_abort();
+	if (job.pattern)
+		io_buffer_free(job.pattern);
+	memset(&job, 0, sizeof(job));
+}
+
+EFI_STATUS storage_job_step(UINT64 *done, UINT64 *total)
+{
+	EFI_STATUS ret;
+
+	if (!job.step)
+		return EFI_INVALID_PARAMETER;
+
+	ret = job.step();
+	if (done)
+		*done = job.done;
+	if (total)
+		*total = job.total;
+	if (ret == EFI_NOT_READY)
+		return ret;
+
+	if (!EFI_ERROR(ret) && job.refresh_gpt)
+		ret = gpt_refresh();
+
+	zero_fill_skipped = job.skipped;
+	if (zero_fill_skipped)
+		debug(L"Zero fill skipped %ld bytes already zero",
+		      zero_fill_skipped);
+
+	/* The sparse step releases its resources on completion */
+	if (job.step == flash_sparse_job_step)
+		job.step = NULL;
+	storage_job_abort();
+	return ret;
+}
+
+static EFI_STATUS storage_job_run(void)
+{
+	EFI_STATUS ret;
+
+	do {
+		ret = storage_job_step(NULL, NULL);
+	} while (ret == EFI_NOT_READY);
+
+	return ret;
+}
+
+EFI_STATUS flash_partition_begin(VOID *data, UINTN size, CHAR16 *label)
+{
+	EFI_STATUS ret;
+
+	storage_job_abort();
+
+	ret = gpt_get_partition_by_label(slot_label(label), &gparti,
+					 LOGICAL_UNIT_USER);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to get partition %s", label);
 		return ret;
 	}
 
 	cur_offset = gparti.part.starting_lba * gparti.bio->Media->BlockSize;
+	job.total = size;
+	job.refresh_gpt = !CompareGuid(&gparti.part.type,
+				       &EfiPartTypeSystemPartitionGuid);
+	job.slot_metadata = !StrCmp(label, MISC_LABEL);
+
+	if (is_sparse_image(data, size)) {
+		ret = flash_sparse_begin(data, size);
+		if (EFI_ERROR(ret))
+			return ret;
+		job.step = flash_sparse_job_step;
+	} else {
+		job.data = data;
+		job.step = flash_raw_step;
+	}
 
-	if (is_sparse_image(data, size))
-		ret = flash_sparse(data, size);
-	else
-		ret = flash_write(data, size);
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label)
+{
+	EFI_STATUS ret;
 
+	ret = flash_partition_begin(data, size, label);
 	if (EFI_ERROR(ret))
 		return ret;
 
-	if (!CompareGuid(&gparti.part.type, &EfiPartTypeSystemPartitionGuid))
-		return gpt_refresh();
-
-	return EFI_SUCCESS;
+	return storage_job_run();
 }
 
 static struct label_exception {
@@ -344,6 +519,22 @@ EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label)
 	return flash_partition(data, size, label);
 }
 
+BOOLEAN flash_is_resumable(CHAR16 *label)
+{
+	UINTN i;
+
+#ifndef USER
+	CHAR16 esp[] = L"/ESP/";
+	if (!StrnCmp(esp, label, StrLen(esp)))
+		return FALSE;
+#endif
+	for (i = 0; i < ARRAY_SIZE(LABEL_EXCEPTIONS); i++)
+		if (!StrCmp(LABEL_EXCEPTIONS[i].name, label))
+			return FALSE;
+
+	return TRUE;
+}
+
 EFI_STATUS flash_file(EFI_HANDLE image, CHAR16 *filename, CHAR16 *label)
 {
 	EFI_STATUS ret;
@@ -376,39 +567,59 @@ out:
 
 }
 
-EFI_STATUS erase_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, UINT64 start, UINT64 end)
+BOOLEAN erase_is_resumable(CHAR16 *label)
+{
+	return !!StrCmp(L"keystore", label);
+}
+
+EFI_STATUS erase_by_label_begin(CHAR16 *label)
 {
 	EFI_STATUS ret;
 
-	ret = storage_erase_blocks(handle, bio, start, end);
-	if (ret == EFI_SUCCESS)
+	storage_job_abort();
+	zero_fill_skipped = 0;
+
+	ret = gpt_get_partition_by_label(slot_label(label), &gparti,
+					 LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to get partition %s", label);
 		return ret;
+	}
 
-	debug(L"Fallbacking to filling with zeros");
-	return fill_zero(bio, start, end);
+	job.handle = gparti.handle;
+	job.bio = gparti.bio;
+	job.lba = gparti.part.starting_lba;
+	job.end_lba = gparti.part.ending_lba;
+	job.total = (job.end_lba + 1 - job.lba) * job.bio->Media->BlockSize;
+	job.refresh_gpt = !CompareGuid(&gparti.part.type,
+				       &EfiPartTypeSystemPartitionGuid);
+	job.slot_metadata = !StrCmp(label, MISC_LABEL);
+	job.step = erase_step;
+
+	return EFI_SUCCESS;
 }
 
 EFI_STATUS erase_by_label(CHAR16 *label)
 {
 	EFI_STATUS ret;
 
-	if (!StrCmp(L"keystore", label))
+	if (!erase_is_resumable(label))
 		return set_user_keystore(NULL, 0);
 
-	ret = gpt_get_partition_by_label(label, &gparti, LOGICAL_UNIT_USER);
-	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Failed to get partition %s", label);
+	ret = erase_by_label_begin(label);
+	if (EFI_ERROR(ret))
 		return ret;
-	}
-	ret = erase_blocks(gparti.handle, gparti.bio, gparti.part.starting_lba, gparti.part.ending_lba);
-	if (EFI_ERROR(ret)) {
+
+	ret = storage_job_run();
+	if (EFI_ERROR(ret))
 		efi_perror(ret, L"Failed to erase partition %s", label);
-		return ret;
-	}
-	if (!CompareGuid(&gparti.part.type, &EfiPartTypeSystemPartitionGuid))
-		return gpt_refresh();
 
-	return EFI_SUCCESS;
+	return ret;
+}
+
+UINT64 erase_skipped_bytes(void)
+{
+	return zero_fill_skipped;
 }
 
 static EFI_STATUS generate_random_number_chunk(VOID *chunk, UINTN size)
@@ -444,14 +655,54 @@ static EFI_STATUS generate_random_number_chunk(VOID *chunk, UINTN size)
 	return EFI_SUCCESS;
 }
 
-EFI_STATUS garbage_disk(void)
+/* Write an empty ext4 filesystem on the LABEL partition.  The image
+ * is generated on the fly as a sparse image so that only the
+ * filesystem metadata are actually written.  */
+EFI_STATUS format_by_label(CHAR16 *label)
+{
+	EFI_STATUS ret;
+	UINT8 random[32];
+	UINT64 size;
+	VOID *image;
+	UINTN image_size;
+
+	ret = gpt_get_partition_by_label(slot_label(label), &gparti,
+					 LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to get partition %s", label);
+		return ret;
+	}
+
+	size = (gparti.part.ending_lba + 1 - gparti.part.starting_lba) *
+		gparti.bio->Media->BlockSize;
+
+	ret = generate_random_number_chunk(random, sizeof(random));
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = ext4_sparse_image(size, random, random + 16, &image, &image_size);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to generate the %s filesystem", label);
+		return ret;
+	}
+
+	ret = flash_partition(image, image_size, label);
+	FreePool(image);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to format partition %s", label);
+
+	return ret;
+}
+
+EFI_STATUS garbage_disk_begin(void)
 {
 	struct gpt_partition_interface gparti;
 	EFI_STATUS ret;
 	VOID *chunk;
-	VOID *aligned_chunk;
 	UINTN size;
 
+	storage_job_abort();
+
 	ret = gpt_get_root_disk(&gparti, LOGICAL_UNIT_USER);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to get disk information");
@@ -459,21 +710,35 @@ EFI_STATUS garbage_disk(void)
 	}
 
 	size = gparti.bio->Media->BlockSize * N_BLOCK;
-	ret = alloc_aligned(&chunk, &aligned_chunk, size, gparti.bio->Media->IoAlign);
+	ret = io_buffer_alloc(size, gparti.bio->Media->IoAlign, FALSE, &chunk);
 	if (EFI_ERROR(ret)) {
 		error(L"Unable to allocate the garbage chunk");
 		return ret;
 	}
 
-	ret = generate_random_number_chunk(aligned_chunk, size);
+	ret = generate_random_number_chunk(chunk, size);
 	if (EFI_ERROR(ret)) {
-		FreePool(chunk);
+		io_buffer_free(chunk);
 		return ret;
 	}
 
-	ret = fill_with(gparti.bio, gparti.part.starting_lba,
-			gparti.part.ending_lba, aligned_chunk, N_BLOCK);
+	job.bio = gparti.bio;
+	job.lba = gparti.part.starting_lba;
+	job.end_lba = gparti.part.ending_lba;
+	job.total = (job.end_lba + 1 - job.lba) * job.bio->Media->BlockSize;
+	job.refresh_gpt = TRUE;
+	job.slot_metadata = TRUE;
+
+	return storage_job_fill(chunk);
+}
+
+EFI_STATUS garbage_disk(void)
+{
+	EFI_STATUS ret;
+
+	ret = garbage_disk_begin();
+	if (EFI_ERROR(ret))
+		return ret;
 
-	FreePool(chunk);
-	return gpt_refresh();
+	return storage_job_run();
 }
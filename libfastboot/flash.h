@@ -48,8 +48,27 @@ EFI_STATUS flash_fill(UINT32 pattern, UINTN size);
 EFI_STATUS flash(VOID *data, UINTN size, CHAR16 *label);
 EFI_STATUS flash_file(EFI_HANDLE image, CHAR16 *filename, CHAR16 *label);
 EFI_STATUS erase_by_label(CHAR16 *label);
+EFI_STATUS format_by_label(CHAR16 *label);
 EFI_STATUS garbage_disk(void);
 EFI_STATUS flash_partition(VOID *data, UINTN size, CHAR16 *label);
 EFI_STATUS fill_zero(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end);
 
+/* Resumable variants of flash_partition(), erase_by_label() and
+ * garbage_disk().  Once started, the operation progresses by calls
+ * to storage_job_step() which returns EFI_NOT_READY until it is
+ * complete.  A step processes at most JOB_SLICE_SIZE bytes. */
+#define JOB_SLICE_SIZE	(16 * 1024 * 1024)
+
+BOOLEAN flash_is_resumable(CHAR16 *label);
+BOOLEAN erase_is_resumable(CHAR16 *label);
+EFI_STATUS flash_partition_begin(VOID *data, UINTN size, CHAR16 *label);
+EFI_STATUS erase_by_label_begin(CHAR16 *label);
+EFI_STATUS garbage_disk_begin(void);
+EFI_STATUS storage_job_step(UINT64 *done, UINT64 *total);
+void storage_job_abort(void);
+
+/* Number of bytes the last erase did not write because they were
+ * already zero, see fill_zero_with().  */
+UINT64 erase_skipped_bytes(void);
+
 #endif	/* _FLASH_H_ */
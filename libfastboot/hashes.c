@@ -423,37 +423,79 @@ static EFI_STATUS read_partition(struct gpt_partition_interface *gparti, UINT64
 
 #define CHUNK 1024 * 1024
 #define MIN(a, b) ((a < b) ? (a) : (b))
-static EFI_STATUS hash_partition(struct gpt_partition_interface *gparti, UINT64 len, CHAR8 *hash)
+/* Amount of data hashed per hash_partition_step() call */
+#define HASH_STEP_SIZE (16 * CHUNK)
+
+/* Partition being hashed, see hash_partition_begin() */
+static struct gpt_partition_interface hash_gparti;
+static EVP_MD_CTX hash_mdctx;
+static CHAR8 *hash_buffer;
+static UINT64 hash_offset;
+static UINT64 hash_len;
+
+static void hash_partition_abort(void)
+{
+	if (!hash_buffer)
+		return;
+
+	EVP_MD_CTX_cleanup(&hash_mdctx);
+	io_buffer_free(hash_buffer);
+	hash_buffer = NULL;
+}
+
+static EFI_STATUS hash_partition_begin(struct gpt_partition_interface *gparti, UINT64 len)
 {
-	EVP_MD_CTX mdctx;
-	CHAR8 *buffer;
-	UINT64 offset;
-	UINT64 chunklen;
 	EFI_STATUS ret;
 
-	buffer = AllocatePool(CHUNK);
-	if (!buffer)
-		return EFI_OUT_OF_RESOURCES;
+	hash_partition_abort();
+
+	ret = io_buffer_alloc(CHUNK, gparti->bio->Media->IoAlign, FALSE,
+			      (VOID **)&hash_buffer);
+	if (EFI_ERROR(ret)) {
+		hash_buffer = NULL;
+		return ret;
+	}
 
 	if (!selected_md)
 		set_hash_algorithm(NULL);
 
-	EVP_MD_CTX_init(&mdctx);
-	EVP_DigestInit_ex(&mdctx, selected_md, NULL);
+	memcpy(&hash_gparti, gparti, sizeof(hash_gparti));
+	hash_offset = 0;
+	hash_len = len;
+	EVP_MD_CTX_init(&hash_mdctx);
+	EVP_DigestInit_ex(&hash_mdctx, selected_md, NULL);
+
+	return EFI_SUCCESS;
+}
+
+/* Hash the next HASH_STEP_SIZE bytes of the partition.  Return
+ * EFI_NOT_READY until the whole length has been hashed, HASH is then
+ * set.  */
+static EFI_STATUS hash_partition_step(CHAR8 *hash)
+{
+	UINT64 end, chunklen;
+	EFI_STATUS ret;
+
+	if (!hash_buffer)
+		return EFI_INVALID_PARAMETER;
 
-	for (offset = 0; offset < len; offset += CHUNK) {
-		chunklen = MIN(len - offset, CHUNK);
-		ret = read_partition(gparti, offset, chunklen, buffer);
-		if (EFI_ERROR(ret))
-			goto free;
-		EVP_DigestUpdate(&mdctx, buffer, chunklen);
+	end = MIN(hash_len, hash_offset + HASH_STEP_SIZE);
+	for (; hash_offset < end; hash_offset += chunklen) {
+		chunklen = MIN(end - hash_offset, CHUNK);
+		ret = read_partition(&hash_gparti, hash_offset, chunklen, hash_buffer);
+		if (EFI_ERROR(ret)) {
+			hash_partition_abort();
+			return ret;
+		}
+		EVP_DigestUpdate(&hash_mdctx, hash_buffer, chunklen);
 	}
-	EVP_DigestFinal_ex(&mdctx, hash, NULL);
 
-free:
-	EVP_MD_CTX_cleanup(&mdctx);
-	FreePool(buffer);
-	return ret;
+	if (hash_offset < hash_len)
+		return EFI_NOT_READY;
+
+	EVP_DigestFinal_ex(&hash_mdctx, hash, NULL);
+	hash_partition_abort();
+	return EFI_SUCCESS;
 }
 
 static EFI_STATUS get_ext4_len(struct gpt_partition_interface *gparti, UINT64 *len)
@@ -502,10 +544,9 @@ static EFI_STATUS check_verity_header(struct gpt_partition_interface *gparti, UI
 	return EFI_SUCCESS;
 }
 
-EFI_STATUS get_ext4_hash(CHAR16 *label)
+EFI_STATUS get_ext4_hash_begin(CHAR16 *label)
 {
 	struct gpt_partition_interface gparti;
-	CHAR8 hash[EVP_MAX_MD_SIZE];
 	EFI_STATUS ret;
 	UINT64 ext4_len;
 
@@ -527,9 +568,37 @@ EFI_STATUS get_ext4_hash(CHAR16 *label)
 
 	debug(L"filesystem size %lld\n", ext4_len);
 
-	ret = hash_partition(&gparti, ext4_len, hash);
+	return hash_partition_begin(&gparti, ext4_len);
+}
+
+EFI_STATUS get_ext4_hash_step(void)
+{
+	CHAR8 hash[EVP_MAX_MD_SIZE];
+	EFI_STATUS ret;
+
+	ret = hash_partition_step(hash);
+	if (ret == EFI_SUCCESS)
+		report_hash(L"/", hash_gparti.part.name, hash);
+
+	return ret;
+}
+
+void get_ext4_hash_abort(void)
+{
+	hash_partition_abort();
+}
+
+EFI_STATUS get_ext4_hash(CHAR16 *label)
+{
+	EFI_STATUS ret;
+
+	ret = get_ext4_hash_begin(label);
 	if (EFI_ERROR(ret))
 		return ret;
-	report_hash(L"/", gparti.part.name, hash);
-	return EFI_SUCCESS;
+
+	do {
+		ret = get_ext4_hash_step();
+	} while (ret == EFI_NOT_READY);
+
+	return ret;
 }
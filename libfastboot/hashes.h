@@ -40,4 +40,11 @@ EFI_STATUS get_esp_hash(void);
 EFI_STATUS get_ext4_hash(CHAR16 *label);
 EFI_STATUS set_hash_algorithm(const CHAR8 *algo);
 
+/* Resumable get_ext4_hash(): get_ext4_hash_step() hashes a slice of
+ * the filesystem and returns EFI_NOT_READY until the hash has been
+ * reported. */
+EFI_STATUS get_ext4_hash_begin(CHAR16 *label);
+EFI_STATUS get_ext4_hash_step(void);
+void get_ext4_hash_abort(void);
+
 #endif	/* _HASHES_H_ */
@@ -42,35 +42,38 @@
 
 /* "secureboot": Indicates whether UEFI Secure Boot is enabled. This
    is a pre-requisite for Verified Boot.  */
-static EFI_STATUS publish_secureboot(void)
+static char *get_secureboot(void)
 {
-	return fastboot_publish("secureboot",
-				is_efi_secure_boot_enabled() ? "yes" : "no" );
+	return is_efi_secure_boot_enabled() ? "yes" : "no";
 }
 
 /* "product-name": Reports "product_name" field in DMI.  */
-static EFI_STATUS publish_product_name(void)
+static char *get_product_name(void)
 {
-	return fastboot_publish("product-name",
-				SMBIOS_GET_STRING(1, ProductName));
+	return (char *)SMBIOS_GET_STRING(1, ProductName);
 }
 
 /* "firmware": Reports the current device firmware version from
  * DMI. Combines the values of DMI "bios_vendor" and "bios_version"
  * fields.  */
 static char firmware_str[128];
-static EFI_STATUS publish_firmware(void)
+static char *get_firmware(void)
 {
 	int len;
 
+	if (firmware_str[0] != '\0')
+		return firmware_str;
+
 	len = snprintf((CHAR8 *)firmware_str, sizeof(firmware_str) - 1,
 		       (CHAR8 *)"%a %a",
 		       SMBIOS_GET_STRING(0, Vendor),
 		       SMBIOS_GET_STRING(0, BiosVersion));
-	if (len == -1)
-		return EFI_INVALID_PARAMETER;
+	if (len == -1) {
+		firmware_str[0] = '\0';
+		return NULL;
+	}
 
-	return fastboot_publish("firmware", firmware_str);
+	return firmware_str;
 }
 
 /* "boot-state": Indicates the device's color-coded boot state as per
@@ -80,71 +83,64 @@ static EFI_STATUS publish_firmware(void)
 static char *BOOT_STATES_STRING[] = {
 	"GREEN", "YELLOW", "ORANGE", "RED"
 };
-static EFI_STATUS publish_boot_state(void)
+static char *get_boot_state(void)
 {
 	UINT8 state;
 	EFI_STATUS ret;
 
 	ret = get_efi_variable_byte(&fastboot_guid, BOOT_STATE_VAR, &state);
 	if (EFI_ERROR(ret) || state >= ARRAY_SIZE(BOOT_STATES_STRING))
-		return fastboot_publish("boot-state", "unknown");
-
-	return fastboot_publish("boot-state", BOOT_STATES_STRING[state]);
-}
+		return "unknown";
 
-/* "device-state": Indicates the device's lock state as per Google's
- * Verified Boot specification. Possible values are "unlocked",
- * "locked", "verified". */
-static EFI_STATUS publish_device_state(void)
-{
-	return fastboot_publish("device-state", get_current_state_string());
+	return BOOT_STATES_STRING[state];
 }
 
 /* "board": Indicates the board information, combining the values of
  * DMI "board_vendor", "board_name", and "board_version" fields.  */
 static char board_str[128];
-static EFI_STATUS publish_board(void)
+static char *get_board(void)
 {
 	int len;
 
+	if (board_str[0] != '\0')
+		return board_str;
+
 	len = snprintf((CHAR8 *)board_str, sizeof(board_str),
 		       (CHAR8 *)"%a %a %a",
 		       SMBIOS_GET_STRING(2, Manufacturer),
 		       SMBIOS_GET_STRING(2, ProductName),
 		       SMBIOS_GET_STRING(2, Version));
-	if (len < 0)
-		return EFI_INVALID_PARAMETER;
+	if (len < 0) {
+		board_str[0] = '\0';
+		return NULL;
+	}
 
-	return fastboot_publish("board", board_str);
+	return board_str;
 }
 
 /* "serialno": The device serial number. */
-static EFI_STATUS publish_serialno(void)
+static char *get_serialno(void)
 {
 	char *serial = get_serial_number();
-	return fastboot_publish("serialno", serial ? serial : "N/A");
+	return serial ? serial : "N/A";
 }
 
-static EFI_STATUS (*PUBLISH_FUNCTION[])(void) = {
-	publish_secureboot,
-	publish_product_name,
-	publish_firmware,
-	publish_boot_state,
-	publish_device_state,
-	publish_board,
-	publish_serialno
+/* Values are only computed when the host requests them, the SMBIOS
+ * strings are cached by their getter on first use.  */
+static struct fastboot_var_def VARIABLES[] = {
+	{ "secureboot",		NULL,	get_secureboot },
+	{ "product-name",	NULL,	get_product_name },
+	{ "firmware",		NULL,	get_firmware },
+	{ "boot-state",		NULL,	get_boot_state },
+	/* "device-state": Indicates the device's lock state as per
+	 * Google's Verified Boot specification. Possible values are
+	 * "unlocked", "locked", "verified". */
+	{ "device-state",	NULL,	get_current_state_string },
+	{ "board",		NULL,	get_board },
+	{ "serialno",		NULL,	get_serialno }
 };
 
 EFI_STATUS publish_intel_variables(void)
 {
-	EFI_STATUS ret;
-	UINTN i;
-
-	for (i = 0; i < ARRAY_SIZE(PUBLISH_FUNCTION); i++) {
-		ret = PUBLISH_FUNCTION[i]();
-		if (EFI_ERROR(ret))
-			return ret;
-	}
-
-	return EFI_SUCCESS;
+	return fastboot_publish_table(VARIABLES, ARRAY_SIZE(VARIABLES));
 }
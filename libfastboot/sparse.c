@@ -77,10 +77,13 @@ BOOLEAN is_sparse_image(void *data, UINT64 size)
 
 static EFI_STATUS init_buffer()
 {
-	buffer = AllocatePool(BUFFER_SIZE);
-	if (!buffer) {
+	EFI_STATUS ret;
+
+	ret = io_buffer_alloc(BUFFER_SIZE, 0, FALSE, (VOID **)&buffer);
+	if (EFI_ERROR(ret)) {
 		error(L"Allocation failed, sparse file buffer is disabled");
-		return EFI_OUT_OF_RESOURCES;
+		buffer = NULL;
+		return ret;
 	}
 
 	cur_size = 0;
@@ -92,7 +95,7 @@ static void free_buffer()
 	if (!buffer)
 		return;
 
-	FreePool(buffer);
+	io_buffer_free(buffer);
 	buffer = NULL;
 }
 
@@ -133,7 +136,9 @@ static EFI_STATUS flash_raw_data(void *data, unsigned size)
 	return EFI_SUCCESS;
 }
 
-static EFI_STATUS flash_chunk(struct sparse_header *sph, struct chunk_header *ckh, CHAR8 *data, unsigned int size)
+/* Flash LEN bytes of the chunk output, starting at OFFSET */
+static EFI_STATUS flash_chunk(struct sparse_header *sph, struct chunk_header *ckh,
+			      CHAR8 *data, unsigned int size, UINT64 offset, UINT64 len)
 {
 	EFI_STATUS ret;
 
@@ -143,17 +148,17 @@ static EFI_STATUS flash_chunk(struct sparse_header *sph, struct chunk_header *ck
 			error(L"inconsistent raw chunk");
 			return EFI_INVALID_PARAMETER;
 		}
-		return flash_raw_data(data, size);
+		return flash_raw_data(data + offset, len);
 	case CHUNK_TYPE_DONT_CARE:
 		ret = flush_buffer();
 		if (EFI_ERROR(ret))
 			return ret;
-		return flash_skip(ckh->chunk_sz * sph->blk_sz);
+		return flash_skip(len);
 	case CHUNK_TYPE_FILL:
 		ret = flush_buffer();
 		if (EFI_ERROR(ret))
 			return ret;
-		return flash_fill(*((UINT32 *) data), ckh->chunk_sz * sph->blk_sz);
+		return flash_fill(*((UINT32 *) data), len);
 	case CHUNK_TYPE_CRC32:
 		debug(L"crc chunk not implemented yet %d", size);
 		break;
@@ -164,44 +169,108 @@ static EFI_STATUS flash_chunk(struct sparse_header *sph, struct chunk_header *ck
 	return EFI_SUCCESS;
 }
 
-EFI_STATUS flash_sparse(void *data, UINT64 size)
+/* Sparse image being flashed.  Each flash_sparse_step() call flashes
+ * at most JOB_SLICE_SIZE bytes of the current chunk, so that large
+ * RAW or FILL chunks do not block the caller for long.  */
+static struct sparse_header *cur_sph;
+static CHAR8 *cur_chunk;
+static UINT64 cur_chunk_done;
+static UINT64 cur_rlen;
+static UINT64 cur_image_size;
+static unsigned int cur_chunk_nb;
+
+EFI_STATUS flash_sparse_begin(void *data, UINT64 size)
 {
-	struct sparse_header *sph;
-	CHAR8 *s;
-	UINT64 rlen;
-	unsigned int i;
+	cur_sph = data;
+	cur_chunk = (CHAR8 *)data + cur_sph->file_hdr_sz;
+	cur_chunk_done = 0;
+	cur_rlen = size;
+	cur_image_size = size;
+	cur_chunk_nb = 0;
+
+	init_buffer();
+
+	return EFI_SUCCESS;
+}
+
+void flash_sparse_abort(void)
+{
+	free_buffer();
+	cur_sph = NULL;
+}
+
+EFI_STATUS flash_sparse_step(UINT64 *done)
+{
+	struct chunk_header *ckh;
+	UINT64 chunk_len, len;
 	EFI_STATUS ret_flush_buffer, ret = EFI_SUCCESS;
 
-	rlen = size;
-	s = data;
-	sph = data;
-	s += sph->file_hdr_sz;
+	if (!cur_sph)
+		return EFI_INVALID_PARAMETER;
 
-	init_buffer();
+	if (cur_chunk_nb == cur_sph->total_chunks)
+		goto out;
 
-	for (i = 0; i < sph->total_chunks; i++) {
-		struct chunk_header *ckh;
-		ckh = (struct chunk_header *) s;
+	ckh = (struct chunk_header *)cur_chunk;
 
-		if (rlen < sph->chunk_hdr_sz || rlen < ckh->total_sz) {
-			error(L"sparse chunk truncated, %ld, %ld", rlen, size);
-			ret = EFI_INVALID_PARAMETER;
-			break;
-		}
-		if (ckh->total_sz < sph->chunk_hdr_sz) {
-			error(L"sparse chunk malformated, %d, %d", ckh->total_sz, sph->chunk_hdr_sz);
-			ret = EFI_INVALID_PARAMETER;
-			break;
-		}
-		ret = flash_chunk(sph, ckh, s + sph->chunk_hdr_sz, ckh->total_sz - sph->chunk_hdr_sz);
-		if (EFI_ERROR(ret))
-			break;
+	if (cur_rlen < cur_sph->chunk_hdr_sz || cur_rlen < ckh->total_sz) {
+		error(L"sparse chunk truncated, %ld, %ld", cur_rlen, cur_image_size);
+		ret = EFI_INVALID_PARAMETER;
+		goto out;
+	}
+	if (ckh->total_sz < cur_sph->chunk_hdr_sz) {
+		error(L"sparse chunk malformated, %d, %d", ckh->total_sz, cur_sph->chunk_hdr_sz);
+		ret = EFI_INVALID_PARAMETER;
+		goto out;
+	}
 
-		s += ckh->total_sz;
-		rlen -= ckh->total_sz;
+	chunk_len = (UINT64)ckh->chunk_sz * cur_sph->blk_sz;
+	if (ckh->chunk_type == CHUNK_TYPE_CRC32)
+		chunk_len = 0;
+	len = min(chunk_len - cur_chunk_done, (UINT64)JOB_SLICE_SIZE);
+	ret = flash_chunk(cur_sph, ckh, cur_chunk + cur_sph->chunk_hdr_sz,
+			  ckh->total_sz - cur_sph->chunk_hdr_sz,
+			  cur_chunk_done, len);
+	if (EFI_ERROR(ret))
+		goto out;
+
+	cur_chunk_done += len;
+	if (cur_chunk_done < chunk_len) {
+		if (done)
+			*done = cur_image_size - cur_rlen +
+				(ckh->chunk_type == CHUNK_TYPE_RAW ? cur_chunk_done : 0);
+		return EFI_NOT_READY;
 	}
 
+	cur_chunk_done = 0;
+	cur_chunk += ckh->total_sz;
+	cur_rlen -= ckh->total_sz;
+	cur_chunk_nb++;
+
+	if (done)
+		*done = cur_image_size - cur_rlen;
+
+	return EFI_NOT_READY;
+
+out:
 	ret_flush_buffer = flush_buffer();
-	free_buffer();
+	flash_sparse_abort();
+	if (done)
+		*done = cur_image_size - cur_rlen;
 	return EFI_ERROR(ret) ? ret : ret_flush_buffer;
 }
+
+EFI_STATUS flash_sparse(void *data, UINT64 size)
+{
+	EFI_STATUS ret;
+
+	ret = flash_sparse_begin(data, size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	do {
+		ret = flash_sparse_step(NULL);
+	} while (ret == EFI_NOT_READY);
+
+	return ret;
+}
@@ -40,4 +40,11 @@
 int is_sparse_image(void *data, UINT64 size);
 EFI_STATUS flash_sparse(void *data, UINT64 size);
 
+/* Resumable flash_sparse(): flash_sparse_step() flashes at most
+ * JOB_SLICE_SIZE bytes of one chunk and returns EFI_NOT_READY until
+ * the whole image has been flashed. */
+EFI_STATUS flash_sparse_begin(void *data, UINT64 size);
+EFI_STATUS flash_sparse_step(UINT64 *done);
+void flash_sparse_abort(void);
+
 #endif	/* _SPARSE_H_ */
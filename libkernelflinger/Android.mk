@@ -51,10 +51,18 @@ ifeq ($(KERNELFLINGER_USE_CHARGING_APPLET),true)
     LOCAL_CFLAGS += -DUSE_CHARGING_APPLET
 endif
 
+ifeq ($(KERNELFLINGER_USE_LOG_STORE),true)
+    LOCAL_CFLAGS += -DUSE_LOG_STORE
+endif
+
 ifneq ($(KERNELFLINGER_IGNORE_RSCI),true)
     LOCAL_CFLAGS += -DUSE_RSCI
 endif
 
+ifeq ($(KERNELFLINGER_ZERO_FILL_VERIFY),true)
+    LOCAL_CFLAGS += -DZERO_FILL_VERIFY
+endif
+
 LOCAL_SRC_FILES := \
 	android.c \
 	efilinux.c \
@@ -72,6 +80,8 @@ LOCAL_SRC_FILES := \
 	ui_boot_menu.c \
 	ui_confirm.c \
 	log.c \
+	log_store.c \
+	lz4.c \
 	em.c \
 	gpt.c \
 	storage.c \
@@ -84,7 +94,8 @@ LOCAL_SRC_FILES := \
 	targets.c \
 	smbios.c \
 	oemvars.c \
-	text_parser.c
+	text_parser.c \
+	slot.c
 
 ifeq ($(HAL_AUTODETECT),true)
     LOCAL_SRC_FILES += blobstore.c
@@ -223,14 +223,48 @@ out:
 }
 
 #ifdef USE_RSCI
+/* The boot logic and the boot reason query the RSCI sources several
+ * times per boot, the table is only looked up and checked once.  */
+static struct {
+	BOOLEAN loaded;
+	enum wake_sources wake_source;
+	enum reset_sources reset_source;
+} rsci;
+
+static void rsci_load(void)
+{
+	EFI_STATUS ret;
+
+	if (rsci.loaded)
+		return;
+	rsci.loaded = TRUE;
+	rsci.wake_source = WAKE_ERROR;
+	rsci.reset_source = RESET_ERROR;
+
+	ret = get_acpi_table((CHAR8 *)"RSCI", (VOID **)&RSCI_table);
+	if (EFI_ERROR(ret))
+		return;
+
+	ret = acpi_table_is_supported(&RSCI_table->header);
+	if (EFI_ERROR(ret)) {
+		error(L"Failed to match a supported ACPI table entry");
+		return;
+	}
+
+	rsci.wake_source = RSCI_table->wake_source;
+	rsci.reset_source = RSCI_table->reset_source;
+}
+
 enum wake_sources rsci_get_wake_source(void)
 {
-	return get_acpi_field(RSCI, wake_source);
+	rsci_load();
+	return rsci.wake_source;
 }
 
 enum reset_sources rsci_get_reset_source(void)
 {
-	return get_acpi_field(RSCI, reset_source);
+	rsci_load();
+	return rsci.reset_source;
 }
 #else
 enum wake_sources rsci_get_wake_source(void)
@@ -45,6 +45,8 @@
 #include "gpt.h"
 #include "storage.h"
 #include "text_parser.h"
+#include "slot.h"
+#include "log_store.h"
 #ifdef HAL_AUTODETECT
 #include "blobstore.h"
 #endif
@@ -391,42 +393,64 @@ static CHAR16 *get_reset_reason(void)
 }
 
 
-static CHAR16 *get_boot_reason(void)
-{
-        CHAR16 *bootreason, *pos;
-
-        bootreason = get_wake_reason();
-        if (bootreason)
-                goto done;
+#define REBOOT_REASON_VAR       L"LoaderEntryRebootReason"
 
-        bootreason = get_reset_reason();
-        if (bootreason)
-                goto done;
+/* The reboot reason set by the OS is consumed on the first read.
+ * The variable is only deleted when it is actually present to avoid
+ * a non-volatile store transaction on every boot. */
+static CHAR16 *get_reboot_reason(void)
+{
+        CHAR16 *reason, *pos;
 
-        bootreason = get_efi_variable_str(&loader_guid,
-                                          L"LoaderEntryRebootReason");
-        if (!bootreason) {
-                debug(L"Error while trying to get LoaderEntryRebootReason variable");
-                bootreason = StrDuplicate(L"unknown");
-                goto done;
+        reason = get_efi_variable_str(&loader_guid, REBOOT_REASON_VAR);
+        if (!reason) {
+                debug(L"No %s variable", REBOOT_REASON_VAR);
+                return NULL;
         }
 
-        pos = bootreason;
-        while (*pos) {
+        del_efi_variable(&loader_guid, REBOOT_REASON_VAR);
+
+        for (pos = reason; *pos; pos++) {
                 /* Only allow alphanumeric characters */
                 if (!((*pos >= L'0' && *pos <= L'9') ||
                             (*pos >= L'a' && *pos <= L'z') ||
                             *pos == L'_')) {
-                        debug(L"Error, LoaderEntryRebootReason contains non-alphanumeric characters");
-                        FreePool(bootreason);
-                        bootreason = StrDuplicate(L"unknown");
-                        break;
+                        debug(L"Error, %s contains non-alphanumeric characters",
+                              REBOOT_REASON_VAR);
+                        FreePool(reason);
+                        return NULL;
                 }
-                pos++;
         }
-done:
-        del_efi_variable(&loader_guid, L"LoaderEntryRebootReason");
-        return bootreason;
+
+        return reason;
+}
+
+static CHAR16 *boot_reason;
+
+const CHAR16 *get_boot_reason(void)
+{
+        CHAR16 *reboot_reason;
+
+        if (boot_reason)
+                return boot_reason;
+
+        /* Always consume the reboot reason so that a stale one is
+         * not reported on a later boot. */
+        reboot_reason = get_reboot_reason();
+
+        boot_reason = get_wake_reason();
+        if (!boot_reason)
+                boot_reason = get_reset_reason();
+        if (!boot_reason)
+                boot_reason = reboot_reason;
+        else if (reboot_reason)
+                FreePool(reboot_reason);
+        if (!boot_reason)
+                boot_reason = StrDuplicate(L"unknown");
+
+        if (boot_reason)
+                debug(L"Boot reason: %s", boot_reason);
+        return boot_reason;
 }
 
 
@@ -623,7 +647,8 @@ static EFI_STATUS setup_command_line(
         CHAR16 *cmdline16 = NULL;
         char   *serialno = NULL;
         CHAR16 *serialport = NULL;
-        CHAR16 *bootreason = NULL;
+        const CHAR16 *bootreason;
+        const CHAR16 *slot;
 
         EFI_PHYSICAL_ADDRESS cmdline_addr;
         CHAR8 *cmdline;
@@ -668,6 +693,14 @@ static EFI_STATUS setup_command_line(
         if (EFI_ERROR(ret))
                 goto out;
 
+        slot = slot_get_active();
+        if (slot) {
+                ret = prepend_command_line(&cmdline16,
+                                L"androidboot.slot_suffix=%s", slot);
+                if (EFI_ERROR(ret))
+                        goto out;
+        }
+
         ret = prepend_command_line(&cmdline16, L"androidboot.verifiedbootstate=%s",
                                    boot_state_to_string(boot_state));
         if (EFI_ERROR(ret))
@@ -742,7 +775,6 @@ static EFI_STATUS setup_command_line(
         ret = EFI_SUCCESS;
 out:
         FreePool(cmdline16);
-        FreePool(bootreason);
         FreePool(serialport);
 
         return ret;
@@ -801,6 +833,7 @@ static EFI_STATUS handover_kernel(CHAR8 *bootimage, EFI_HANDLE parent_image)
 #ifndef USER
         log_flush_to_var(FALSE);
 #endif
+        log_store_flush();
 
         boot_params = (struct boot_params *)(UINTN)boot_addr;
         memset(boot_params, 0x0, 16384);
@@ -48,16 +48,27 @@ struct battery_status {
         BATTERY_CAPACITY BatteryCapacityLevel;
 };
 
-static EFI_STATUS get_battery_status(struct battery_status *status)
+/* Fuel gauge accesses go through slow I2C transactions on most of
+ * our boards.  The battery and charger status are sampled at most
+ * once per EM_SAMPLE_PERIOD and all the callers are served from the
+ * cached sample. */
+#define EM_SAMPLE_PERIOD        (2 * 1000 * 1000 * 10) /* 100ns unit, 2 seconds */
+
+static struct {
+        BOOLEAN initialized;
+        EFI_EVENT timer;
+        EFI_STATUS battery_ret;
+        struct battery_status battery;
+        EFI_STATUS charger_ret;
+        CHARGER_TYPE charger;
+        EFI_TIME timestamp;
+} sampler;
+
+static EFI_STATUS get_battery_status(CHARGING_APPLET_PROTOCOL *charging_protocol,
+                                     struct battery_status *status)
 {
-        CHARGING_APPLET_PROTOCOL *charging_protocol;
         EFI_STATUS ret;
 
-        ret = LibLocateProtocol(&gChargingAppletProtocolGuid,
-                                (VOID **)&charging_protocol);
-        if (EFI_ERROR(ret))
-                goto error;
-
         ret = uefi_call_wrapper(charging_protocol->GetBatteryInfo, 7,
                                 charging_protocol,
                                 &status->BatteryInfo,
@@ -67,46 +78,134 @@ static EFI_STATUS get_battery_status(struct battery_status *status)
                                 &status->BatteryVoltageLevel,
                                 &status->BatteryCapacityLevel);
         if (EFI_ERROR(ret))
-                goto error;
+                efi_perror(ret, L"Failed to get the battery status");
 
         return ret;
+}
+
+static EFI_STATUS get_charger_type(CHARGING_APPLET_PROTOCOL *charging_protocol,
+                                   CHARGER_TYPE *type)
+{
+        EFI_STATUS ret;
+
+        ret = uefi_call_wrapper(charging_protocol->GetChargerType, 2,
+                                charging_protocol, type);
+        if (EFI_ERROR(ret))
+                efi_perror(ret, L"Failed to get charger status");
 
-error:
-        efi_perror(ret, L"Failed to get the battery status");
         return ret;
 }
 
-BOOLEAN is_charger_plugged_in(void)
+static BOOLEAN sample_is_stale(void)
+{
+        EFI_STATUS ret;
+
+        if (!sampler.initialized)
+                return TRUE;
+
+        /* Without timer, fall back to sampling on each request */
+        if (!sampler.timer)
+                return TRUE;
+
+        ret = uefi_call_wrapper(BS->CheckEvent, 1, sampler.timer);
+        return ret == EFI_SUCCESS;
+}
+
+static void sampler_arm_timer(void)
+{
+        EFI_STATUS ret;
+
+        if (!sampler.timer) {
+                ret = uefi_call_wrapper(BS->CreateEvent, 5, EVT_TIMER,
+                                        0, NULL, NULL, &sampler.timer);
+                if (EFI_ERROR(ret)) {
+                        efi_perror(ret, L"Failed to create the battery sampler timer");
+                        sampler.timer = NULL;
+                        return;
+                }
+        }
+
+        ret = uefi_call_wrapper(BS->SetTimer, 3, sampler.timer,
+                                TimerRelative, EM_SAMPLE_PERIOD);
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Failed to arm the battery sampler timer");
+                uefi_call_wrapper(BS->CloseEvent, 1, sampler.timer);
+                sampler.timer = NULL;
+        }
+}
+
+static void sampler_refresh(BOOLEAN force)
 {
         CHARGING_APPLET_PROTOCOL *charging_protocol;
-        CHARGER_TYPE type;
         EFI_STATUS ret;
 
+        if (!force && !sample_is_stale())
+                return;
+
         ret = LibLocateProtocol(&gChargingAppletProtocolGuid,
                                 (VOID **)&charging_protocol);
-        if (EFI_ERROR(ret))
-                goto error;
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Failed to locate the charging applet protocol");
+                sampler.battery_ret = ret;
+                sampler.charger_ret = ret;
+        } else {
+                sampler.battery_ret = get_battery_status(charging_protocol,
+                                                         &sampler.battery);
+                sampler.charger_ret = get_charger_type(charging_protocol,
+                                                       &sampler.charger);
+        }
 
-        ret = uefi_call_wrapper(charging_protocol->GetChargerType, 2,
-                                charging_protocol, &type);
+        ret = uefi_call_wrapper(RT->GetTime, 2, &sampler.timestamp, NULL);
         if (EFI_ERROR(ret))
-                goto error;
+                memset(&sampler.timestamp, 0, sizeof(sampler.timestamp));
 
-        return type != ChargerUndefined;
+        sampler.initialized = TRUE;
+        sampler_arm_timer();
+}
 
-error:
-        efi_perror(ret, L"Failed to get charger status");
-        return FALSE;
+EFI_STATUS em_get_battery_sample(struct battery_sample *sample, BOOLEAN force)
+{
+        if (!sample)
+                return EFI_INVALID_PARAMETER;
+
+        sampler_refresh(force);
+
+        memset(sample, 0, sizeof(*sample));
+        sample->timestamp = sampler.timestamp;
+
+        if (!EFI_ERROR(sampler.charger_ret)) {
+                sample->charger_valid = TRUE;
+                sample->charger_plugged_in = sampler.charger != ChargerUndefined;
+        }
+
+        if (EFI_ERROR(sampler.battery_ret))
+                return sampler.battery_ret;
+
+        sample->battery_valid = TRUE;
+        sample->capacity_readable = sampler.battery.CapacityReadable;
+        sample->voltage = sampler.battery.BatteryVoltageLevel;
+        sample->capacity = sampler.battery.BatteryCapacityLevel;
+
+        return EFI_SUCCESS;
+}
+
+BOOLEAN is_charger_plugged_in(void)
+{
+        struct battery_sample sample;
+
+        em_get_battery_sample(&sample, FALSE);
+
+        return sample.charger_valid && sample.charger_plugged_in;
 }
 
 BOOLEAN is_battery_below_boot_OS_threshold(void)
 {
-        struct battery_status status;
+        struct battery_sample sample;
         EFI_STATUS ret;
         UINTN value, threshold;
         UINT8 ia_apps_to_use;
 
-        ret = get_battery_status(&status);
+        ret = em_get_battery_sample(&sample, FALSE);
         if (EFI_ERROR(ret))
                 return FALSE;
 
@@ -116,12 +215,12 @@ BOOLEAN is_battery_below_boot_OS_threshold(void)
                 return FALSE;
         }
 
-        if (status.CapacityReadable && ia_apps_to_use == OEM1_USE_IA_APPS_CAP) {
-                value = status.BatteryCapacityLevel;
+        if (sample.capacity_readable && ia_apps_to_use == OEM1_USE_IA_APPS_CAP) {
+                value = sample.capacity;
                 threshold = oem1_get_ia_apps_cap();
                 debug(L"Battery: %d%% Threshold: %d%%", value, threshold);
         } else {
-                value = status.BatteryVoltageLevel;
+                value = sample.voltage;
                 threshold = oem1_get_ia_apps_run();
                 debug(L"Battery: %dmV Threshold: %dmV", value, threshold);
                 if (value == 0) {
@@ -140,18 +239,28 @@ BOOLEAN is_battery_below_boot_OS_threshold(void)
 
 EFI_STATUS get_battery_voltage(UINTN *voltage)
 {
-        struct battery_status status;
+        struct battery_sample sample;
         EFI_STATUS ret;
 
-        ret = get_battery_status(&status);
+        ret = em_get_battery_sample(&sample, FALSE);
         if (EFI_ERROR(ret))
                 return ret;
 
-        *voltage = status.BatteryVoltageLevel;
+        *voltage = sample.voltage;
 
         return EFI_SUCCESS;
 }
 #else
+EFI_STATUS em_get_battery_sample(struct battery_sample *sample,
+                                 __attribute__((__unused__)) BOOLEAN force)
+{
+        if (!sample)
+                return EFI_INVALID_PARAMETER;
+
+        memset(sample, 0, sizeof(*sample));
+        return EFI_UNSUPPORTED;
+}
+
 BOOLEAN is_charger_plugged_in(void)
 {
         debug(L"WARNING: charging protocol disabled, assume charger is not plugged-in");
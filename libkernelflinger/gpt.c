@@ -96,6 +96,23 @@ struct mbr {
 	uint16_t sig;
 } __attribute__((__packed__));
 
+/* Partitions used on every boot.  They are resolved in a single pass
+ * over the GPT entries when the partition table is read and their
+ * partition handles are looked up together on first request.  */
+static const CHAR16 *BOOT_PARTS[] = {
+	L"boot",
+	L"boot_a",		/* A/B slots */
+	L"boot_b",
+	L"recovery",
+	L"misc",
+	BOOTLOADER_PART		/* ESP, holds the OEM keystore */
+};
+
+struct gpt_boot_part {
+	struct gpt_partition *part;
+	EFI_HANDLE handle;
+};
+
 struct gpt_disk {
 	EFI_BLOCK_IO *bio;
 	EFI_DISK_IO *dio;
@@ -104,11 +121,24 @@ struct gpt_disk {
 	logical_unit_t log_unit;
 	struct gpt_header gpt_hd;
 	struct gpt_partition *partitions;
+	BOOLEAN boot_parts_resolved;
+	struct gpt_boot_part boot_parts[ARRAY_SIZE(BOOT_PARTS)];
 };
 
 /* Allow to scan and flash only one disk at a time
- * this disk could be emmc user area or emmc gpp */
-static struct gpt_disk sdisk;
+ * this disk could be emmc user area or emmc gpp.  A cache is kept for
+ * the boot device of each storage type so that switching from one
+ * boot device to another does not require to read its GPT again.  */
+static struct gpt_disk disks[STORAGE_ALL];
+static struct gpt_disk *sdisk = &disks[STORAGE_EMMC];
+
+static void select_disk_cache(void)
+{
+	enum storage_type type;
+
+	if (!EFI_ERROR(get_boot_device_type(&type)))
+		sdisk = &disks[type];
+}
 
 static EFI_STATUS calculate_crc32(void *data, UINTN size, UINT32 *crc)
 {
@@ -223,13 +253,13 @@ static EFI_STATUS gpt_remove_prefix(void)
 	BOOLEAN not_removed = FALSE;
 	UINTN p;
 
-	if (sdisk.label_prefix_removed)
+	if (sdisk->label_prefix_removed)
 		return EFI_SUCCESS;
 
-	for (p = 0; p < sdisk.gpt_hd.number_of_entries; p++) {
+	for (p = 0; p < sdisk->gpt_hd.number_of_entries; p++) {
 		struct gpt_partition *part;
 
-		part = &sdisk.partitions[p];
+		part = &sdisk->partitions[p];
 		if (!CompareGuid(&part->type, &NullGuid))
 			continue;
 
@@ -247,7 +277,7 @@ static EFI_STATUS gpt_remove_prefix(void)
 		not_removed = TRUE;
 	}
 
-	sdisk.label_prefix_removed = TRUE;
+	sdisk->label_prefix_removed = TRUE;
 	return EFI_SUCCESS;
 error:
 	error(L"Not all the partition have the '%s' prefix", ANDROID_PREFIX);
@@ -260,13 +290,13 @@ static void gpt_put_prefix_back(void)
 	struct gpt_partition save;
 	UINTN p;
 
-	if (!sdisk.label_prefix_removed)
+	if (!sdisk->label_prefix_removed)
 		return;
 
-	for (p = 0; p < sdisk.gpt_hd.number_of_entries; p++) {
+	for (p = 0; p < sdisk->gpt_hd.number_of_entries; p++) {
 		struct gpt_partition *part;
 
-		part = &sdisk.partitions[p];
+		part = &sdisk->partitions[p];
 		if (!CompareGuid(&part->type, &NullGuid))
 			continue;
 
@@ -276,7 +306,42 @@ static void gpt_put_prefix_back(void)
 		CopyMem(part->name, ANDROID_PREFIX, prefix_len * sizeof(CHAR16));
 	}
 
-	sdisk.label_prefix_removed = FALSE;
+	sdisk->label_prefix_removed = FALSE;
+}
+
+static void resolve_boot_parts(struct gpt_disk *disk)
+{
+	struct gpt_partition *part;
+	UINTN p, i;
+
+	for (p = 0; p < disk->gpt_hd.number_of_entries; p++) {
+		part = &disk->partitions[p];
+		if (!CompareGuid(&part->type, &NullGuid))
+			continue;
+
+		for (i = 0; i < ARRAY_SIZE(BOOT_PARTS); i++)
+			if (!disk->boot_parts[i].part &&
+			    !StrCmp(part->name, BOOT_PARTS[i])) {
+				disk->boot_parts[i].part = part;
+				break;
+			}
+	}
+
+	disk->boot_parts_resolved = TRUE;
+}
+
+static struct gpt_boot_part *get_boot_part(const CHAR16 *label)
+{
+	UINTN i;
+
+	if (!sdisk->boot_parts_resolved)
+		return NULL;
+
+	for (i = 0; i < ARRAY_SIZE(BOOT_PARTS); i++)
+		if (!StrCmp(label, BOOT_PARTS[i]))
+			return &sdisk->boot_parts[i];
+
+	return NULL;
 }
 
 static EFI_STATUS gpt_list_partition_on_disk(struct gpt_disk *disk)
@@ -296,11 +361,13 @@ static EFI_STATUS gpt_list_partition_on_disk(struct gpt_disk *disk)
 		return ret;
 	}
 
+	resolve_boot_parts(disk);
+
 	return EFI_SUCCESS;
 }
 
 /* Given the logical unit, find the disk and caches
- * information into the global sdisk variable */
+ * information into the current sdisk cache */
 static EFI_STATUS gpt_cache_partition(logical_unit_t log_unit)
 {
 	EFI_STATUS ret;
@@ -310,8 +377,10 @@ static EFI_STATUS gpt_cache_partition(logical_unit_t log_unit)
 	BOOLEAN found = FALSE;
 	EFI_DEVICE_PATH *device_path;
 
+	select_disk_cache();
+
 	/* if  already cached, return */
-	if (sdisk.dio && sdisk.log_unit == log_unit)
+	if (sdisk->dio && sdisk->log_unit == log_unit)
 		return EFI_SUCCESS;
 
 	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol, &BlockIoProtocol, NULL, &nb_handle, &handles);
@@ -328,14 +397,14 @@ static EFI_STATUS gpt_cache_partition(logical_unit_t log_unit)
 		if (EFI_ERROR(ret))
 			continue;
 
-		ZeroMem(&sdisk, sizeof(sdisk));
-		ret = gpt_prepare_disk(handles[i], &sdisk);
+		ZeroMem(sdisk, sizeof(*sdisk));
+		ret = gpt_prepare_disk(handles[i], sdisk);
 		if (EFI_ERROR(ret))
 			continue;
 		debug(L"Found disk as block io %d for logical unit %d", i, log_unit);
 
-		sdisk.handle = handles[i];
-		sdisk.log_unit = log_unit;
+		sdisk->handle = handles[i];
+		sdisk->log_unit = log_unit;
 		found = TRUE;
 	}
 	if (!found) {
@@ -348,10 +417,10 @@ static EFI_STATUS gpt_cache_partition(logical_unit_t log_unit)
 	if (log_unit != LOGICAL_UNIT_USER)
 		return EFI_SUCCESS;
 
-	ret = gpt_list_partition_on_disk(&sdisk);
+	ret = gpt_list_partition_on_disk(sdisk);
 	/* ignore if there are no gpt partition on the system disk */
 	if (EFI_ERROR(ret)) {
-		ZeroMem(&sdisk.gpt_hd, sizeof(struct gpt_header));
+		ZeroMem(&sdisk->gpt_hd, sizeof(struct gpt_header));
 	}
 	ret = EFI_SUCCESS;
 
@@ -360,21 +429,30 @@ free_handles:
 	return ret;
 }
 
+static void free_disk_cache(struct gpt_disk *disk)
+{
+	if (disk->partitions)
+		FreePool(disk->partitions);
+	ZeroMem(disk, sizeof(*disk));
+}
+
 void gpt_free_cache(void)
 {
-	if (sdisk.partitions)
-		FreePool(sdisk.partitions);
-	ZeroMem(&sdisk, sizeof(sdisk));
+	UINTN i;
+
+	for (i = 0; i < ARRAY_SIZE(disks); i++)
+		free_disk_cache(&disks[i]);
 }
 
 EFI_STATUS gpt_sync(void)
 {
 	EFI_STATUS ret;
 
-	if (!sdisk.bio)
+	select_disk_cache();
+	if (!sdisk->bio)
 		return EFI_SUCCESS;
 
-	ret = uefi_call_wrapper(sdisk.bio->FlushBlocks, 1, sdisk.bio);
+	ret = uefi_call_wrapper(sdisk->bio->FlushBlocks, 1, sdisk->bio);
 	if (EFI_ERROR(ret))
 		efi_perror(ret, L"Failed to flush block io interface");
 
@@ -390,16 +468,19 @@ EFI_STATUS gpt_refresh(void)
 		return ret;
 
 	/* Nothing cached, just return */
-	if (!sdisk.bio)
+	if (!sdisk->bio)
 		return EFI_SUCCESS;
 
-	ret = uefi_call_wrapper(BS->ReinstallProtocolInterface, 4, sdisk.handle, &BlockIoProtocol, sdisk.bio, sdisk.bio);
+	/* The file systems are about to be re-installed */
+	uefi_dir_cache_flush();
+
+	ret = uefi_call_wrapper(BS->ReinstallProtocolInterface, 4, sdisk->handle, &BlockIoProtocol, sdisk->bio, sdisk->bio);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to Reinstall block io interface on System disk");
 		return ret;
 	}
 	/* invalid gpt cache to force to get new handle next time */
-	gpt_free_cache();
+	free_disk_cache(sdisk);
 
 	return EFI_SUCCESS;
 }
@@ -413,21 +494,26 @@ EFI_STATUS gpt_get_root_disk(struct gpt_partition_interface *gpart, logical_unit
 		return ret;
 
 	gpart->part.starting_lba = 0;
-	gpart->part.ending_lba = sdisk.bio->Media->LastBlock;
-	gpart->bio = sdisk.bio;
-	gpart->dio = sdisk.dio;
+	gpart->part.ending_lba = sdisk->bio->Media->LastBlock;
+	gpart->bio = sdisk->bio;
+	gpart->dio = sdisk->dio;
 
 	return EFI_SUCCESS;
 }
 
 static struct gpt_partition *gpt_find_partition(const CHAR16 *label)
 {
+	struct gpt_boot_part *boot_part;
 	UINTN p;
 
-	for (p = 0; p < sdisk.gpt_hd.number_of_entries; p++) {
+	boot_part = get_boot_part(label);
+	if (boot_part)
+		return boot_part->part;
+
+	for (p = 0; p < sdisk->gpt_hd.number_of_entries; p++) {
 		struct gpt_partition *part;
 
-		part = &sdisk.partitions[p];
+		part = &sdisk->partitions[p];
 		if (!CompareGuid(&part->type, &NullGuid) || StrCmp(part->name, label))
 			continue;
 
@@ -452,9 +538,9 @@ EFI_STATUS gpt_get_partition_by_label(const CHAR16 *label,
 	part = gpt_find_partition(label);
 	if (part) {
 		CopyMem(&gpart->part, part, sizeof(*part));
-		gpart->bio = sdisk.bio;
-		gpart->dio = sdisk.dio;
-		gpart->handle = sdisk.handle;
+		gpart->bio = sdisk->bio;
+		gpart->dio = sdisk->dio;
+		gpart->handle = sdisk->handle;
 		return EFI_SUCCESS;
 	}
 
@@ -474,24 +560,24 @@ EFI_STATUS gpt_list_partition(struct gpt_partition_interface **gpartlist, UINTN
 		return ret;
 
 	*part_count = 0;
-	if (!sdisk.gpt_hd.number_of_entries)
+	if (!sdisk->gpt_hd.number_of_entries)
 		return EFI_SUCCESS;
 
-	*gpartlist = AllocatePool(sdisk.gpt_hd.number_of_entries * sizeof(struct gpt_partition_interface));
+	*gpartlist = AllocatePool(sdisk->gpt_hd.number_of_entries * sizeof(struct gpt_partition_interface));
 	if (!*gpartlist)
 		return EFI_OUT_OF_RESOURCES;
 
-	for (p = 0; p < sdisk.gpt_hd.number_of_entries; p++) {
+	for (p = 0; p < sdisk->gpt_hd.number_of_entries; p++) {
 		struct gpt_partition *part;
 		struct gpt_partition_interface *parti;
 
-		part = &sdisk.partitions[p];
+		part = &sdisk->partitions[p];
 		if (!CompareGuid(&part->type, &NullGuid) || !part->name[0])
 			continue;
 
 		parti = &(*gpartlist)[(*part_count)];
-		parti->bio = sdisk.bio;
-		parti->dio = sdisk.dio;
+		parti->bio = sdisk->bio;
+		parti->dio = sdisk->dio;
 		CopyMem(&parti->part, part, sizeof(*part));
 		(*part_count)++;
 	}
@@ -560,7 +646,7 @@ static EFI_STATUS gpt_check_partition_list(UINTN part_count, struct gpt_bin_part
 		}
 		totsize += gbp[i].length;
 	}
-	disksize = ((sdisk.gpt_hd.last_usable_lba + 1 - sdisk.gpt_hd.first_usable_lba) * sdisk.bio->Media->BlockSize) / MiB;
+	disksize = ((sdisk->gpt_hd.last_usable_lba + 1 - sdisk->gpt_hd.first_usable_lba) * sdisk->bio->Media->BlockSize) / MiB;
 
 	if (totsize > disksize) {
 		error(L"partitions are bigger than the disk, partitions %ld MiB disk %ld MiB", totsize, disksize);
@@ -576,19 +662,19 @@ static struct gpt_partition *gpt_fill_entries(UINTN part_count, struct gpt_bin_p
 	UINT64 start_lba;
 	UINTN i;
 
-	gp = AllocateZeroPool(sdisk.gpt_hd.number_of_entries * sdisk.gpt_hd.size_of_entry);
+	gp = AllocateZeroPool(sdisk->gpt_hd.number_of_entries * sdisk->gpt_hd.size_of_entry);
 	if (!gp)
 		return NULL;
 
 	/* align on MiB boundaries ??? */
-	start_lba = sdisk.gpt_hd.first_usable_lba;
+	start_lba = sdisk->gpt_hd.first_usable_lba;
 
 	for (i = 0; i < part_count; i++) {
 		CopyMem(&gp[i].name, &gbp[i].label, sizeof(gp[i].name));
 		CopyMem(&gp[i].type, &gbp[i].type, sizeof(EFI_GUID));
 		CopyMem(&gp[i].unique, &gbp[i].uuid, sizeof(EFI_GUID));
 		gp[i].starting_lba = start_lba;
-		gp[i].ending_lba = start_lba - 1 + gbp[i].length * (MiB / sdisk.bio->Media->BlockSize);
+		gp[i].ending_lba = start_lba - 1 + gbp[i].length * (MiB / sdisk->bio->Media->BlockSize);
 		start_lba = gp[i].ending_lba + 1;
 		debug(L"partition %s, start %ld, end %ld", gp[i].name, gp[i].starting_lba, gp[i].ending_lba);
 	}
@@ -605,12 +691,12 @@ static EFI_STATUS gpt_write_mbr(void)
 	mbr.sig = 0xAA55;
 	mbr.entries[0].type = PROTECTIVE_MBR;
 	mbr.entries[0].first_lba = 1;
-	if (sdisk.bio->Media->LastBlock > 0xFFFFFFFFULL)
+	if (sdisk->bio->Media->LastBlock > 0xFFFFFFFFULL)
 		mbr.entries[0].lba_count = 0xFFFFFFFFULL;
 	else
-		mbr.entries[0].lba_count = sdisk.bio->Media->LastBlock;
+		mbr.entries[0].lba_count = sdisk->bio->Media->LastBlock;
 
-	ret = uefi_call_wrapper(sdisk.dio->WriteDisk, 5, sdisk.dio, sdisk.bio->Media->MediaId,
+	ret = uefi_call_wrapper(sdisk->dio->WriteDisk, 5, sdisk->dio, sdisk->bio->Media->MediaId,
 				440, sizeof(struct mbr), &mbr);
 	if (EFI_ERROR(ret))
 		error(L"Couldn't write MBR");
@@ -624,19 +710,19 @@ static EFI_STATUS gpt_write_table_to_disk(struct gpt_header *gh)
 	EFI_STATUS ret;
 
 	entries_size = gh->number_of_entries * gh->size_of_entry;
-	header_offset = gh->my_lba * sdisk.bio->Media->BlockSize;
-	entries_offset = gh->entries_lba * sdisk.bio->Media->BlockSize;
+	header_offset = gh->my_lba * sdisk->bio->Media->BlockSize;
+	entries_offset = gh->entries_lba * sdisk->bio->Media->BlockSize;
 
-	ret = uefi_call_wrapper(sdisk.dio->WriteDisk, 5, sdisk.dio, sdisk.bio->Media->MediaId,
+	ret = uefi_call_wrapper(sdisk->dio->WriteDisk, 5, sdisk->dio, sdisk->bio->Media->MediaId,
 				header_offset, sizeof(struct gpt_header), gh);
 	if (EFI_ERROR(ret)) {
 		error(L"Couldn't write GPT header");
 		return ret;
 	}
 
-	ret = uefi_call_wrapper(sdisk.dio->WriteDisk, 5, sdisk.dio, sdisk.bio->Media->MediaId,
+	ret = uefi_call_wrapper(sdisk->dio->WriteDisk, 5, sdisk->dio, sdisk->bio->Media->MediaId,
 				entries_offset, entries_size,
-				sdisk.partitions);
+				sdisk->partitions);
 	if (EFI_ERROR(ret))
 		error(L"Couldn't write GPT entries array");
 
@@ -653,14 +739,14 @@ static EFI_STATUS gpt_write_partition_tables(void)
 
 	gpt_put_prefix_back();
 
-	gh = &sdisk.gpt_hd;
+	gh = &sdisk->gpt_hd;
 
 	entries_size = gh->number_of_entries * gh->size_of_entry;
 	gh->my_lba = 1;
-	gh->alternate_lba = sdisk.bio->Media->LastBlock;
+	gh->alternate_lba = sdisk->bio->Media->LastBlock;
 	gh->entries_lba = 2;
 
-	ret = calculate_crc32(sdisk.partitions, entries_size, &crc);
+	ret = calculate_crc32(sdisk->partitions, entries_size, &crc);
 	if (EFI_ERROR(ret))
 		return ret;
 
@@ -687,7 +773,7 @@ static EFI_STATUS gpt_write_partition_tables(void)
 
 	gh_backup->my_lba = gh->alternate_lba;
 	gh_backup->alternate_lba = gh->my_lba;
-	gh_backup->entries_lba = gh_backup->my_lba - entries_size / sdisk.bio->Media->BlockSize;
+	gh_backup->entries_lba = gh_backup->my_lba - entries_size / sdisk->bio->Media->BlockSize;
 
 	ret = set_header_crc32(gh_backup);
 	if (EFI_ERROR(ret))
@@ -716,18 +802,18 @@ EFI_STATUS gpt_create(UINTN start_lba, UINTN part_count, struct gpt_bin_part *gb
 	if (EFI_ERROR(ret))
 		return ret;
 
-	if (sdisk.partitions) {
-		FreePool(sdisk.partitions);
-		sdisk.partitions = NULL;
+	if (sdisk->partitions) {
+		FreePool(sdisk->partitions);
+		sdisk->partitions = NULL;
 	}
-	gpt_new(&sdisk.gpt_hd, start_lba, sdisk.bio->Media->BlockSize, sdisk.bio->Media->LastBlock);
+	gpt_new(&sdisk->gpt_hd, start_lba, sdisk->bio->Media->BlockSize, sdisk->bio->Media->LastBlock);
 
 	ret = gpt_check_partition_list(part_count, gbp);
 	if (EFI_ERROR(ret))
 		return ret;
 
-	sdisk.partitions = gpt_fill_entries(part_count, gbp);
-	sdisk.label_prefix_removed = FALSE;
+	sdisk->partitions = gpt_fill_entries(part_count, gbp);
+	sdisk->label_prefix_removed = FALSE;
 
 	gpt_write_partition_tables();
 
@@ -804,9 +890,10 @@ EFI_STATUS gpt_get_partition_handle(const CHAR16 *label,
 {
 	EFI_STATUS ret;
 	struct gpt_partition_interface gpart;
+	struct gpt_boot_part *boot_part;
 	EFI_HANDLE *handles;
 	UINTN nb_handle = 0;
-	UINTN i;
+	UINTN i, j;
 	EFI_DEVICE_PATH *device_path;
 	HARDDRIVE_DEVICE_PATH *hd_path;
 
@@ -818,6 +905,12 @@ EFI_STATUS gpt_get_partition_handle(const CHAR16 *label,
 		return ret;
 	}
 
+	boot_part = sdisk->log_unit == log_unit ? get_boot_part(label) : NULL;
+	if (boot_part && boot_part->handle) {
+		*handle = boot_part->handle;
+		return EFI_SUCCESS;
+	}
+
 	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol, &BlockIoProtocol, NULL, &nb_handle, &handles);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to locate Block IO Protocol");
@@ -834,10 +927,20 @@ EFI_STATUS gpt_get_partition_handle(const CHAR16 *label,
 		hd_path = get_hd_device_path(device_path);
 		if (!hd_path)
 			continue;
-		if (hd_path->PartitionStart == gpart.part.starting_lba) {
+		if (hd_path->PartitionStart == gpart.part.starting_lba)
 			*handle = handles[i];
-			break;
+
+		/* Resolve the other boot partitions handles in the
+		 * same pass */
+		if (!boot_part) {
+			if (*handle)
+				break;
+			continue;
 		}
+		for (j = 0; j < ARRAY_SIZE(BOOT_PARTS); j++)
+			if (sdisk->boot_parts[j].part &&
+			    hd_path->PartitionStart == sdisk->boot_parts[j].part->starting_lba)
+				sdisk->boot_parts[j].handle = handles[i];
 	}
 
 	FreePool(handles);
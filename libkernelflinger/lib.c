@@ -68,6 +68,7 @@
 
 #include "lib.h"
 #include "vars.h"
+#include "log_store.h"
 
 
 EFI_HANDLE g_parent_image;
@@ -629,14 +630,60 @@ out:
 }
 
 
+/* BS->Stall() busy-loops, waiting for a timer event lets the firmware
+ * idle the CPU.  */
 VOID pause(UINTN seconds)
 {
+        EFI_STATUS ret;
+        EFI_EVENT timer;
+        UINTN index;
+
+        if (!seconds)
+                return;
+
+        ret = uefi_call_wrapper(BS->CreateEvent, 5, EVT_TIMER, 0, NULL,
+                                NULL, &timer);
+        if (EFI_ERROR(ret))
+                goto stall;
+
+        ret = uefi_call_wrapper(BS->SetTimer, 3, timer, TimerRelative,
+                                seconds * 10000000);
+        if (!EFI_ERROR(ret))
+                ret = uefi_call_wrapper(BS->WaitForEvent, 3, 1, &timer, &index);
+        uefi_call_wrapper(BS->CloseEvent, 1, timer);
+        if (!EFI_ERROR(ret))
+                return;
+
+stall:
         uefi_call_wrapper(BS->Stall, 1, seconds * 1000000);
 }
 
 
+/* Time stamp counter based clock.  The firmware does not provide any
+ * fine grained time service we can rely on: RT->GetTime() has a one
+ * second resolution on most of our platforms and the UEFI timestamp
+ * protocol is optional.  The TSC frequency is calibrated against
+ * BS->Stall() on first use.  Only meant to measure durations. */
+UINT64 get_time_us(VOID)
+{
+        static UINT64 tsc_per_us;
+        UINT64 start;
+
+        if (!tsc_per_us) {
+                start = __builtin_ia32_rdtsc();
+                uefi_call_wrapper(BS->Stall, 1, 1000);
+                tsc_per_us = (__builtin_ia32_rdtsc() - start) / 1000;
+                if (!tsc_per_us)
+                        tsc_per_us = 1;
+        }
+
+        return __builtin_ia32_rdtsc() / tsc_per_us;
+}
+
+
 VOID halt_system(VOID)
 {
+        log_store_flush();
         uefi_call_wrapper(RT->ResetSystem, 4, EfiResetShutdown, EFI_SUCCESS,
                           0, NULL);
         while (1) { }
@@ -657,27 +704,143 @@ VOID reboot(CHAR16 *target)
                 }
         }
 
+        log_store_flush();
         uefi_call_wrapper(RT->ResetSystem, 4, EfiResetCold, EFI_SUCCESS,
                           0, NULL);
         while (1) { }
 }
 
-EFI_STATUS alloc_aligned(VOID **free_addr, VOID **aligned_addr,
-                         UINTN size, UINTN align)
+/* Released I/O buffers are kept for reuse, the large transfer paths
+ * (download, sparse, erase and hash) allocate and release buffers of
+ * the same size again and again.  */
+#define IO_BUFFER_MAX   8
+
+static struct io_buffer {
+        EFI_PHYSICAL_ADDRESS base;
+        UINTN pages;
+        VOID *data;
+        UINTN size;
+        BOOLEAN used;
+} io_buffers[IO_BUFFER_MAX];
+
+static void io_buffer_free_pages(struct io_buffer *buf)
+{
+        uefi_call_wrapper(BS->FreePages, 2, buf->base, buf->pages);
+        memset(buf, 0, sizeof(*buf));
+}
+
+EFI_STATUS io_buffer_alloc(UINTN size, UINT32 align, BOOLEAN zero,
+                           VOID **buffer)
 {
-        *free_addr = AllocateZeroPool(size + align);
-        if (!*free_addr)
-                return EFI_OUT_OF_RESOURCES;
+        EFI_STATUS ret;
+        struct io_buffer *buf = NULL, *empty = NULL, *unused = NULL;
+        UINTN i;
 
-        if (align > 1)
-                *aligned_addr = (char *)*free_addr +
-                                ((UINTN)*free_addr % align);
-        else
-                *aligned_addr = *free_addr;
+        if (!size || !buffer)
+                return EFI_INVALID_PARAMETER;
 
+        if (align <= 1)
+                align = 1;
+        if (align & (align - 1))
+                return EFI_INVALID_PARAMETER;
+
+        for (i = 0; i < ARRAY_SIZE(io_buffers); i++) {
+                if (!io_buffers[i].base) {
+                        if (!empty)
+                                empty = &io_buffers[i];
+                        continue;
+                }
+                if (io_buffers[i].used)
+                        continue;
+                unused = &io_buffers[i];
+                if (io_buffers[i].size < size
+                    || (UINTN)io_buffers[i].data & (align - 1))
+                        continue;
+                if (!buf || io_buffers[i].size < buf->size)
+                        buf = &io_buffers[i];
+        }
+
+        if (!buf) {
+                if (!empty && unused) {
+                        io_buffer_free_pages(unused);
+                        empty = unused;
+                }
+                if (!empty) {
+                        error(L"Too many I/O buffers in use");
+                        return EFI_OUT_OF_RESOURCES;
+                }
+
+                buf = empty;
+                buf->pages = EFI_SIZE_TO_PAGES(size + (align > EFI_PAGE_SIZE ? align : 0));
+                ret = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages,
+                                        EfiLoaderData, buf->pages, &buf->base);
+                if (ret == EFI_OUT_OF_RESOURCES) {
+                        /* Give the idle buffers back and try again */
+                        io_buffer_release_all();
+                        ret = uefi_call_wrapper(BS->AllocatePages, 4,
+                                                AllocateAnyPages, EfiLoaderData,
+                                                buf->pages, &buf->base);
+                }
+                if (EFI_ERROR(ret)) {
+                        efi_perror(ret, L"Failed to allocate %d pages", buf->pages);
+                        memset(buf, 0, sizeof(*buf));
+                        return ret;
+                }
+
+                buf->data = (VOID *)(UINTN)((buf->base + align - 1) & ~((EFI_PHYSICAL_ADDRESS)align - 1));
+                buf->size = buf->pages * EFI_PAGE_SIZE -
+                        ((UINTN)buf->data - (UINTN)buf->base);
+        }
+
+        buf->used = TRUE;
+        if (zero)
+                memset(buf->data, 0, size);
+
+        *buffer = buf->data;
         return EFI_SUCCESS;
 }
 
+void io_buffer_free(VOID *buffer)
+{
+        UINTN i;
+
+        if (!buffer)
+                return;
+
+        for (i = 0; i < ARRAY_SIZE(io_buffers); i++)
+                if (io_buffers[i].used && io_buffers[i].data == buffer) {
+                        io_buffers[i].used = FALSE;
+                        return;
+                }
+
+        error(L"Unknown I/O buffer %p", buffer);
+}
+
+void io_buffer_release(VOID *buffer)
+{
+        UINTN i;
+
+        if (!buffer)
+                return;
+
+        for (i = 0; i < ARRAY_SIZE(io_buffers); i++)
+                if (io_buffers[i].used && io_buffers[i].data == buffer) {
+                        io_buffer_free_pages(&io_buffers[i]);
+                        return;
+                }
+
+        error(L"Unknown I/O buffer %p", buffer);
+}
+
+void io_buffer_release_all(void)
+{
+        UINTN i;
+
+        for (i = 0; i < ARRAY_SIZE(io_buffers); i++)
+                if (io_buffers[i].base && !io_buffers[i].used)
+                        io_buffer_free_pages(&io_buffers[i]);
+}
+
 /* vim: softtabstop=8:shiftwidth=8:expandtab
  */
 
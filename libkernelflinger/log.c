@@ -34,6 +34,7 @@
 #include <efilib.h>
 
 #include "log.h"
+#include "log_store.h"
 #include "lib.h"
 #include "vars.h"
 
@@ -124,9 +125,6 @@ void log(const CHAR16 *fmt, ...)
 	va_list args;
 	UINTN length;
 
-	if (!serial && EFI_ERROR(serial_init()))
-		return;
-
 	va_start(args, fmt);
 
 	length = VSPrint(buf16, sizeof(buf16), (CHAR16 *)fmt, args) + 1;
@@ -134,6 +132,11 @@ void log(const CHAR16 *fmt, ...)
 	if (EFI_ERROR(str_to_stra(buf8, buf16, length)))
 		goto exit;
 
+	log_store_append(buf8, length - 1);
+
+	if (!serial && EFI_ERROR(serial_init()))
+		goto exit;
+
 	if (EFI_ERROR(uefi_call_wrapper(serial->Write, 3, serial, &length, buf8)))
 		goto exit;
 
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2026, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "lib.h"
+#include "gpt.h"
+#include "uefi_utils.h"
+#include "log_store.h"
+
+#ifdef USE_LOG_STORE
+
+/* Log records are accumulated in the current block and the block is
+ * written as a whole when it is full or when the store is flushed.
+ * The store back end is only looked up at the first flush so that
+ * the records logged before the storage is available are kept.  */
+static struct {
+	BOOLEAN initialized;
+	BOOLEAN busy;
+	EFI_STATUS init_ret;
+	BOOLEAN use_file;
+	UINT64 start;		/* Partition start offset in bytes */
+	UINT64 nb_blocks;
+	UINT64 slot;		/* Slot of the current block */
+	UINT64 seq;
+	UINT64 boot_seq;
+	BOOLEAN dirty;
+} store;
+
+static UINT8 block[LOG_STORE_BLOCK_SIZE] __attribute__((aligned(8)));
+
+static struct log_store_block *block_header(void)
+{
+	return (struct log_store_block *)block;
+}
+
+static void block_reset(void)
+{
+	memset(block, 0, sizeof(block));
+	block_header()->used = sizeof(struct log_store_block);
+}
+
+static EFI_STATUS open_file(EFI_FILE **file)
+{
+	EFI_STATUS ret;
+	EFI_FILE_IO_INTERFACE *io;
+
+	ret = get_esp_fs(&io);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return uefi_file_open(io, LOG_STORE_FILE, EFI_FILE_MODE_READ |
+			      EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, file);
+}
+
+static EFI_STATUS store_io(BOOLEAN write, UINT64 offset, VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+	struct gpt_partition_interface gparti;
+	EFI_FILE *file;
+
+	if (!store.use_file) {
+		ret = gpt_get_partition_by_label(LOG_STORE_LABEL, &gparti,
+						 LOGICAL_UNIT_USER);
+		if (EFI_ERROR(ret))
+			return ret;
+
+		offset += store.start;
+		if (write)
+			return uefi_call_wrapper(gparti.dio->WriteDisk, 5, gparti.dio,
+						 gparti.bio->Media->MediaId,
+						 offset, size, data);
+		return uefi_call_wrapper(gparti.dio->ReadDisk, 5, gparti.dio,
+					 gparti.bio->Media->MediaId,
+					 offset, size, data);
+	}
+
+	ret = open_file(&file);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = uefi_call_wrapper(file->SetPosition, 2, file, offset);
+	if (!EFI_ERROR(ret)) {
+		if (write)
+			ret = uefi_file_write_chunk(file, data, size);
+		else
+			ret = uefi_file_read_chunk(file, data, &size);
+	}
+
+	uefi_file_close(file);
+	return ret;
+}
+
+static EFI_STATUS block_io(BOOLEAN write, UINT64 slot, VOID *data, UINTN size)
+{
+	return store_io(write, slot * LOG_STORE_BLOCK_SIZE, data, size);
+}
+
+static BOOLEAN is_valid_block(struct log_store_block *header)
+{
+	return header->magic == LOG_STORE_MAGIC &&
+		header->version == LOG_STORE_VERSION &&
+		header->header_size == sizeof(*header) &&
+		header->used >= sizeof(*header) &&
+		header->used <= LOG_STORE_BLOCK_SIZE;
+}
+
+static EFI_STATUS store_init(void)
+{
+	EFI_STATUS ret;
+	struct gpt_partition_interface gparti;
+	struct log_store_block header;
+	EFI_FILE *file;
+	UINT64 size, slot, last_seq = 0;
+	BOOLEAN found = FALSE;
+
+	ret = gpt_get_partition_by_label(LOG_STORE_LABEL, &gparti,
+					 LOGICAL_UNIT_USER);
+	if (!EFI_ERROR(ret)) {
+		store.start = gparti.part.starting_lba * gparti.bio->Media->BlockSize;
+		size = (gparti.part.ending_lba + 1 - gparti.part.starting_lba) *
+			gparti.bio->Media->BlockSize;
+	} else {
+		store.use_file = TRUE;
+		ret = open_file(&file);
+		if (EFI_ERROR(ret))
+			return ret;
+
+		ret = uefi_file_get_size(file, &size);
+		if (!EFI_ERROR(ret) && size != LOG_STORE_FILE_SIZE) {
+			size = LOG_STORE_FILE_SIZE;
+			ret = uefi_file_preallocate(file, size);
+		}
+		uefi_file_close(file);
+		if (EFI_ERROR(ret))
+			return ret;
+	}
+
+	store.nb_blocks = size / LOG_STORE_BLOCK_SIZE;
+	if (!store.nb_blocks)
+		return EFI_BUFFER_TOO_SMALL;
+
+	/* Look for the most recent block */
+	for (slot = 0; slot < store.nb_blocks; slot++) {
+		ret = block_io(FALSE, slot, &header, sizeof(header));
+		if (EFI_ERROR(ret))
+			return ret;
+
+		if (!is_valid_block(&header) || (found && header.seq <= last_seq))
+			continue;
+
+		found = TRUE;
+		last_seq = header.seq;
+		store.slot = slot;
+	}
+
+	if (found) {
+		store.slot = (store.slot + 1) % store.nb_blocks;
+		store.seq = last_seq + 1;
+	}
+	store.boot_seq = store.seq;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS store_get(void)
+{
+	if (!store.initialized) {
+		store.init_ret = store_init();
+		store.initialized = TRUE;
+	}
+	return store.init_ret;
+}
+
+EFI_STATUS log_store_flush(void)
+{
+	EFI_STATUS ret;
+	struct log_store_block *header = block_header();
+
+	if (store.busy || !store.dirty)
+		return EFI_SUCCESS;
+
+	store.busy = TRUE;
+
+	ret = store_get();
+	if (EFI_ERROR(ret))
+		goto out;
+
+	header->magic = LOG_STORE_MAGIC;
+	header->version = LOG_STORE_VERSION;
+	header->header_size = sizeof(*header);
+	header->seq = store.seq;
+	header->boot_seq = store.boot_seq;
+
+	ret = block_io(TRUE, store.slot, block, sizeof(block));
+	if (!EFI_ERROR(ret))
+		store.dirty = FALSE;
+
+out:
+	store.busy = FALSE;
+	return ret;
+}
+
+EFI_STATUS log_store_get_size(UINT64 *size)
+{
+	EFI_STATUS ret;
+
+	ret = store_get();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	*size = store.nb_blocks * LOG_STORE_BLOCK_SIZE;
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS log_store_read(UINT64 offset, VOID *data, UINTN size)
+{
+	EFI_STATUS ret;
+	UINT64 store_size;
+
+	ret = log_store_flush();
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = log_store_get_size(&store_size);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (offset > store_size || size > store_size - offset)
+		return EFI_INVALID_PARAMETER;
+
+	return store_io(FALSE, offset, data, size);
+}
+
+/* Start a new block in the next slot of the ring */
+static void next_block(void)
+{
+	if (store.dirty)
+		log_store_flush();
+
+	if (store.nb_blocks)
+		store.slot = (store.slot + 1) % store.nb_blocks;
+	store.seq++;
+	store.dirty = FALSE;
+	block_reset();
+}
+
+void log_store_append(CHAR8 *msg, UINTN length)
+{
+	struct log_store_block *header = block_header();
+	struct log_store_record *record;
+	UINTN size = sizeof(*record) + length;
+
+	if (size > LOG_STORE_BLOCK_SIZE - sizeof(*header))
+		return;
+
+	if (!header->used)
+		block_reset();
+
+	if (header->used + size > LOG_STORE_BLOCK_SIZE) {
+		/* Do not lose the records of a flush in progress */
+		if (store.busy)
+			return;
+		next_block();
+	}
+
+	record = (struct log_store_record *)(block + header->used);
+	record->size = size;
+	record->timestamp = get_time_us();
+	memcpy(record + 1, msg, length);
+	header->used += size;
+	store.dirty = TRUE;
+}
+
+#else
+
+void log_store_append(__attribute__((__unused__)) CHAR8 *msg,
+		      __attribute__((__unused__)) UINTN length)
+{
+}
+
+EFI_STATUS log_store_flush(void)
+{
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS log_store_get_size(__attribute__((__unused__)) UINT64 *size)
+{
+	return EFI_UNSUPPORTED;
+}
+
+EFI_STATUS log_store_read(__attribute__((__unused__)) UINT64 offset,
+			  __attribute__((__unused__)) VOID *data,
+			  __attribute__((__unused__)) UINTN size)
+{
+	return EFI_UNSUPPORTED;
+}
+
+#endif	/* USE_LOG_STORE */
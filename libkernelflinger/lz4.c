@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2026, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "lib.h"
+#include "lz4.h"
+
+/* Simple greedy LZ4 compressor.  Each legacy frame block holds up
+ * to LEGACY_BLOCK_SIZE bytes of input and is compressed
+ * independently.  */
+#define LEGACY_MAGIC		0x184C2102
+#define LEGACY_BLOCK_SIZE	(8 * 1024 * 1024)
+
+#define MIN_MATCH		4
+#define LAST_LITERALS		5
+#define MF_LIMIT		12
+#define MAX_DISTANCE		0xFFFF
+#define HASH_LOG		12
+
+static UINT32 read32(const UINT8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+static void write32(UINT8 *p, UINT32 value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+static UINT32 hash(UINT32 sequence)
+{
+	return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static UINTN compress_bound(UINTN size)
+{
+	return size + size / 255 + 16;
+}
+
+static UINT8 *write_length(UINT8 *op, UINTN length)
+{
+	for (; length >= 255; length -= 255)
+		*op++ = 255;
+	*op++ = length;
+	return op;
+}
+
+static UINT8 *write_literals(UINT8 *op, UINT8 *token, const UINT8 *literals,
+			     UINTN length)
+{
+	if (length >= 15) {
+		*token = 15 << 4;
+		op = write_length(op, length - 15);
+	} else
+		*token = length << 4;
+
+	memcpy(op, literals, length);
+	return op + length;
+}
+
+static UINTN compress_block(const UINT8 *src, UINTN size, UINT8 *dst,
+			    UINT32 *table)
+{
+	const UINT8 *ip = src, *anchor = src, *ref;
+	const UINT8 *end = src + size;
+	UINT8 *op = dst, *token;
+	UINT32 sequence, h;
+	UINTN length;
+
+	memset(table, 0, sizeof(*table) << HASH_LOG);
+
+	while (size >= MF_LIMIT + 1 && ip < end - MF_LIMIT) {
+		sequence = read32(ip);
+		h = hash(sequence);
+		ref = src + table[h];
+		table[h] = ip - src;
+
+		if (ref >= ip || ip - ref > MAX_DISTANCE || read32(ref) != sequence) {
+			ip++;
+			continue;
+		}
+
+		length = MIN_MATCH;
+		while (ip + length < end - LAST_LITERALS && ref[length] == ip[length])
+			length++;
+
+		token = op++;
+		op = write_literals(op, token, anchor, ip - anchor);
+
+		*op++ = (ip - ref);
+		*op++ = (ip - ref) >> 8;
+
+		if (length - MIN_MATCH >= 15) {
+			*token |= 15;
+			op = write_length(op, length - MIN_MATCH - 15);
+		} else
+			*token |= length - MIN_MATCH;
+
+		ip += length;
+		anchor = ip;
+	}
+
+	token = op++;
+	op = write_literals(op, token, anchor, end - anchor);
+
+	return op - dst;
+}
+
+EFI_STATUS lz4_compress(VOID *src, UINTN size, VOID **dst, UINTN *dst_size)
+{
+	UINT32 *table;
+	UINT8 *out, *op;
+	UINTN offset, chunk, nb_blocks, len;
+
+	nb_blocks = size ? (size + LEGACY_BLOCK_SIZE - 1) / LEGACY_BLOCK_SIZE : 1;
+	out = AllocatePool(sizeof(UINT32) + nb_blocks * sizeof(UINT32) +
+			   compress_bound(size) + nb_blocks * 16);
+	if (!out)
+		return EFI_OUT_OF_RESOURCES;
+
+	table = AllocatePool(sizeof(*table) << HASH_LOG);
+	if (!table) {
+		FreePool(out);
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	write32(out, LEGACY_MAGIC);
+	op = out + sizeof(UINT32);
+
+	for (offset = 0; offset < size; offset += chunk) {
+		chunk = min(size - offset, (UINTN)LEGACY_BLOCK_SIZE);
+		len = compress_block((UINT8 *)src + offset, chunk,
+				     op + sizeof(UINT32), table);
+		write32(op, len);
+		op += sizeof(UINT32) + len;
+	}
+
+	FreePool(table);
+	*dst = out;
+	*dst_size = op - out;
+
+	return EFI_SUCCESS;
+}
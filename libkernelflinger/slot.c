@@ -0,0 +1,376 @@
+/*
+ * Copyright (c) 2026, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "lib.h"
+#include "vars.h"
+#include "gpt.h"
+#include "slot.h"
+
+static const CHAR16 *SUFFIXES[SLOT_COUNT] = { L"_a", L"_b" };
+
+/* Slot selected by slot_boot() for this boot */
+static INTN boot_slot = -1;
+
+/* Parsed slot metadata, see slot_invalidate_metadata() */
+static struct slot_metadata cache;
+static BOOLEAN cached;
+
+static EFI_STATUS metadata_io(BOOLEAN write, struct slot_metadata *meta)
+{
+	EFI_STATUS ret;
+	struct gpt_partition_interface gpart;
+	UINT64 offset;
+
+	ret = gpt_get_partition_by_label(MISC_LABEL, &gpart, LOGICAL_UNIT_USER);
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to find the %s partition", MISC_LABEL);
+		return ret;
+	}
+
+	offset = gpart.part.starting_lba * gpart.bio->Media->BlockSize
+		+ SLOT_METADATA_OFFSET;
+	if (write)
+		ret = uefi_call_wrapper(gpart.dio->WriteDisk, 5, gpart.dio,
+					gpart.bio->Media->MediaId,
+					offset, sizeof(*meta), meta);
+	else
+		ret = uefi_call_wrapper(gpart.dio->ReadDisk, 5, gpart.dio,
+					gpart.bio->Media->MediaId,
+					offset, sizeof(*meta), meta);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to %a the slot metadata",
+			   write ? "write" : "read");
+
+	return ret;
+}
+
+static EFI_STATUS metadata_crc32(struct slot_metadata *meta, UINT32 *crc)
+{
+	EFI_STATUS ret;
+
+	ret = uefi_call_wrapper(BS->CalculateCrc32, 3, meta,
+				offsetof(struct slot_metadata, crc32), crc);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"CalculateCrc32 failed");
+
+	return ret;
+}
+
+static void metadata_init(struct slot_metadata *meta)
+{
+	UINTN i;
+
+	memset(meta, 0, sizeof(*meta));
+	meta->magic = SLOT_MAGIC;
+	meta->version = SLOT_VERSION;
+	meta->nb_slot = SLOT_COUNT;
+	meta->recovery_retry_count = SLOT_MAX_RETRY;
+	for (i = 0; i < SLOT_COUNT; i++) {
+		meta->slots[i].priority = SLOT_MAX_PRIORITY - i;
+		meta->slots[i].retry_count = SLOT_MAX_RETRY;
+	}
+}
+
+/* Read the slot metadata.  If it is missing or corrupted, META is
+ * set to the default metadata: all the slots are bootable and the
+ * first one is active.  It is written back on the next change
+ * only.  The metadata is read from the disk once and then served
+ * from the cache.  */
+static EFI_STATUS read_metadata(struct slot_metadata *meta)
+{
+	EFI_STATUS ret;
+	UINT32 crc;
+
+	if (cached) {
+		memcpy(meta, &cache, sizeof(*meta));
+		return EFI_SUCCESS;
+	}
+
+	ret = metadata_io(FALSE, meta);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (meta->magic != SLOT_MAGIC || meta->version != SLOT_VERSION ||
+	    meta->nb_slot != SLOT_COUNT)
+		goto reset;
+
+	ret = metadata_crc32(meta, &crc);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (crc == meta->crc32)
+		goto out;
+
+reset:
+	debug(L"Invalid slot metadata, using the default one");
+	metadata_init(meta);
+out:
+	memcpy(&cache, meta, sizeof(cache));
+	cached = TRUE;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS write_metadata(struct slot_metadata *meta)
+{
+	EFI_STATUS ret;
+
+	slot_invalidate_metadata();
+
+	ret = metadata_crc32(meta, &meta->crc32);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	return metadata_io(TRUE, meta);
+}
+
+void slot_invalidate_metadata(void)
+{
+	cached = FALSE;
+}
+
+static INTN suffix_to_index(const CHAR16 *suffix)
+{
+	UINTN i;
+
+	if (!suffix)
+		return -1;
+
+	/* Accept "a" as well as "_a" */
+	if (suffix[0] == L'_')
+		suffix++;
+
+	for (i = 0; i < SLOT_COUNT; i++)
+		if (suffix[0] == SUFFIXES[i][1] && suffix[1] == L'\0')
+			return i;
+
+	return -1;
+}
+
+static BOOLEAN is_bootable(struct slot_info *slot)
+{
+	return slot->priority > 0 && (slot->successful || slot->retry_count > 0);
+}
+
+/* Return the bootable slot with the highest priority, -1 if none */
+static INTN get_active_index(struct slot_metadata *meta)
+{
+	INTN active = -1;
+	UINTN i;
+
+	for (i = 0; i < SLOT_COUNT; i++) {
+		if (!is_bootable(&meta->slots[i]))
+			continue;
+		if (active == -1 ||
+		    meta->slots[i].priority > meta->slots[active].priority)
+			active = i;
+	}
+
+	return active;
+}
+
+static BOOLEAN partition_exists(const CHAR16 *label)
+{
+	struct gpt_partition_interface gpart;
+
+	return !EFI_ERROR(gpt_get_partition_by_label(label, &gpart,
+						     LOGICAL_UNIT_USER));
+}
+
+static const CHAR16 *suffixed_label(const CHAR16 *base, const CHAR16 *suffix)
+{
+	static CHAR16 label[ARRAY_SIZE(((struct gpt_partition *)0)->name)];
+
+	if (StrLen(base) + StrLen(suffix) >= ARRAY_SIZE(label))
+		return NULL;
+
+	StrCpy(label, base);
+	StrCat(label, suffix);
+	return label;
+}
+
+BOOLEAN use_slot(void)
+{
+	const CHAR16 *label;
+
+	label = suffixed_label(BOOT_LABEL, SUFFIXES[0]);
+	return label && partition_exists(label);
+}
+
+const CHAR16 *slot_get_active(void)
+{
+	struct slot_metadata meta;
+	INTN active;
+
+	if (!use_slot())
+		return NULL;
+
+	if (boot_slot != -1)
+		return SUFFIXES[boot_slot];
+
+	if (EFI_ERROR(read_metadata(&meta)))
+		return NULL;
+
+	active = get_active_index(&meta);
+	return active == -1 ? NULL : SUFFIXES[active];
+}
+
+const CHAR16 **slot_get_suffixes(void)
+{
+	return SUFFIXES;
+}
+
+const CHAR16 *slot_label(const CHAR16 *base)
+{
+	const CHAR16 *suffix, *label;
+
+	if (partition_exists(base))
+		return base;
+
+	suffix = slot_get_active();
+	if (!suffix)
+		return base;
+
+	label = suffixed_label(base, suffix);
+	if (!label || !partition_exists(label))
+		return base;
+
+	return label;
+}
+
+EFI_STATUS slot_set_active(const CHAR16 *suffix)
+{
+	EFI_STATUS ret;
+	struct slot_metadata meta;
+	INTN index;
+	UINTN i;
+
+	index = suffix_to_index(suffix);
+	if (index == -1) {
+		error(L"Invalid slot '%s'", suffix);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if (!use_slot())
+		return EFI_UNSUPPORTED;
+
+	ret = read_metadata(&meta);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	for (i = 0; i < SLOT_COUNT; i++)
+		if ((INTN)i != index &&
+		    meta.slots[i].priority == SLOT_MAX_PRIORITY)
+			meta.slots[i].priority = SLOT_MAX_PRIORITY - 1;
+
+	meta.slots[index].priority = SLOT_MAX_PRIORITY;
+	meta.slots[index].retry_count = SLOT_MAX_RETRY;
+	meta.slots[index].successful = 0;
+	str_to_stra(meta.suffix, (CHAR16 *)SUFFIXES[index], sizeof(meta.suffix));
+	boot_slot = -1;
+
+	return write_metadata(&meta);
+}
+
+EFI_STATUS slot_boot(enum boot_target target)
+{
+	EFI_STATUS ret;
+	struct slot_metadata meta, orig;
+	INTN active;
+
+	if (!use_slot())
+		return EFI_SUCCESS;
+
+	ret = read_metadata(&meta);
+	if (EFI_ERROR(ret))
+		return ret;
+	memcpy(&orig, &meta, sizeof(orig));
+
+	active = get_active_index(&meta);
+	if (active == -1) {
+		error(L"No bootable slot");
+		return EFI_NOT_FOUND;
+	}
+
+	/* Only the OS can tell if a boot succeeded: recovery and
+	 * charger boots do not consume retries */
+	if (target == NORMAL_BOOT && !meta.slots[active].successful)
+		meta.slots[active].retry_count--;
+	str_to_stra(meta.suffix, (CHAR16 *)SUFFIXES[active], sizeof(meta.suffix));
+	boot_slot = active;
+	debug(L"Booting slot %s, %d retries left", SUFFIXES[active],
+	      meta.slots[active].retry_count);
+
+	if (!memcmp(&meta, &orig, sizeof(meta)))
+		return EFI_SUCCESS;
+
+	return write_metadata(&meta);
+}
+
+static struct slot_info *get_slot_info(const CHAR16 *suffix,
+				       struct slot_metadata *meta)
+{
+	INTN index;
+
+	index = suffix_to_index(suffix);
+	if (index == -1 || !use_slot() || EFI_ERROR(read_metadata(meta)))
+		return NULL;
+
+	return &meta->slots[index];
+}
+
+BOOLEAN slot_is_successful(const CHAR16 *suffix)
+{
+	struct slot_metadata meta;
+	struct slot_info *slot;
+
+	slot = get_slot_info(suffix, &meta);
+	return slot && slot->successful;
+}
+
+BOOLEAN slot_is_bootable(const CHAR16 *suffix)
+{
+	struct slot_metadata meta;
+	struct slot_info *slot;
+
+	slot = get_slot_info(suffix, &meta);
+	return slot && is_bootable(slot);
+}
+
+UINTN slot_retry_count(const CHAR16 *suffix)
+{
+	struct slot_metadata meta;
+	struct slot_info *slot;
+
+	slot = get_slot_info(suffix, &meta);
+	return slot ? slot->retry_count : 0;
+}
@@ -41,26 +41,54 @@ char *SMBIOS_UNDEFINED = "N/A";
 /* Allow cast to pointer from integer of different size.  */
 #pragma GCC diagnostic ignored "-Wint-to-pointer-cast"
 
-char *smbios_get_string(UINT8 type, UINT8 offset)
+#define SMBIOS_END_OF_TABLE	127
+
+/* The structures of the types defined in smbios.h, located by a
+ * single pass over the SMBIOS table on first use.  */
+static SMBIOS_STRUCTURE_POINTER structures[TYPE_CHASSIS + 1];
+static BOOLEAN scanned;
+
+static void smbios_scan(void)
 {
 	SMBIOS_STRUCTURE_TABLE *table;
 	EFI_STATUS ret;
 	SMBIOS_STRUCTURE_POINTER sm_struct;
-	UINT8 i;
-	CHAR8 *str;
+	UINT8 *end;
+	UINT16 i;
+	UINT8 type;
+
+	scanned = TRUE;
 
 	ret = LibGetSystemConfigurationTable(&SMBIOSTableGuid, (VOID**)&table);
 	if (EFI_ERROR(ret))
-		return SMBIOS_UNDEFINED;
+		return;
 
 	sm_struct.Hdr = (SMBIOS_HEADER *)table->TableAddress;
-	for (i = 0; i < table->TableLength; i++) {
-		if (sm_struct.Hdr->Type == type)
+	end = sm_struct.Raw + table->TableLength;
+	for (i = 0; i < table->NumberOfSmbiosStructures && sm_struct.Raw < end; i++) {
+		type = sm_struct.Hdr->Type;
+		if (type == SMBIOS_END_OF_TABLE)
 			break;
+		if (type <= TYPE_CHASSIS && !structures[type].Raw)
+			structures[type] = sm_struct;
 		LibGetSmbiosString(&sm_struct, -1);
 	}
+}
+
+char *smbios_get_string(UINT8 type, UINT8 offset)
+{
+	SMBIOS_STRUCTURE_POINTER sm_struct;
+	CHAR8 *str;
+
+	if (!scanned)
+		smbios_scan();
+
+	if (type > TYPE_CHASSIS || !structures[type].Raw)
+		return SMBIOS_UNDEFINED;
 
-	if (i == table->TableLength)
+	sm_struct = structures[type];
+	/* Field not defined by this SMBIOS version */
+	if (offset >= sm_struct.Hdr->Length)
 		return SMBIOS_UNDEFINED;
 
 	str = LibGetSmbiosString(&sm_struct, sm_struct.Raw[offset]);
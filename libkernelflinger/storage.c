@@ -32,24 +32,57 @@
 #include <efilib.h>
 #include <log.h>
 #include <lib.h>
+#include <vars.h>
 #include "storage.h"
 #include "pci.h"
-
-static struct storage *storage;
-static PCI_DEVICE_PATH boot_device;
+#include "protocol.h"
+
+/* The automatically selected boot device is saved in this variable.
+ * On the next boot, it is revalidated against the single block
+ * device it describes and the block devices are only scanned if it
+ * does not match anymore.  */
+#define BOOT_STORAGE_VAR	L"BootStorage"
+#define BOOT_STORAGE_VERSION	1
+
+struct boot_storage_record {
+	UINT8 version;
+	UINT8 type;
+	UINT8 pci_function;
+	UINT8 pci_device;
+	/* Device path of the block device, up to the end node */
+	UINT8 device_path[0];
+} __attribute__((packed));
+
+/* Boot device identified for each storage type, STORAGE_ALL being
+ * the automatic selection.  All of them are identified by a single
+ * scan of the block devices so that switching from one boot device to
+ * another is only a matter of selecting the corresponding entry.  */
+struct boot_device {
+	EFI_STATUS status;	/* EFI_NOT_FOUND, EFI_UNSUPPORTED if
+				   ambiguous or EFI_SUCCESS */
+	enum storage_type type;
+	struct storage *storage;
+	PCI_DEVICE_PATH pci;
+	EFI_HANDLE handle;	/* First matching block device */
+};
+
+static struct boot_device devices[STORAGE_ALL + 1];
+static struct boot_device *current;
+static BOOLEAN scanned = FALSE;
+static BOOLEAN revalidated = FALSE;
 static BOOLEAN initialized = FALSE;
 
 static BOOLEAN is_boot_device(EFI_DEVICE_PATH *p)
 {
 	PCI_DEVICE_PATH *pci;
 
-	if (boot_device.Header.Type == 0)
+	if (!current)
 		return FALSE;
 
 	pci = get_pci_device_path(p);
 
-	return pci && pci->Function == boot_device.Function
-		&& pci->Device == boot_device.Device;
+	return pci && pci->Function == current->pci.Function
+		&& pci->Device == current->pci.Device;
 }
 
 extern struct storage STORAGE(STORAGE_EMMC);
@@ -57,22 +90,22 @@ extern struct storage STORAGE(STORAGE_UFS);
 extern struct storage STORAGE(STORAGE_SDCARD);
 extern struct storage STORAGE(STORAGE_SATA);
 
+static struct storage *supported_storage[STORAGE_ALL] =  {
+	&STORAGE(STORAGE_EMMC),
+	&STORAGE(STORAGE_UFS),
+	&STORAGE(STORAGE_SDCARD),
+	&STORAGE(STORAGE_SATA)
+};
+
 static EFI_STATUS identify_storage(EFI_DEVICE_PATH *device_path,
-				   enum storage_type filter)
+				   enum storage_type *type)
 {
 	enum storage_type st;
-	static struct storage *supported_storage[STORAGE_ALL] =  {
-		&STORAGE(STORAGE_EMMC),
-		&STORAGE(STORAGE_UFS),
-		&STORAGE(STORAGE_SDCARD),
-		&STORAGE(STORAGE_SATA)
-	};
 
 	for (st = STORAGE_EMMC; st < STORAGE_ALL; st++) {
-		if ((filter == st || filter == STORAGE_ALL) &&
-		    supported_storage[st] && supported_storage[st]->probe(device_path)) {
+		if (supported_storage[st] && supported_storage[st]->probe(device_path)) {
 			debug(L"%s storage identified", supported_storage[st]->name);
-			storage = supported_storage[st];
+			*type = st;
 			return EFI_SUCCESS;
 		}
 	}
@@ -80,14 +113,33 @@ static EFI_STATUS identify_storage(EFI_DEVICE_PATH *device_path,
 	return EFI_UNSUPPORTED;
 }
 
-EFI_STATUS identify_boot_device(enum storage_type type)
+static void add_device(struct boot_device *device, EFI_HANDLE handle,
+		       PCI_DEVICE_PATH *pci, enum storage_type type)
+{
+	if (device->status == EFI_NOT_FOUND) {
+		device->status = EFI_SUCCESS;
+		device->type = type;
+		device->storage = supported_storage[type];
+		device->handle = handle;
+		memcpy(&device->pci, pci, sizeof(device->pci));
+		return;
+	}
+
+	if (pci->Function != device->pci.Function
+	    || pci->Device != device->pci.Device)
+		device->status = EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS scan_boot_devices(void)
 {
 	EFI_STATUS ret;
 	EFI_HANDLE *handles;
 	UINTN nb_handle = 0;
 	UINTN i;
 	EFI_DEVICE_PATH *device_path;
-	PCI_DEVICE_PATH *pci = NULL;
+	PCI_DEVICE_PATH *pci;
+	enum storage_type type;
+	BOOLEAN found;
 
 	ret = uefi_call_wrapper(BS->LocateHandleBuffer, 5, ByProtocol,
 				&BlockIoProtocol, NULL, &nb_handle, &handles);
@@ -96,43 +148,194 @@ EFI_STATUS identify_boot_device(enum storage_type type)
 		return ret;
 	}
 
-	boot_device.Header.Type = 0;
+	for (type = STORAGE_EMMC; type <= STORAGE_ALL; type++)
+		devices[type].status = EFI_NOT_FOUND;
+
 	for (i = 0; i < nb_handle; i++) {
 		device_path = DevicePathFromHandle(handles[i]);
 		pci = get_pci_device_path(device_path);
-
-		if (!pci || EFI_ERROR(identify_storage(device_path, type)))
-			continue;
-		if (!boot_device.Header.Type) {
-			memcpy(&boot_device, pci, sizeof(boot_device));
+		if (!pci)
 			continue;
-		}
-		if (pci->Function != boot_device.Function
-		    || pci->Device != boot_device.Device) {
-			error(L"Multiple PCI storage found! Can't make a decision");
-			storage = NULL;
-			boot_device.Header.Type = 0;
-			FreePool(handles);
-			return EFI_UNSUPPORTED;
+
+		/* The automatic selection takes the first matching type */
+		found = FALSE;
+		for (type = STORAGE_EMMC; type < STORAGE_ALL; type++) {
+			if (!supported_storage[type] ||
+			    !supported_storage[type]->probe(device_path))
+				continue;
+			debug(L"%s storage identified", supported_storage[type]->name);
+			add_device(&devices[type], handles[i], pci, type);
+			if (!found)
+				add_device(&devices[STORAGE_ALL], handles[i],
+					   pci, type);
+			found = TRUE;
 		}
 	}
 
 	FreePool(handles);
+	scanned = TRUE;
 
-	if (!pci) {
+	return EFI_SUCCESS;
+}
+
+static UINTN device_path_size(EFI_DEVICE_PATH *p, UINTN max_size)
+{
+	UINTN size = 0, len;
+
+	for (;;) {
+		if (max_size - size < sizeof(*p))
+			return 0;
+		len = DevicePathNodeLength(p);
+		if (len < sizeof(*p) || len > max_size - size)
+			return 0;
+		size += len;
+		if (IsDevicePathEnd(p))
+			return size;
+		p = NextDevicePathNode(p);
+	}
+}
+
+static EFI_STATUS load_boot_storage(struct boot_device *device)
+{
+	EFI_STATUS ret;
+	struct boot_storage_record *record;
+	EFI_DEVICE_PATH *path, *device_path;
+	EFI_HANDLE handle;
+	PCI_DEVICE_PATH *pci;
+	UINTN size;
+
+	ret = get_efi_variable(&fastboot_guid, BOOT_STORAGE_VAR, &size,
+			       (VOID **)&record, NULL);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	ret = EFI_NOT_FOUND;
+	if (size <= sizeof(*record) || record->version != BOOT_STORAGE_VERSION
+	    || record->type >= STORAGE_ALL || !supported_storage[record->type]
+	    || device_path_size((EFI_DEVICE_PATH *)record->device_path,
+				size - sizeof(*record)) != size - sizeof(*record))
+		goto out;
+
+	path = (EFI_DEVICE_PATH *)record->device_path;
+	ret = locate_device_path(&BlockIoProtocol, &path, &handle);
+	if (EFI_ERROR(ret) || !IsDevicePathEnd(path)) {
+		ret = EFI_NOT_FOUND;
+		goto out;
+	}
+
+	ret = EFI_NOT_FOUND;
+	device_path = DevicePathFromHandle(handle);
+	if (!device_path)
+		goto out;
+
+	pci = get_pci_device_path(device_path);
+	if (!pci || pci->Function != record->pci_function
+	    || pci->Device != record->pci_device
+	    || !supported_storage[record->type]->probe(device_path))
+		goto out;
+
+	debug(L"%s storage revalidated", supported_storage[record->type]->name);
+	device->status = EFI_NOT_FOUND;
+	add_device(device, handle, pci, record->type);
+	ret = EFI_SUCCESS;
+
+out:
+	FreePool(record);
+	return ret;
+}
+
+static void save_boot_storage(struct boot_device *device)
+{
+	EFI_STATUS ret;
+	struct boot_storage_record *record, *cur;
+	EFI_DEVICE_PATH *device_path;
+	UINTN size, cur_size, path_size;
+
+	device_path = DevicePathFromHandle(device->handle);
+	if (!device_path)
+		return;
+
+	path_size = DevicePathSize(device_path);
+	size = sizeof(*record) + path_size;
+	record = AllocatePool(size);
+	if (!record)
+		return;
+
+	record->version = BOOT_STORAGE_VERSION;
+	record->type = device->type;
+	record->pci_function = device->pci.Function;
+	record->pci_device = device->pci.Device;
+	memcpy(record->device_path, device_path, path_size);
+
+	ret = get_efi_variable(&fastboot_guid, BOOT_STORAGE_VAR, &cur_size,
+			       (VOID **)&cur, NULL);
+	if (!EFI_ERROR(ret)) {
+		if (cur_size == size && !memcmp(cur, record, size)) {
+			FreePool(cur);
+			goto out;
+		}
+		FreePool(cur);
+	}
+
+	ret = set_efi_variable(&fastboot_guid, BOOT_STORAGE_VAR, size,
+			       record, TRUE, FALSE);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to save the boot storage");
+
+out:
+	FreePool(record);
+}
+
+EFI_STATUS identify_boot_device(enum storage_type type)
+{
+	EFI_STATUS ret;
+	struct boot_device *device = &devices[type];
+	BOOLEAN saved;
+
+	if (!scanned && type == STORAGE_ALL && !revalidated)
+		revalidated = !EFI_ERROR(load_boot_storage(device));
+	saved = type == STORAGE_ALL && revalidated;
+
+	/* A device not found might have been plugged since the
+	 * previous scan */
+	if ((!scanned && !saved) || device->status == EFI_NOT_FOUND) {
+		ret = scan_boot_devices();
+		if (EFI_ERROR(ret))
+			return ret;
+		if (type == STORAGE_ALL && device->status == EFI_SUCCESS)
+			save_boot_storage(device);
+	}
+
+	initialized = TRUE;
+	current = NULL;
+
+	if (device->status == EFI_NOT_FOUND) {
 		error(L"No PCI storage found");
 		return EFI_UNSUPPORTED;
 	}
+	if (device->status == EFI_UNSUPPORTED) {
+		error(L"Multiple PCI storage found! Can't make a decision");
+		return EFI_UNSUPPORTED;
+	}
+
+	current = device;
 	return EFI_SUCCESS;
 }
 
 static BOOLEAN valid_storage(void)
 {
-	if (!initialized) {
-		initialized = TRUE;
+	if (!initialized)
 		return !EFI_ERROR(identify_boot_device(STORAGE_ALL));
-	}
-	return boot_device.Header.Type && storage;
+	return current && current->storage;
+}
+
+EFI_STATUS get_boot_device_type(enum storage_type *type)
+{
+	if (!valid_storage())
+		return EFI_UNSUPPORTED;
+
+	*type = current->type;
+	return EFI_SUCCESS;
 }
 
 EFI_STATUS storage_check_logical_unit(EFI_DEVICE_PATH *p, logical_unit_t log_unit)
@@ -142,7 +345,7 @@ EFI_STATUS storage_check_logical_unit(EFI_DEVICE_PATH *p, logical_unit_t log_uni
 	if (!is_boot_device(p))
 		return EFI_UNSUPPORTED;
 
-	return storage->check_logical_unit(p, log_unit);
+	return current->storage->check_logical_unit(p, log_unit);
 }
 
 EFI_STATUS storage_erase_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, UINT64 start, UINT64 end)
@@ -151,7 +354,7 @@ EFI_STATUS storage_erase_blocks(EFI_HANDLE handle, EFI_BLOCK_IO *bio, UINT64 sta
 		return EFI_UNSUPPORTED;
 
 	debug(L"Erase lba %ld -> %ld", start, end);
-	return storage->erase_blocks(handle, bio, start, end);
+	return current->storage->erase_blocks(handle, bio, start, end);
 }
 
 EFI_STATUS fill_with(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end,
@@ -180,21 +383,85 @@ EFI_STATUS fill_with(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end,
 	return ret;
 }
 
+#ifdef ZERO_FILL_VERIFY
+static BOOLEAN is_zero(VOID *data, UINTN size)
+{
+	UINT64 *p = data;
+	UINTN i;
+
+	for (i = 0; i < size / sizeof(*p); i++)
+		if (p[i])
+			return FALSE;
+
+	return TRUE;
+}
+
+/* Read the range by windows of BUFFER_BLOCKS blocks and only write
+ * the windows which are not already zero.  Reads are much faster than
+ * writes on most eMMC parts.  */
+static EFI_STATUS fill_zero_verify(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end,
+				   VOID *buffer, UINTN buffer_blocks,
+				   UINT64 *skipped)
+{
+	UINT64 lba, size;
+	EFI_STATUS ret;
+
+	debug(L"Zero fill with verify lba %ld -> %ld", start, end);
+	for (lba = start; lba <= end; lba += buffer_blocks) {
+		size = min(end - lba + 1, (UINT64)buffer_blocks) *
+			bio->Media->BlockSize;
+
+		ret = uefi_call_wrapper(bio->ReadBlocks, 5, bio,
+					bio->Media->MediaId, lba, size, buffer);
+		if (!EFI_ERROR(ret) && is_zero(buffer, size)) {
+			*skipped += size;
+			continue;
+		}
+
+		memset(buffer, 0, size);
+		ret = uefi_call_wrapper(bio->WriteBlocks, 5, bio,
+					bio->Media->MediaId, lba, size, buffer);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to erase block %ld", lba);
+			return ret;
+		}
+	}
+
+	return EFI_SUCCESS;
+}
+#endif
+
+/* Write zeros from START to END lba using the zeroed BUFFER of
+ * BUFFER_BLOCKS blocks.  The buffer is still zeroed on return.  The
+ * number of bytes which were already zero and have not been written
+ * is added to *SKIPPED.  */
+EFI_STATUS fill_zero_with(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end,
+			  VOID *buffer, UINTN buffer_blocks, UINT64 *skipped)
+{
+#ifdef ZERO_FILL_VERIFY
+	return fill_zero_verify(bio, start, end, buffer, buffer_blocks, skipped);
+#else
+	(void)skipped;
+	return fill_with(bio, start, end, buffer, buffer_blocks);
+#endif
+}
+
 EFI_STATUS fill_zero(EFI_BLOCK_IO *bio, UINT64 start, UINT64 end)
 {
 	EFI_STATUS ret;
 	VOID *emptyblock;
-	VOID *aligned_emptyblock;
+	UINT64 skipped = 0;
 
-	ret = alloc_aligned(&emptyblock, &aligned_emptyblock,
-			    bio->Media->BlockSize * N_BLOCK,
-			    bio->Media->IoAlign);
+	ret = io_buffer_alloc(bio->Media->BlockSize * N_BLOCK,
+			      bio->Media->IoAlign, TRUE, &emptyblock);
 	if (EFI_ERROR(ret))
 		return ret;
 
-	ret = fill_with(bio, start, end, aligned_emptyblock, N_BLOCK);
+	ret = fill_zero_with(bio, start, end, emptyblock, N_BLOCK, &skipped);
+	if (skipped)
+		debug(L"Zero fill skipped %ld bytes already zero", skipped);
 
-	FreePool(emptyblock);
+	io_buffer_free(emptyblock);
 
 	return ret;
 }
@@ -205,6 +472,7 @@ EFI_STATUS storage_set_boot_device(EFI_HANDLE device)
 	PCI_DEVICE_PATH *pci;
 	EFI_STATUS ret;
 	CHAR16 *dps;
+	enum storage_type type;
 
 	if (!device_path) {
 		error(L"Failed to get device path from boot handle");
@@ -217,7 +485,7 @@ EFI_STATUS storage_set_boot_device(EFI_HANDLE device)
 		return EFI_UNSUPPORTED;
 	}
 
-	ret = identify_storage(device_path, STORAGE_ALL);
+	ret = identify_storage(device_path, &type);
 	if (EFI_ERROR(ret)) {
 		error(L"Boot device unsupported");
 		return ret;
@@ -227,7 +495,9 @@ EFI_STATUS storage_set_boot_device(EFI_HANDLE device)
 	FreePool(dps);
 
 	initialized = TRUE;
-	memcpy(&boot_device, pci, sizeof(boot_device));
+	devices[type].status = EFI_NOT_FOUND;
+	add_device(&devices[type], device, pci, type);
+	current = &devices[type];
 	return EFI_SUCCESS;
 }
 
@@ -240,5 +510,5 @@ PCI_DEVICE_PATH *get_boot_device(void)
 		if (EFI_ERROR(ret))
 			efi_perror(ret, L"Failed to get boot device");
 	}
-	return boot_device.Header.Type == 0 ? NULL : &boot_device;
+	return current ? &current->pci : NULL;
 }
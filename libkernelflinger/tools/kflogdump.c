@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2026, Intel Corporation
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <errno.h>
+
+/* Decode the kernelflinger persistent log store.  The input is either
+ * a dump of the "logs" partition or the ESP log file.  This layout
+ * must be kept in sync with include/libkernelflinger/log_store.h.  */
+
+#define LOG_STORE_MAGIC		0x474f4c4b
+#define LOG_STORE_VERSION	1
+#define LOG_STORE_BLOCK_SIZE	(64 * 1024)
+
+struct log_store_block {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size;
+	uint64_t seq;
+	uint64_t boot_seq;
+	uint32_t used;
+	uint32_t reserved;
+} __attribute__((packed));
+
+struct log_store_record {
+	uint16_t size;
+	uint16_t reserved;
+	uint32_t reserved2;
+	uint64_t timestamp;
+} __attribute__((packed));
+
+static char *program_name;
+
+static void usage(int status)
+{
+	printf("Usage: %s [-b] FILE\n", basename((char *)program_name));
+	printf("\
+Print the records of a kernelflinger log store, oldest first.\n\
+  -b, --last-boot               only print the records of the last boot\n\
+  -h, --help                    display this help\n\
+");
+	exit(status);
+}
+
+static void error(const char *s)
+{
+	perror(s);
+	exit(EXIT_FAILURE);
+}
+
+static int is_valid_block(struct log_store_block *header)
+{
+	return header->magic == LOG_STORE_MAGIC &&
+		header->version == LOG_STORE_VERSION &&
+		header->header_size == sizeof(*header) &&
+		header->used >= sizeof(*header) &&
+		header->used <= LOG_STORE_BLOCK_SIZE;
+}
+
+static int cmp_blocks(const void *a, const void *b)
+{
+	const struct log_store_block *ha = *(struct log_store_block **)a;
+	const struct log_store_block *hb = *(struct log_store_block **)b;
+
+	if (ha->seq == hb->seq)
+		return 0;
+	return ha->seq < hb->seq ? -1 : 1;
+}
+
+static void print_block(struct log_store_block *header)
+{
+	struct log_store_record *record;
+	unsigned char *cur = (unsigned char *)header + sizeof(*header);
+	unsigned char *end = (unsigned char *)header + header->used;
+	int length;
+
+	while (cur + sizeof(*record) <= end) {
+		record = (struct log_store_record *)cur;
+		if (record->size < sizeof(*record) || cur + record->size > end) {
+			fprintf(stderr, "Corrupted record in block %llu\n",
+				(unsigned long long)header->seq);
+			return;
+		}
+
+		length = record->size - sizeof(*record);
+		while (length && ((char *)(record + 1))[length - 1] == '\n')
+			length--;
+		printf("[%5llu.%06llu] %.*s\n",
+		       (unsigned long long)(record->timestamp / 1000000),
+		       (unsigned long long)(record->timestamp % 1000000),
+		       length, (char *)(record + 1));
+		cur += record->size;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"last-boot", no_argument, 0, 'b'},
+		{"help", no_argument, 0, 'h'},
+		{0, 0, 0, 0}
+	};
+	struct log_store_block **blocks = NULL, *header;
+	unsigned char *data;
+	size_t nb_blocks = 0, i;
+	int last_boot = 0, c;
+	uint64_t boot_seq = (uint64_t)-1;
+	FILE *f;
+
+	program_name = argv[0];
+
+	while ((c = getopt_long(argc, argv, "bh", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'b':
+			last_boot = 1;
+			break;
+		case 'h':
+			usage(EXIT_SUCCESS);
+		default:
+			usage(EXIT_FAILURE);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(EXIT_FAILURE);
+
+	f = fopen(argv[optind], "rb");
+	if (!f)
+		error(argv[optind]);
+
+	for (;;) {
+		data = malloc(LOG_STORE_BLOCK_SIZE);
+		if (!data)
+			error("malloc");
+
+		if (fread(data, LOG_STORE_BLOCK_SIZE, 1, f) != 1) {
+			free(data);
+			break;
+		}
+
+		header = (struct log_store_block *)data;
+		if (!is_valid_block(header)) {
+			free(data);
+			continue;
+		}
+
+		blocks = realloc(blocks, (nb_blocks + 1) * sizeof(*blocks));
+		if (!blocks)
+			error("realloc");
+		blocks[nb_blocks++] = header;
+	}
+	if (ferror(f))
+		error(argv[optind]);
+	fclose(f);
+
+	if (!nb_blocks) {
+		fprintf(stderr, "No log block found in %s\n", argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	qsort(blocks, nb_blocks, sizeof(*blocks), cmp_blocks);
+
+	for (i = 0; i < nb_blocks; i++) {
+		if (last_boot && blocks[i]->boot_seq != blocks[nb_blocks - 1]->boot_seq)
+			continue;
+		if (blocks[i]->boot_seq != boot_seq) {
+			boot_seq = blocks[i]->boot_seq;
+			printf("--- boot %llu ---\n", (unsigned long long)boot_seq);
+		}
+		print_block(blocks[i]);
+	}
+
+	for (i = 0; i < nb_blocks; i++)
+		free(blocks[i]);
+	free(blocks);
+
+	return EXIT_SUCCESS;
+}
@@ -69,51 +69,337 @@ EFI_STATUS get_esp_fs(EFI_FILE_IO_INTERFACE **esp_fs)
 }
 
 EFI_STATUS uefi_open_file(EFI_FILE_IO_INTERFACE *io, CHAR16 *filename, EFI_FILE **file)
+{
+	return uefi_file_open(io, filename, EFI_FILE_MODE_READ, file);
+}
+
+EFI_STATUS uefi_create_dir(EFI_FILE *parent, EFI_FILE **dir, CHAR16 *dirname)
+{
+	return uefi_call_wrapper(parent->Open, 5, parent, dir, dirname,
+				 EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
+				 EFI_FILE_DIRECTORY);
+}
+
+/* Directory handles cache.  Each directory opened on a volume to
+ * reach a file is kept open, keyed by the volume and the directory
+ * path, so that several operations in the same directories do not
+ * walk the same path again.  The root directory of a volume is cached
+ * with an empty path.  The cache must be flushed when the file
+ * systems are re-installed, see uefi_dir_cache_flush().  */
+#define DIR_CACHE_SIZE		16
+#define DIR_CACHE_PATH_MAX	128
+
+static struct dir_cache_entry {
+	EFI_FILE_IO_INTERFACE *io;
+	CHAR16 path[DIR_CACHE_PATH_MAX];
+	EFI_FILE *dir;
+} dir_cache[DIR_CACHE_SIZE];
+static UINTN dir_cache_next;
+
+static void dir_cache_evict(struct dir_cache_entry *entry)
+{
+	uefi_call_wrapper(entry->dir->Close, 1, entry->dir);
+	memset(entry, 0, sizeof(*entry));
+}
+
+void uefi_dir_cache_flush(void)
+{
+	UINTN i;
+
+	for (i = 0; i < DIR_CACHE_SIZE; i++)
+		if (dir_cache[i].dir)
+			dir_cache_evict(&dir_cache[i]);
+	dir_cache_next = 0;
+}
+
+/* Drop PATH and all its sub-directories from the IO cache.  */
+static void dir_cache_evict_path(EFI_FILE_IO_INTERFACE *io, CHAR16 *path)
+{
+	UINTN i, len = StrLen(path);
+
+	for (i = 0; i < DIR_CACHE_SIZE; i++)
+		if (dir_cache[i].dir && dir_cache[i].io == io &&
+		    !memcmp(dir_cache[i].path, path, len * sizeof(*path)) &&
+		    (dir_cache[i].path[len] == '\0' || dir_cache[i].path[len] == '/'))
+			dir_cache_evict(&dir_cache[i]);
+}
+
+static struct dir_cache_entry *dir_cache_lookup(EFI_FILE_IO_INTERFACE *io,
+						CHAR16 *path)
+{
+	UINTN i;
+
+	for (i = 0; i < DIR_CACHE_SIZE; i++)
+		if (dir_cache[i].dir && dir_cache[i].io == io &&
+		    !StrCmp(dir_cache[i].path, path))
+			return &dir_cache[i];
+
+	return NULL;
+}
+
+static void dir_cache_insert(EFI_FILE_IO_INTERFACE *io, CHAR16 *path,
+			     EFI_FILE *dir)
+{
+	struct dir_cache_entry *entry;
+
+	if (StrSize(path) > sizeof(entry->path))
+		return;
+
+	entry = &dir_cache[dir_cache_next];
+	dir_cache_next = (dir_cache_next + 1) % DIR_CACHE_SIZE;
+	if (entry->dir)
+		dir_cache_evict(entry);
+
+	entry->io = io;
+	memcpy(entry->path, path, StrSize(path));
+	entry->dir = dir;
+}
+
+/* Get a handle on the PATH directory of IO, PATH being a normalized
+ * '/' separated path relative to the root directory.  The returned
+ * handle belongs to the cache and must not be closed.  */
+static EFI_STATUS dir_cache_open(EFI_FILE_IO_INTERFACE *io, CHAR16 *path,
+				 BOOLEAN create, EFI_FILE **dir)
 {
 	EFI_STATUS ret;
+	struct dir_cache_entry *entry;
+	EFI_FILE *parent;
+	CHAR16 *name;
+
+	entry = dir_cache_lookup(io, path);
+	if (entry) {
+		*dir = entry->dir;
+		return EFI_SUCCESS;
+	}
+
+	if (!*path) {
+		ret = uefi_call_wrapper(io->OpenVolume, 2, io, dir);
+		if (EFI_ERROR(ret)) {
+			efi_perror(ret, L"Failed to open root directory");
+			return ret;
+		}
+		goto insert;
+	}
+
+	for (name = path + StrLen(path); name != path && name[-1] != '/'; name--)
+		;
 
-	ret = uefi_call_wrapper(io->OpenVolume, 2, io, file);
+	if (name == path)
+		ret = dir_cache_open(io, L"", create, &parent);
+	else {
+		name[-1] = '\0';
+		ret = dir_cache_open(io, path, create, &parent);
+		name[-1] = '/';
+	}
 	if (EFI_ERROR(ret))
 		return ret;
 
-	ret = uefi_call_wrapper((*file)->Open, 5, *file, file, filename, EFI_FILE_MODE_READ, 0);
+	if (create) {
+		debug(L"create directory %s", name);
+		ret = uefi_create_dir(parent, dir, name);
+	} else
+		ret = uefi_call_wrapper(parent->Open, 5, parent, dir, name,
+					EFI_FILE_MODE_READ, 0);
 	if (EFI_ERROR(ret))
 		return ret;
 
+insert:
+	dir_cache_insert(io, path, *dir);
+	if (!dir_cache_lookup(io, path)) {
+		/* Too long to be cached, the caller has to close it */
+		error(L"Directory path %s is too long", path);
+		uefi_call_wrapper((*dir)->Close, 1, *dir);
+		return EFI_INVALID_PARAMETER;
+	}
+
 	return EFI_SUCCESS;
 }
 
+/* Normalize FILENAME into a newly allocated '/' separated path
+ * without leading, trailing or duplicated separator.  */
+static CHAR16 *normalize_path(CHAR16 *filename)
+{
+	CHAR16 *path, *dst;
+
+	path = AllocatePool(StrSize(filename));
+	if (!path)
+		return NULL;
+
+	for (dst = path; *filename; filename++) {
+		if (*filename == '/' || *filename == '\\') {
+			if (dst != path && dst[-1] != '/')
+				*dst++ = '/';
+			continue;
+		}
+		*dst++ = *filename;
+	}
+	if (dst != path && dst[-1] == '/')
+		dst--;
+	*dst = '\0';
+
+	return path;
+}
+
+/* Open FILENAME, relative to the root directory of IO.  If MODE
+ * includes EFI_FILE_MODE_CREATE, the missing parent directories of
+ * FILENAME are created.  */
+EFI_STATUS uefi_file_open(EFI_FILE_IO_INTERFACE *io, CHAR16 *filename,
+			  UINT64 mode, EFI_FILE **file)
+{
+	EFI_STATUS ret;
+	EFI_FILE *dir;
+	CHAR16 *path, *name;
+	BOOLEAN retried = FALSE;
+
+	path = normalize_path(filename);
+	if (!path)
+		return EFI_OUT_OF_RESOURCES;
+
+	for (name = path + StrLen(path); name != path && name[-1] != '/'; name--)
+		;
+
+retry:
+	if (name == path)
+		ret = dir_cache_open(io, L"", FALSE, &dir);
+	else {
+		name[-1] = '\0';
+		ret = dir_cache_open(io, path, !!(mode & EFI_FILE_MODE_CREATE), &dir);
+		name[-1] = '/';
+	}
+	if (!EFI_ERROR(ret))
+		ret = uefi_call_wrapper(dir->Open, 5, dir, file, name, mode, 0);
+
+	/* A cached handle may belong to a volume which has been
+	 * re-installed behind our back, retry once from scratch.  */
+	if (EFI_ERROR(ret) && ret != EFI_NOT_FOUND && !retried) {
+		uefi_dir_cache_flush();
+		retried = TRUE;
+		goto retry;
+	}
+
+	FreePool(path);
+	return ret;
+}
+
 #define FILENAME_MAX_LENGTH 200
 
-EFI_STATUS uefi_get_file_size(EFI_FILE_IO_INTERFACE *io, CHAR16 *filename, UINTN *size)
+static EFI_STATUS get_file_info(EFI_FILE *file, EFI_FILE_INFO **info)
+{
+	EFI_STATUS ret;
+	UINTN info_size = SIZE_OF_EFI_FILE_INFO + FILENAME_MAX_LENGTH;
+
+	for (;;) {
+		*info = AllocatePool(info_size);
+		if (!*info)
+			return EFI_OUT_OF_RESOURCES;
+
+		ret = uefi_call_wrapper(file->GetInfo, 4, file, &GenericFileInfo,
+					&info_size, *info);
+		if (!EFI_ERROR(ret))
+			return ret;
+
+		FreePool(*info);
+		*info = NULL;
+		if (ret != EFI_BUFFER_TOO_SMALL)
+			return ret;
+	}
+}
+
+EFI_STATUS uefi_file_get_size(EFI_FILE *file, UINT64 *size)
 {
 	EFI_STATUS ret;
 	EFI_FILE_INFO *info;
-	UINTN info_size;
-	EFI_FILE *file;
 
-	ret = uefi_open_file(io, filename, &file);
+	ret = get_file_info(file, &info);
 	if (EFI_ERROR(ret))
-		goto out;
+		return ret;
 
-	info_size = SIZE_OF_EFI_FILE_INFO + FILENAME_MAX_LENGTH;
+	*size = info->FileSize;
+	FreePool(info);
 
-	info = AllocatePool(info_size);
-	if (!info) {
-		ret = EFI_OUT_OF_RESOURCES;
-		goto close;
+	return EFI_SUCCESS;
+}
+
+/* Set the FILE size to SIZE so that the file system allocates the
+ * storage once instead of growing the file at each write.  It also
+ * truncates the previous content when it was larger.  This is an
+ * explicit opt-in: the FAT driver zero-fills the clusters it adds, so
+ * it only pays off for files written in many small chunks.  */
+EFI_STATUS uefi_file_preallocate(EFI_FILE *file, UINT64 size)
+{
+	EFI_STATUS ret;
+	EFI_FILE_INFO *info;
+
+	ret = get_file_info(file, &info);
+	if (EFI_ERROR(ret))
+		return ret;
+
+	if (info->FileSize != size) {
+		info->FileSize = size;
+		ret = uefi_call_wrapper(file->SetInfo, 4, file, &GenericFileInfo,
+					info->Size, info);
 	}
+	FreePool(info);
 
-	ret = uefi_call_wrapper(file->GetInfo, 4, file, &GenericFileInfo, &info_size, info);
+	return ret;
+}
+
+/* Read up to *SIZE bytes from the current position of FILE into
+ * DATA.  On return, *SIZE is the number of bytes read, which is only
+ * smaller than requested at the end of the file.  */
+EFI_STATUS uefi_file_read_chunk(EFI_FILE *file, void *data, UINTN *size)
+{
+	EFI_STATUS ret;
+	UINTN done = 0, len;
+
+	while (done < *size) {
+		len = *size - done;
+		ret = uefi_call_wrapper(file->Read, 3, file, &len, (CHAR8 *)data + done);
+		if (EFI_ERROR(ret)) {
+			*size = done;
+			return ret;
+		}
+		if (!len)
+			break;
+		done += len;
+	}
+
+	*size = done;
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS uefi_file_write_chunk(EFI_FILE *file, void *data, UINTN size)
+{
+	EFI_STATUS ret;
+	UINTN len = size;
+
+	ret = uefi_call_wrapper(file->Write, 3, file, &len, data);
 	if (EFI_ERROR(ret))
-		goto free_info;
+		return ret;
 
-	*size = info->FileSize;
+	return len == size ? EFI_SUCCESS : EFI_VOLUME_FULL;
+}
 
-free_info:
-	FreePool(info);
-close:
-	uefi_call_wrapper(file->Close, 1, file);
+EFI_STATUS uefi_file_close(EFI_FILE *file)
+{
+	return uefi_call_wrapper(file->Close, 1, file);
+}
+
+EFI_STATUS uefi_get_file_size(EFI_FILE_IO_INTERFACE *io, CHAR16 *filename, UINTN *size)
+{
+	EFI_STATUS ret;
+	EFI_FILE *file;
+	UINT64 file_size;
+
+	ret = uefi_open_file(io, filename, &file);
+	if (EFI_ERROR(ret))
+		goto out;
+
+	ret = uefi_file_get_size(file, &file_size);
+	if (!EFI_ERROR(ret))
+		*size = file_size;
+
+	uefi_file_close(file);
 out:
 	if (EFI_ERROR(ret))
 		efi_perror(ret, L"Failed to read file %s", filename);
@@ -123,44 +409,30 @@ out:
 EFI_STATUS uefi_read_file(EFI_FILE_IO_INTERFACE *io, CHAR16 *filename, void **data, UINTN *size)
 {
 	EFI_STATUS ret;
-	EFI_FILE_INFO *info;
-	UINTN info_size;
 	EFI_FILE *file;
+	UINT64 file_size;
 
 	ret = uefi_open_file(io, filename, &file);
 	if (EFI_ERROR(ret))
 		goto out;
 
-	info_size = SIZE_OF_EFI_FILE_INFO + FILENAME_MAX_LENGTH;
-
-	info = AllocatePool(info_size);
-	if (!info) {
-		ret = EFI_OUT_OF_RESOURCES;
-		goto close;
-	}
-
-	ret = uefi_call_wrapper(file->GetInfo, 4, file, &GenericFileInfo, &info_size, info);
+	ret = uefi_file_get_size(file, &file_size);
 	if (EFI_ERROR(ret))
-		goto free_info;
+		goto close;
 
-	*size = info->FileSize;
+	*size = file_size;
 	*data = AllocatePool(*size);
-
-retry:
-	ret = uefi_call_wrapper(file->Read, 3, file, size, *data);
-	if (ret == EFI_BUFFER_TOO_SMALL) {
-		FreePool(*data);
-		*data = AllocatePool(*size);
-		goto retry;
+	if (!*data) {
+		ret = EFI_OUT_OF_RESOURCES;
+		goto close;
 	}
 
+	ret = uefi_file_read_chunk(file, *data, size);
 	if (EFI_ERROR(ret))
 		FreePool(*data);
 
-free_info:
-	FreePool(info);
 close:
-	uefi_call_wrapper(file->Close, 1, file);
+	uefi_file_close(file);
 out:
 	if (EFI_ERROR(ret))
 		efi_perror(ret, L"Failed to read file %s", filename);
@@ -170,18 +442,15 @@ out:
 EFI_STATUS uefi_write_file(EFI_FILE_IO_INTERFACE *io, CHAR16 *filename, void *data, UINTN *size)
 {
 	EFI_STATUS ret;
-	EFI_FILE *file, *root;
-
-	ret = uefi_call_wrapper(io->OpenVolume, 2, io, &root);
-	if (EFI_ERROR(ret))
-		goto out;
+	EFI_FILE *file;
 
-	ret = uefi_call_wrapper(root->Open, 5, root, &file, filename, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+	ret = uefi_file_open(io, filename, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE |
+			     EFI_FILE_MODE_CREATE, &file);
 	if (EFI_ERROR(ret))
 		goto out;
 
 	ret = uefi_call_wrapper(file->Write, 3, file, size, data);
-	uefi_call_wrapper(file->Close, 1, file);
+	uefi_file_close(file);
 
 out:
 	if (EFI_ERROR(ret))
@@ -189,63 +458,21 @@ out:
 	return ret;
 }
 
-EFI_STATUS uefi_create_dir(EFI_FILE *parent, EFI_FILE **dir, CHAR16 *dirname)
-{
-	return uefi_call_wrapper(parent->Open, 5, parent, dir, dirname,
-				 EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE,
-				 EFI_FILE_DIRECTORY);
-}
-
-#define MAX_SUBDIR 10
 EFI_STATUS uefi_write_file_with_dir(EFI_FILE_IO_INTERFACE *io, CHAR16 *filename, void *data, UINTN size)
 {
 	EFI_STATUS ret;
-	EFI_FILE *dirs[MAX_SUBDIR];
 	EFI_FILE *file;
-	CHAR16 *start;
-	CHAR16 *end;
-	INTN subdir = 0;
-
-	ret = uefi_call_wrapper(io->OpenVolume, 2, io, &dirs[0]);
-	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Failed to open root directory");
-		return ret;
-	}
-	start = filename;
-	for (end = filename; *end; end++) {
-		if (*end != '/')
-			continue;
-		if (start == end) {
-			start++;
-			continue;
-		}
 
-		*end = 0;
-		debug(L"create directory %s", start);
-		ret = uefi_create_dir(dirs[subdir], &dirs[subdir + 1], start);
-		*end = '/';
-		if (EFI_ERROR(ret))
-			goto out;
-		subdir++;
-		if (subdir >= MAX_SUBDIR - 1) {
-			error(L"too many subdirectories, limit is %d", MAX_SUBDIR);
-			ret = EFI_INVALID_PARAMETER;
-			goto out;
-		}
-		start = end + 1;
-	}
-	debug(L"write file %s", start);
-	ret = uefi_call_wrapper(dirs[subdir]->Open, 5, dirs[subdir], &file, start, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+	debug(L"write file %s", filename);
+	ret = uefi_file_open(io, filename, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE |
+			     EFI_FILE_MODE_CREATE, &file);
 	if (EFI_ERROR(ret))
 		goto out;
 
-	ret = uefi_call_wrapper(file->Write, 3, file, &size, data);
-	uefi_call_wrapper(file->Close, 1, file);
+	ret = uefi_file_write_chunk(file, data, size);
+	uefi_file_close(file);
 
 out:
-	for (; subdir >= 0; subdir--)
-		uefi_call_wrapper(dirs[subdir]->Close, 1, dirs[subdir]);
-
 	if (EFI_ERROR(ret))
 		efi_perror(ret, L"Failed to write file %s", filename);
 	return ret;
@@ -254,14 +481,19 @@ out:
 EFI_STATUS uefi_delete_file(EFI_FILE_IO_INTERFACE *io, CHAR16 *filename)
 {
 	EFI_STATUS ret;
-	EFI_FILE *file, *root;
+	EFI_FILE *file;
+	CHAR16 *path;
 
-	ret = uefi_call_wrapper(io->OpenVolume, 2, io, &root);
-	if (EFI_ERROR(ret))
+	/* Deleting a directory invalidates its cached handles */
+	path = normalize_path(filename);
+	if (!path) {
+		ret = EFI_OUT_OF_RESOURCES;
 		goto out;
+	}
+	dir_cache_evict_path(io, path);
+	FreePool(path);
 
-	ret = uefi_call_wrapper(root->Open, 5, root, &file, filename,
-				EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0);
+	ret = uefi_file_open(io, filename, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, &file);
 	if (EFI_ERROR(ret))
 		goto out;
 
@@ -294,7 +526,7 @@ BOOLEAN uefi_exist_file_root(EFI_FILE_IO_INTERFACE *io, CHAR16 *filename)
 	EFI_STATUS ret;
 	EFI_FILE *root;
 
-	ret = uefi_call_wrapper(io->OpenVolume, 2, io, &root);
+	ret = dir_cache_open(io, L"", FALSE, &root);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to open volume %s", filename);
 		return FALSE;
@@ -324,7 +556,7 @@ EFI_STATUS uefi_create_directory_root(EFI_FILE_IO_INTERFACE *io, CHAR16 *dirname
 	EFI_STATUS ret;
 	EFI_FILE *root;
 
-	ret = uefi_call_wrapper(io->OpenVolume, 2, io, &root);
+	ret = dir_cache_open(io, L"", FALSE, &root);
 	if (EFI_ERROR(ret)) {
 		efi_perror(ret, L"Failed to open volume %s", dirname);
 		return ret;
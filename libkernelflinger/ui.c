@@ -216,8 +216,33 @@ EFI_STATUS ui_display_vendor_splash(VOID)
 	return EFI_SUCCESS;
 }
 
+/* Off-screen framebuffer.  While composing, the drawing primitives
+ * render into it and only the modified area is blitted to the screen
+ * by ui_fb_flush().  A copy of the framebuffer, the base, can be kept
+ * to restore the background shared by successive screens without
+ * drawing it again.  */
+static struct {
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *blt;
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL *base;
+	const void *base_id;
+	BOOLEAN composing;
+	BOOLEAN synced;		/* The screen shows the framebuffer */
+	UINTN x0, y0, x1, y1;	/* Dirty area, empty if x0 >= x1 */
+} fb;
+
+static void fb_free(void)
+{
+	if (fb.blt)
+		FreePool(fb.blt);
+	if (fb.base)
+		FreePool(fb.base);
+	memset(&fb, 0, sizeof(fb));
+}
+
 void ui_free(void)
 {
+	fb_free();
+
 	if (!default_textarea)
 		return;
 
@@ -238,14 +263,148 @@ EFI_STATUS ui_clear_screen()
 	return ui_clear_area(0, 0, graphic.width, graphic.height);
 }
 
+static BOOLEAN fb_clip(UINTN *x, UINTN *y, UINTN *width, UINTN *height)
+{
+	if (*x >= graphic.width || *y >= graphic.height)
+		return FALSE;
+
+	*width = min(*width, graphic.width - *x);
+	*height = min(*height, graphic.height - *y);
+	return *width && *height;
+}
+
+static void fb_mark_dirty(UINTN x, UINTN y, UINTN width, UINTN height)
+{
+	if (fb.x0 >= fb.x1) {
+		fb.x0 = x;
+		fb.y0 = y;
+		fb.x1 = x + width;
+		fb.y1 = y + height;
+		return;
+	}
+
+	fb.x0 = min(fb.x0, x);
+	fb.y0 = min(fb.y0, y);
+	fb.x1 = max(fb.x1, x + width);
+	fb.y1 = max(fb.y1, y + height);
+}
+
+static void fb_copy_area(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *dst,
+			 EFI_GRAPHICS_OUTPUT_BLT_PIXEL *src,
+			 UINTN x, UINTN y, UINTN width, UINTN height)
+{
+	UINTN i, offset;
+
+	for (i = 0; i < height; i++) {
+		offset = (y + i) * graphic.width + x;
+		memcpy(dst + offset, src + offset, width * sizeof(*dst));
+	}
+}
+
+EFI_STATUS ui_fb_begin(void)
+{
+	if (!ui_is_ready())
+		return EFI_UNSUPPORTED;
+
+	if (!fb.blt) {
+		fb.blt = AllocateZeroPool(ui_get_blt_size(graphic.width,
+							  graphic.height));
+		if (!fb.blt)
+			return EFI_OUT_OF_RESOURCES;
+		fb.synced = FALSE;
+	}
+
+	fb.composing = TRUE;
+	if (!fb.synced)
+		fb_mark_dirty(0, 0, graphic.width, graphic.height);
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS ui_fb_flush(void)
+{
+	EFI_STATUS ret;
+
+	if (!fb.composing || fb.x0 >= fb.x1)
+		return EFI_SUCCESS;
+
+	ret = uefi_call_wrapper(graphic.output->Blt, 10, graphic.output,
+				fb.blt, EfiBltBufferToVideo, fb.x0, fb.y0,
+				fb.x0, fb.y0, fb.x1 - fb.x0, fb.y1 - fb.y0,
+				graphic.width * sizeof(*fb.blt));
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Failed to display the framebuffer");
+		return ret;
+	}
+
+	fb.x0 = fb.x1 = 0;
+	fb.synced = TRUE;
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS ui_fb_end(void)
+{
+	EFI_STATUS ret;
+
+	ret = ui_fb_flush();
+	fb.composing = FALSE;
+	return ret;
+}
+
+void ui_fb_restore_base_area(UINTN x, UINTN y, UINTN width, UINTN height)
+{
+	if (!fb.composing || !fb.base || !fb_clip(&x, &y, &width, &height))
+		return;
+
+	fb_copy_area(fb.blt, fb.base, x, y, width, height);
+	fb_mark_dirty(x, y, width, height);
+}
+
+void ui_fb_save_base(const void *id)
+{
+	if (!fb.composing)
+		return;
+
+	if (!fb.base) {
+		fb.base = AllocatePool(ui_get_blt_size(graphic.width,
+						       graphic.height));
+		if (!fb.base)
+			return;
+	}
+
+	memcpy(fb.base, fb.blt, ui_get_blt_size(graphic.width, graphic.height));
+	fb.base_id = id;
+}
+
+const void *ui_fb_base_id(void)
+{
+	return fb.base ? fb.base_id : NULL;
+}
+
 EFI_STATUS ui_fill_area(UINTN x, UINTN y, UINTN width, UINTN height,
 			EFI_GRAPHICS_OUTPUT_BLT_PIXEL *color)
 {
+	UINTN i, j;
+
 	if (!ui_is_ready())
 		return EFI_UNSUPPORTED;
 
-	return uefi_call_wrapper(graphic.output->Blt, 10, graphic.output,
-				 color, EfiBltVideoFill, 0, 0, x, y, width, height, 0);
+	if (!fb.composing) {
+		fb.synced = FALSE;
+		return uefi_call_wrapper(graphic.output->Blt, 10, graphic.output,
+					 color, EfiBltVideoFill, 0, 0, x, y,
+					 width, height, 0);
+	}
+
+	if (!fb_clip(&x, &y, &width, &height))
+		return EFI_SUCCESS;
+
+	for (i = 0; i < height; i++)
+		for (j = 0; j < width; j++)
+			fb.blt[(y + i) * graphic.width + x + j] = *color;
+	fb_mark_dirty(x, y, width, height);
+
+	return EFI_SUCCESS;
 }
 
 EFI_STATUS ui_clear_area(UINTN x, UINTN y, UINTN width, UINTN height)
@@ -295,10 +454,25 @@ EFI_STATUS ui_draw_blt(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *blt, UINTN x, UINTN y,
 		       UINTN width, UINTN height)
 {
 	EFI_STATUS ret;
+	UINTN i, clipped_width, clipped_height;
 
 	if (!graphic.output)
 		return EFI_UNSUPPORTED;
 
+	if (fb.composing) {
+		clipped_width = width;
+		clipped_height = height;
+		if (!fb_clip(&x, &y, &clipped_width, &clipped_height))
+			return EFI_SUCCESS;
+
+		for (i = 0; i < clipped_height; i++)
+			memcpy(fb.blt + (y + i) * graphic.width + x,
+			       blt + i * width, clipped_width * sizeof(*blt));
+		fb_mark_dirty(x, y, clipped_width, clipped_height);
+		return EFI_SUCCESS;
+	}
+
+	fb.synced = FALSE;
 	ret = uefi_call_wrapper(graphic.output->Blt, 10, graphic.output, blt, EfiBltBufferToVideo,
 				0, 0, x, y, width, height, 0);
 	if (EFI_ERROR(ret))
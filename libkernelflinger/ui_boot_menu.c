@@ -75,20 +75,47 @@ static EFI_STATUS ui_boot_menu_redraw(ui_boot_menu_t *menu, UINTN *y)
 		{ NULL, NULL, TRUE }
 	};
 
-	*y = menu->y;
-
 	ui_image_t *image = menu->actions[menu->cur].image;
 	if (!image)
 		return EFI_UNSUPPORTED;
 
+	*y = menu->y;
 	ret = ui_image_draw(image, menu->x, *y);
 	if (EFI_ERROR(ret))
 		return ret;
 
 	*y += image->height + MARGIN;
 
-	return ui_textarea_display_text(lines, ui_font_get_default(),
-					menu->x, y, menu->max_width, 0, NULL);
+	ret = ui_textarea_display_text(lines, ui_font_get_default(),
+				       menu->x, y, menu->max_width, 0, NULL);
+	menu->y_end = *y;
+	return ret;
+}
+
+/* On selection change, only the action image is drawn again if the
+ * new one has the same height.  The area of the previous image not
+ * covered by the new one is cleared.  Otherwise, the help text below
+ * the image has to move: the whole menu is cleared and laid out
+ * again.  */
+static EFI_STATUS ui_boot_menu_select(ui_boot_menu_t *menu, UINTN cur)
+{
+	ui_image_t *prev = menu->actions[menu->cur].image;
+	ui_image_t *image = menu->actions[cur].image;
+	UINTN y;
+
+	menu->cur = cur;
+	if (prev->height != image->height) {
+		ui_clear_area(menu->x, menu->y,
+			      max(menu->max_width, prev->width),
+			      menu->y_end - menu->y);
+		return ui_boot_menu_redraw(menu, &y);
+	}
+
+	if (prev->width > image->width)
+		ui_clear_area(menu->x + image->width, menu->y,
+			      prev->width - image->width, prev->height);
+
+	return ui_image_draw(image, menu->x, menu->y);
 }
 
 EFI_STATUS ui_boot_menu_draw(ui_boot_menu_t *menu, UINTN x, UINTN *y, UINTN max_width)
@@ -101,13 +128,11 @@ EFI_STATUS ui_boot_menu_draw(ui_boot_menu_t *menu, UINTN x, UINTN *y, UINTN max_
 
 enum boot_target ui_boot_menu_event_handler(ui_boot_menu_t *menu, ui_events_t event)
 {
-	UINTN y;
-
 	switch (event) {
 	case EV_UP:
 #ifdef USE_POWER_BUTTON
-		menu->cur = (menu->cur + menu->action_nb - 1) % menu->action_nb;
-		ui_boot_menu_redraw(menu, &y);
+		ui_boot_menu_select(menu, (menu->cur + menu->action_nb - 1) %
+				    menu->action_nb);
 		break;
 	case EV_POWER:
 		return menu->actions[menu->cur].target;
@@ -115,8 +140,7 @@ enum boot_target ui_boot_menu_event_handler(ui_boot_menu_t *menu, ui_events_t ev
 		return menu->actions[menu->cur].target;
 #endif
 	case EV_DOWN:
-		menu->cur = (menu->cur + 1) % menu->action_nb;
-		ui_boot_menu_redraw(menu, &y);
+		ui_boot_menu_select(menu, (menu->cur + 1) % menu->action_nb);
 		break;
 	default:
 		break;
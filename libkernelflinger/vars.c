@@ -40,13 +40,15 @@
 #include "smbios.h"
 #include "version.h"
 
-#define OFF_MODE_CHARGE_VAR	L"off-mode-charge"
-#define OEM_LOCK_VAR		L"OEMLock"
+#define DEVICE_STATE_VAR	L"DeviceState"
+#define OFF_MODE_CHARGE_VAR	L"off-mode-charge"	/* Legacy */
+#define OEM_LOCK_VAR		L"OEMLock"		/* Legacy, except with USERFASTBOOT */
 #define KEYSTORE_VAR		L"KeyStore"
-#define CRASH_EVENT_MENU_VAR	L"CrashEventMenu"
-#define WDT_COUNTER_VAR		L"WatchdogCounter"
-#define WDT_TIME_REF_VAR	L"WatchdogTimeReference"
-#define UPDATE_OEMVARS		L"UpdateOemVars"
+#define CRASH_EVENT_MENU_VAR	L"CrashEventMenu"	/* Legacy */
+#define WDT_STATUS_VAR		L"WatchdogStatus"
+#define WDT_COUNTER_VAR		L"WatchdogCounter"	/* Legacy */
+#define WDT_TIME_REF_VAR	L"WatchdogTimeReference" /* Legacy */
+#define UPDATE_OEMVARS		L"UpdateOemVars"	/* Legacy */
 #define UI_DISPLAY_SPLASH_VAR	L"UIDisplaySplash"
 
 #define OEM_LOCK_UNLOCKED	(1 << 0)
@@ -78,9 +80,6 @@ static struct state_display {
 	{ "unlocked", &COLOR_RED }
 };
 
-static CHAR8 current_off_mode_charge[2];
-static CHAR8 current_crash_event_menu[2];
-static CHAR8 current_update_oemvars[2];
 static CHAR8 ui_display_splash[2];
 
 CHAR16 *boot_state_to_string(UINT8 boot_state)
@@ -122,38 +121,224 @@ BOOLEAN get_current_boolean_var(const EFI_GUID *guid, CHAR16 *varname, CHAR8 cac
 	return !strcmp(cache, (CHAR8 *)"1");
 }
 
-EFI_STATUS set_boolean_var(const EFI_GUID *guid, CHAR16 *varname, CHAR8 cache[2], BOOLEAN enabled)
+/* The device state, the off-mode-charge, crash event menu and OEM
+ * vars update flags are stored in a single record.  It is read once
+ * per boot and only written back when one of its fields changes.
+ * The legacy variables are imported, then deleted, when the record
+ * does not exist yet.  */
+#define DEVICE_STATE_VERSION	1
+#define DEVICE_STATE_PROVISIONED	(1 << 0)
+
+struct device_state_record {
+	UINT8 version;
+	UINT8 flags;
+	UINT8 oem_lock;
+	UINT8 off_mode_charge;
+	UINT8 crash_event_menu;
+	UINT8 update_oemvars;
+	UINT16 reserved;
+	UINT32 crc32;
+} __attribute__((packed));
+
+static struct device_state_record dstate;
+static BOOLEAN dstate_loaded;
+static BOOLEAN dstate_stored;
+
+static EFI_STATUS device_state_crc(struct device_state_record *record,
+				   UINT32 *crc)
 {
-	CHAR8 *val = (CHAR8 *)(enabled ? "1" : "0");
-	EFI_STATUS ret = set_efi_variable(guid, varname,
-					  2, val, TRUE, FALSE);
+	EFI_STATUS ret;
+
+	ret = uefi_call_wrapper(BS->CalculateCrc32, 3, record,
+				sizeof(*record) - sizeof(record->crc32), crc);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"CalculateCrc32 failed");
+
+	return ret;
+}
+
+static EFI_STATUS store_device_state(struct device_state_record *record)
+{
+	EFI_STATUS ret;
+	UINT32 crc;
+
+	ret = device_state_crc(record, &crc);
+	if (EFI_ERROR(ret))
+		return ret;
+	record->crc32 = crc;
+
+	if (dstate_stored && !memcmp(record, &dstate, sizeof(dstate)))
+		return EFI_SUCCESS;
+
+	ret = set_efi_variable(&fastboot_guid, DEVICE_STATE_VAR,
+			       sizeof(*record), record, TRUE, FALSE);
 	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Failed to set %s variable", varname);
+		efi_perror(ret, L"Failed to set %s variable", DEVICE_STATE_VAR);
 		return ret;
 	}
 
-	memcpy(cache, val, 2);
+	memcpy(&dstate, record, sizeof(dstate));
+	dstate_stored = TRUE;
 	return EFI_SUCCESS;
 }
 
+static BOOLEAN import_legacy_boolean(CHAR16 *varname, UINT8 *value)
+{
+	EFI_STATUS ret;
+	CHAR8 *data;
+	UINTN size;
+
+	ret = get_efi_variable(&fastboot_guid, varname, &size,
+			       (VOID **)&data, NULL);
+	if (EFI_ERROR(ret))
+		return FALSE;
+
+	if (size == 2 && (!strcmp(data, (CHAR8 *)"0") ||
+			  !strcmp(data, (CHAR8 *)"1")))
+		*value = data[0] == '1';
+
+	FreePool(data);
+	return TRUE;
+}
+
+static void import_legacy_state_vars(void)
+{
+	static CHAR16 *LEGACY_VARS[] = {
+#ifndef USERFASTBOOT
+		OEM_LOCK_VAR,
+#endif
+		OFF_MODE_CHARGE_VAR, CRASH_EVENT_MENU_VAR, UPDATE_OEMVARS
+	};
+	struct device_state_record record = dstate;
+	BOOLEAN found = FALSE;
+	EFI_STATUS ret;
+	UINTN i;
+#ifndef USERFASTBOOT
+	UINT8 *stored_state;
+	UINTN dsize;
+	UINT32 flags;
+
+	ret = get_efi_variable((EFI_GUID *)&fastboot_guid, OEM_LOCK_VAR,
+			       &dsize, (void **)&stored_state, &flags);
+	if (ret != EFI_NOT_FOUND) {
+		found = TRUE;
+		record.flags |= DEVICE_STATE_PROVISIONED;
+		/* If we can't read the state, be safe and assume locked. */
+		if (EFI_ERROR(ret) || !dsize) {
+			error(L"Couldn't read %s, assuming locked", OEM_LOCK_VAR);
+		} else if (flags & EFI_VARIABLE_RUNTIME_ACCESS) {
+			error(L"%s has RUNTIME_ACCESS flag, assuming locked", OEM_LOCK_VAR);
+		} else
+			record.oem_lock = stored_state[0] &
+				(OEM_LOCK_UNLOCKED | OEM_LOCK_VERIFIED);
+		if (!EFI_ERROR(ret))
+			FreePool(stored_state);
+	}
+#endif
+
+	found |= import_legacy_boolean(OFF_MODE_CHARGE_VAR, &record.off_mode_charge);
+	found |= import_legacy_boolean(CRASH_EVENT_MENU_VAR, &record.crash_event_menu);
+	found |= import_legacy_boolean(UPDATE_OEMVARS, &record.update_oemvars);
+
+	if (!found)
+		return;
+
+	memcpy(&dstate, &record, sizeof(dstate));
+	ret = store_device_state(&record);
+	if (EFI_ERROR(ret))
+		return;
+
+	debug(L"Legacy device state variables imported");
+	for (i = 0; i < ARRAY_SIZE(LEGACY_VARS); i++)
+		del_efi_variable(&fastboot_guid, LEGACY_VARS[i]);
+}
+
+static void load_device_state(void)
+{
+	struct device_state_record *record;
+	EFI_STATUS ret;
+	UINTN size;
+	UINT32 flags, crc;
+
+	if (dstate_loaded)
+		return;
+	dstate_loaded = TRUE;
+
+	/* The flags default to enabled, as the legacy variables did
+	 * when they were not set.  */
+	memset(&dstate, 0, sizeof(dstate));
+	dstate.version = DEVICE_STATE_VERSION;
+	dstate.off_mode_charge = 1;
+	dstate.crash_event_menu = 1;
+	dstate.update_oemvars = 1;
+
+	ret = get_efi_variable(&fastboot_guid, DEVICE_STATE_VAR, &size,
+			       (VOID **)&record, &flags);
+	if (ret == EFI_NOT_FOUND) {
+		import_legacy_state_vars();
+		return;
+	}
+
+	/* If we can't read the state, be safe and assume locked. */
+	dstate.flags = DEVICE_STATE_PROVISIONED;
+	if (EFI_ERROR(ret)) {
+		efi_perror(ret, L"Couldn't read %s, assuming locked",
+			   DEVICE_STATE_VAR);
+		return;
+	}
+
+	if (size != sizeof(*record) || record->version != DEVICE_STATE_VERSION
+	    || EFI_ERROR(device_state_crc(record, &crc))
+	    || crc != record->crc32) {
+		error(L"%s is corrupted, assuming locked", DEVICE_STATE_VAR);
+		goto out;
+	}
+
+#ifndef USERFASTBOOT
+	if (flags & EFI_VARIABLE_RUNTIME_ACCESS) {
+		error(L"%s has RUNTIME_ACCESS flag, assuming locked",
+		      DEVICE_STATE_VAR);
+		goto out;
+	}
+#endif
+
+	memcpy(&dstate, record, sizeof(dstate));
+	dstate_stored = TRUE;
+
+out:
+	FreePool(record);
+}
+
 BOOLEAN get_current_off_mode_charge(void)
 {
-	return get_current_boolean_var(&fastboot_guid, OFF_MODE_CHARGE_VAR, current_off_mode_charge);
+	load_device_state();
+	return dstate.off_mode_charge;
 }
 
 EFI_STATUS set_off_mode_charge(BOOLEAN enabled)
 {
-	return set_boolean_var(&fastboot_guid, OFF_MODE_CHARGE_VAR, current_off_mode_charge, enabled);
+	struct device_state_record record;
+
+	load_device_state();
+	record = dstate;
+	record.off_mode_charge = enabled ? 1 : 0;
+	return store_device_state(&record);
 }
 
 BOOLEAN get_current_crash_event_menu(void)
 {
-	return get_current_boolean_var(&fastboot_guid, CRASH_EVENT_MENU_VAR, current_crash_event_menu);
+	load_device_state();
+	return dstate.crash_event_menu;
 }
 
 EFI_STATUS set_crash_event_menu(BOOLEAN enabled)
 {
-	return set_boolean_var(&fastboot_guid, CRASH_EVENT_MENU_VAR, current_crash_event_menu, enabled);
+	struct device_state_record record;
+
+	load_device_state();
+	record = dstate;
+	record.crash_event_menu = enabled ? 1 : 0;
+	return store_device_state(&record);
 }
 
 BOOLEAN get_display_splash(void) {
@@ -162,84 +347,129 @@ BOOLEAN get_display_splash(void) {
 
 BOOLEAN get_oemvars_update(void)
 {
-	return get_current_boolean_var(&fastboot_guid, UPDATE_OEMVARS, current_update_oemvars);
+	load_device_state();
+	return dstate.update_oemvars;
 }
 
 EFI_STATUS set_oemvars_update(BOOLEAN enabled)
 {
-	return set_boolean_var(&fastboot_guid, UPDATE_OEMVARS, current_update_oemvars, enabled);
+	struct device_state_record record;
+
+	load_device_state();
+	record = dstate;
+	record.update_oemvars = enabled ? 1 : 0;
+	return store_device_state(&record);
 }
 
-enum device_state get_current_state()
+#ifdef USERFASTBOOT
+/* userfastboot changes the lock state at OS runtime by writing the
+ * OEMLock variable, so it remains the reference for the lock state
+ * and is read on every boot instead of being merged in DeviceState.
+ * Return FALSE if the device is not provisioned.  */
+static BOOLEAN get_oem_lock(UINT8 *oem_lock)
 {
+	EFI_STATUS ret;
 	UINT8 *stored_state;
 	UINTN dsize;
+
+	ret = get_efi_variable((EFI_GUID *)&fastboot_guid, OEM_LOCK_VAR,
+			       &dsize, (void **)&stored_state, NULL);
+	if (ret == EFI_NOT_FOUND)
+		return FALSE;
+
+	/* If we can't read the state, be safe and assume locked. */
+	*oem_lock = 0;
+	if (EFI_ERROR(ret) || !dsize) {
+		error(L"Couldn't read %s, assuming locked", OEM_LOCK_VAR);
+		if (!EFI_ERROR(ret))
+			FreePool(stored_state);
+		return TRUE;
+	}
+
+	*oem_lock = stored_state[0];
+	FreePool(stored_state);
+	return TRUE;
+}
+
+static EFI_STATUS set_oem_lock(UINT8 oem_lock)
+{
 	EFI_STATUS ret;
-	UINT32 flags;
+	UINT8 cur;
 
-	if (current_state == UNKNOWN_STATE) {
-		ret = get_efi_variable((EFI_GUID *)&fastboot_guid, OEM_LOCK_VAR,
-				       &dsize, (void **)&stored_state, &flags);
-		/* If the variable does not exist, assume unlocked. */
-		if (ret == EFI_NOT_FOUND) {
-			provisioning_mode = TRUE;
-			current_state = UNLOCKED;
-			debug(L"OEMLock not set, device is in provisioning mode");
-			goto exit;
-		}
+	if (get_oem_lock(&cur) && cur == oem_lock)
+		return EFI_SUCCESS;
 
-		/* If we can't read the state, be safe and assume locked. */
-		if (EFI_ERROR(ret) || !dsize) {
-			current_state = LOCKED;
-			error(L"Couldn't read %s, assuming locked", OEM_LOCK_VAR);
-			goto exit;
-#ifndef USERFASTBOOT
-		} else if (flags & EFI_VARIABLE_RUNTIME_ACCESS) {
-			current_state = LOCKED;
-			error(L"%s has RUNTIME_ACCESS flag, assuming locked", OEM_LOCK_VAR);
+	ret = set_efi_variable(&fastboot_guid, OEM_LOCK_VAR,
+			       sizeof(oem_lock), &oem_lock, TRUE, FALSE);
+	if (EFI_ERROR(ret))
+		efi_perror(ret, L"Failed to set %s variable", OEM_LOCK_VAR);
+
+	return ret;
+}
+#else
+static BOOLEAN get_oem_lock(UINT8 *oem_lock)
+{
+	load_device_state();
+	*oem_lock = dstate.oem_lock;
+	return !!(dstate.flags & DEVICE_STATE_PROVISIONED);
+}
 #endif
-		} else {
-			if (stored_state[0] & OEM_LOCK_UNLOCKED)
-				current_state = UNLOCKED;
-			else if (stored_state[0] & OEM_LOCK_VERIFIED)
-				current_state = VERIFIED;
-			else
-				current_state = LOCKED;
-
-			debug(L"device state %d", current_state);
-		}
-		FreePool(stored_state);
+
+enum device_state get_current_state()
+{
+	UINT8 oem_lock;
+
+	if (current_state != UNKNOWN_STATE)
+		return current_state;
+
+	if (!get_oem_lock(&oem_lock)) {
+		provisioning_mode = TRUE;
+		current_state = UNLOCKED;
+		debug(L"Device state not set, device is in provisioning mode");
+		return current_state;
 	}
 
-exit:
+	if (oem_lock & OEM_LOCK_UNLOCKED)
+		current_state = UNLOCKED;
+	else if (oem_lock & OEM_LOCK_VERIFIED)
+		current_state = VERIFIED;
+	else
+		current_state = LOCKED;
+
+	debug(L"device state %d", current_state);
 	return current_state;
 }
 
 EFI_STATUS set_current_state(enum device_state state)
 {
-	UINT8 stored_state;
+	struct device_state_record record;
+	EFI_STATUS ret;
+
+	load_device_state();
+	record = dstate;
+	record.flags |= DEVICE_STATE_PROVISIONED;
 
 	switch (state) {
 	case LOCKED:
-		stored_state = 0;
+		record.oem_lock = 0;
 		break;
 	case VERIFIED:
-		stored_state = OEM_LOCK_VERIFIED;
+		record.oem_lock = OEM_LOCK_VERIFIED;
 		break;
 	case UNLOCKED:
-		stored_state = OEM_LOCK_UNLOCKED;
+		record.oem_lock = OEM_LOCK_UNLOCKED;
 		break;
 	default:
 		return EFI_INVALID_PARAMETER;
 	}
 
-	EFI_STATUS ret = set_efi_variable(&fastboot_guid, OEM_LOCK_VAR,
-					  sizeof(stored_state), &stored_state,
-					  TRUE, FALSE);
-	if (EFI_ERROR(ret)) {
-		efi_perror(ret, L"Failed to set %s variable", OEM_LOCK_VAR);
+#ifdef USERFASTBOOT
+	ret = set_oem_lock(record.oem_lock);
+#else
+	ret = store_device_state(&record);
+#endif
+	if (EFI_ERROR(ret))
 		return ret;
-	}
 
 	debug(L"device state is now %d", state);
 	current_state = state;
@@ -249,7 +479,16 @@ EFI_STATUS set_current_state(enum device_state state)
 #ifndef USER
 EFI_STATUS reprovision_state_vars(VOID)
 {
-	return del_efi_variable(&fastboot_guid, OEM_LOCK_VAR);
+	struct device_state_record record;
+
+	load_device_state();
+	record = dstate;
+	record.flags &= ~DEVICE_STATE_PROVISIONED;
+	record.oem_lock = 0;
+#ifdef USERFASTBOOT
+	del_efi_variable(&fastboot_guid, OEM_LOCK_VAR);
+#endif
+	return store_device_state(&record);
 }
 #endif
 
@@ -330,7 +569,21 @@ BOOLEAN device_is_provisioning(void)
 	return provisioning_mode;
 }
 
-EFI_STATUS get_watchdog_status(UINT8 *counter, EFI_TIME *time)
+/* The watchdog counter and time reference are stored in a single
+ * variable so that they are read and updated at once.  The legacy
+ * layout made of two variables is still read and is removed on the
+ * next update.  */
+#define WDT_STATUS_VERSION	1
+
+struct watchdog_status {
+	UINT8 version;
+	UINT8 counter;
+	EFI_TIME time_ref;
+} __attribute__((packed));
+
+static BOOLEAN wdt_legacy_layout;
+
+static EFI_STATUS get_legacy_watchdog_status(UINT8 *counter, EFI_TIME *time)
 {
 	EFI_STATUS ret;
 	EFI_TIME *tmp;
@@ -346,46 +599,91 @@ EFI_STATUS get_watchdog_status(UINT8 *counter, EFI_TIME *time)
 	if (EFI_ERROR(ret))
 		return ret;
 
+	wdt_legacy_layout = TRUE;
+
 	ret = get_efi_variable(&fastboot_guid, WDT_TIME_REF_VAR, &size,
 			       (VOID **)&tmp, &flags);
 	if (EFI_ERROR(ret))
 		return ret;
 
-	if (size != sizeof(*time))
+	if (size != sizeof(*time)) {
+		FreePool(tmp);
 		return EFI_COMPROMISED_DATA;
+	}
 
 	memcpy(time, tmp, size);
+	FreePool(tmp);
 
 	return EFI_SUCCESS;
 }
 
-EFI_STATUS reset_watchdog_status(VOID)
+static void del_legacy_watchdog_status(VOID)
+{
+	if (!wdt_legacy_layout)
+		return;
+
+	del_efi_variable(&fastboot_guid, WDT_COUNTER_VAR);
+	del_efi_variable(&fastboot_guid, WDT_TIME_REF_VAR);
+	wdt_legacy_layout = FALSE;
+}
+
+EFI_STATUS get_watchdog_status(UINT8 *counter, EFI_TIME *time)
 {
 	EFI_STATUS ret;
+	struct watchdog_status *status;
+	UINTN size;
+	UINT32 flags;
 
-	ret = set_watchdog_counter(0);
+	ret = get_efi_variable(&fastboot_guid, WDT_STATUS_VAR, &size,
+			       (VOID **)&status, &flags);
+	if (ret == EFI_NOT_FOUND)
+		return get_legacy_watchdog_status(counter, time);
 	if (EFI_ERROR(ret))
 		return ret;
 
-	return set_watchdog_time_reference(NULL);
+	if (size != sizeof(*status) || status->version != WDT_STATUS_VERSION) {
+		FreePool(status);
+		return EFI_COMPROMISED_DATA;
+	}
+
+	*counter = status->counter;
+	memcpy(time, &status->time_ref, sizeof(*time));
+	FreePool(status);
+
+	return EFI_SUCCESS;
 }
 
-EFI_STATUS set_watchdog_counter(UINT8 counter)
+EFI_STATUS set_watchdog_status(UINT8 counter, EFI_TIME *time)
 {
+	EFI_STATUS ret;
+	struct watchdog_status status;
+
 	if (counter == 0)
-		return del_efi_variable(&fastboot_guid, WDT_COUNTER_VAR);
+		return reset_watchdog_status();
+
+	status.version = WDT_STATUS_VERSION;
+	status.counter = counter;
+	memcpy(&status.time_ref, time, sizeof(status.time_ref));
+
+	ret = set_efi_variable(&fastboot_guid, WDT_STATUS_VAR,
+			       sizeof(status), &status, TRUE, FALSE);
+	if (EFI_ERROR(ret))
+		return ret;
 
-	return set_efi_variable(&fastboot_guid, WDT_COUNTER_VAR,
-				sizeof(counter), &counter, TRUE, FALSE);
+	del_legacy_watchdog_status();
+	return EFI_SUCCESS;
 }
 
-EFI_STATUS set_watchdog_time_reference(EFI_TIME *time)
+EFI_STATUS reset_watchdog_status(VOID)
 {
-	if (time == NULL)
-		return del_efi_variable(&fastboot_guid, WDT_TIME_REF_VAR);
+	EFI_STATUS ret;
+
+	ret = del_efi_variable(&fastboot_guid, WDT_STATUS_VAR);
+	if (ret == EFI_NOT_FOUND)
+		ret = EFI_SUCCESS;
 
-	return set_efi_variable(&fastboot_guid, WDT_TIME_REF_VAR,
-				sizeof(*time), time, TRUE, FALSE);
+	del_legacy_watchdog_status();
+	return ret;
 }
 
 static void CDD_clean_string(char *buf)
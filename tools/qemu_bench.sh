@@ -0,0 +1,153 @@
+#!/bin/bash -e
+
+# Run the installer and the kernelflinger benchmark suites under QEMU
+# with OVMF, boot the test boot image and report the duration of each
+# stage.
+#
+# usage: qemu_bench.sh OUT_DIR [BOOT_IMG [RECOVERY_IMG]]
+#
+# OUT_DIR is the Android product out directory where the installer
+# and kernelflinger EFI binaries have been built (efi/installer.efi
+# and efi/kernelflinger.efi).  The disk image, the serial log and the
+# results are written in $WORK_DIR (default: a temporary directory).
+#
+# BOOT_IMG must log on the serial port (console=ttyS0) with printk
+# timestamps: once kernelflinger has handed over, the firmware time
+# services are gone and the kernel stage duration is read from the
+# timestamp of the first kernel log line matching $BOOT_MARKER.  QEMU
+# is stopped as soon as this line shows up.
+#
+# Environment:
+#   OVMF        path to the OVMF firmware (default: /usr/share/OVMF/OVMF.fd)
+#   QEMU        QEMU binary (default: qemu-system-x86_64)
+#   DISK_IF     disk interface, virtio or ahci (default: virtio)
+#   DISK_SIZE   disk image size in MiB (default: 512)
+#   TIMEOUT     QEMU run timeout in seconds (default: 600)
+#   BOOT_MARKER kernel log line ending the kernel stage
+#               (default: "Freeing unused kernel memory")
+#   WORK_DIR    working directory
+
+out=$1
+boot_img=${2:-$out/boot.img}
+recovery_img=${3:-$out/recovery.img}
+
+if [ -z "$out" ]
+then
+    echo "usage: $0 OUT_DIR [BOOT_IMG [RECOVERY_IMG]]" >&2
+    exit 1
+fi
+
+OVMF=${OVMF:-/usr/share/OVMF/OVMF.fd}
+QEMU=${QEMU:-qemu-system-x86_64}
+DISK_IF=${DISK_IF:-virtio}
+DISK_SIZE=${DISK_SIZE:-512}
+TIMEOUT=${TIMEOUT:-600}
+BOOT_MARKER=${BOOT_MARKER:-Freeing unused kernel memory}
+WORK_DIR=${WORK_DIR:-$(mktemp -d)}
+
+for tool in $QEMU sgdisk mkfs.vfat mcopy timeout
+do
+    if ! which $tool > /dev/null
+    then
+        echo "$tool is required" >&2
+        exit 1
+    fi
+done
+
+disk=$WORK_DIR/disk.img
+esp=$WORK_DIR/esp.img
+log=$WORK_DIR/serial.log
+results=$WORK_DIR/results.txt
+
+# Partition layout: ESP then the partitions used by the benchmarks.
+esp_size=64
+rm -f $disk
+truncate -s ${DISK_SIZE}M $disk
+sgdisk -Z $disk > /dev/null
+sgdisk -n 1:2048:+${esp_size}M -t 1:ef00 -c 1:bootloader \
+       -n 2:0:+32M -t 2:8300 -c 2:boot \
+       -n 3:0:+32M -t 3:8300 -c 3:recovery \
+       -n 4:0:+1M -t 4:8300 -c 4:misc \
+       -n 5:0:0 -t 5:8300 -c 5:data \
+       $disk > /dev/null
+
+# The installer batch file flashes the sample images into their
+# partitions, stage durations are reported by the installer itself.
+batch=$WORK_DIR/bench.cmd
+echo "flash boot boot.img" > $batch
+echo "flash recovery recovery.img" >> $batch
+echo "erase misc" >> $batch
+
+startup=$WORK_DIR/startup.nsh
+cat > $startup <<EOF
+fs0:
+installer.efi --batch bench.cmd
+kernelflinger.efi -U bench-boot
+kernelflinger.efi -U bench-storage
+kernelflinger.efi -U bench-fastboot
+kernelflinger.efi -U destructive-state-vars
+kernelflinger.efi -U bench-kernel
+reset -s
+EOF
+
+rm -f $esp
+mkfs.vfat -C $esp $((esp_size * 1024)) > /dev/null
+mcopy -i $esp $out/efi/installer.efi $out/efi/kernelflinger.efi \
+      $batch $startup ::/
+mcopy -i $esp $boot_img ::/boot.img
+mcopy -i $esp $recovery_img ::/recovery.img
+dd if=$esp of=$disk bs=1M seek=1 conv=notrunc status=none
+
+case $DISK_IF in
+    virtio)
+        drive="-drive file=$disk,format=raw,if=virtio"
+        ;;
+    ahci)
+        drive="-drive file=$disk,format=raw,if=none,id=disk0 \
+               -device ahci,id=ahci0 -device ide-hd,drive=disk0,bus=ahci0.0"
+        ;;
+    *)
+        echo "Unsupported disk interface $DISK_IF" >&2
+        exit 1
+esac
+
+echo "Running QEMU, serial output in $log"
+rm -f $log
+timeout $TIMEOUT $QEMU -m 1024 -bios $OVMF $drive \
+        -nographic -serial file:$log -monitor none -net none &
+qemu=$!
+while kill -0 $qemu 2> /dev/null
+do
+    if grep -qF "$BOOT_MARKER" $log 2> /dev/null
+    then
+        kill $qemu 2> /dev/null || true
+        break
+    fi
+    sleep 1
+done
+wait $qemu || true
+
+# Installer stages: "Starting command: 'X'" followed by
+# "Command successfully executed (N us)".  Kernel stage: printk
+# timestamp of the $BOOT_MARKER line.
+tr -d '\r' < $log | awk -v marker="$BOOT_MARKER" '
+/^Starting command: / {
+    sub(/^Starting command: /, ""); gsub(/'"'"'/, ""); cmd = $0
+}
+/^Command successfully executed \(/ {
+    gsub(/[()]/, ""); printf "installer %-32s %12d us\n", cmd, $4
+}
+/^BENCH / {
+    printf "kernelflinger %-28s %12d %s\n", $2, $3, $4
+}
+!booted && index($0, marker) && match($0, /^\[ *[0-9]+\.[0-9]+\]/) {
+    t = substr($0, RSTART + 1, RLENGTH - 2); gsub(/ /, "", t)
+    printf "kernel %-35s %12d us\n", "boot", int(t * 1000000 + 0.5)
+    booted = 1
+}' | tee $results
+
+if [ ! -s $results ]
+then
+    echo "No result found, check $log" >&2
+    exit 1
+fi
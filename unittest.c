@@ -40,10 +40,17 @@
 #include "lib.h"
 #include "unittest.h"
 #include "blobstore.h"
+#include "android.h"
+#include "vars.h"
+#include "gpt.h"
+#ifndef USERFASTBOOT
+#include <fastboot.h>
+#include "protocol/UsbDeviceModeProtocol.h"
+#endif
 
 
 
-static VOID test_keys(VOID)
+static EFI_STATUS test_keys(VOID)
 {
         const UINTN wait_s = 10;
         UINTN i;
@@ -58,11 +65,13 @@ static VOID test_keys(VOID)
                 }
                 Print(L"Received %d key event\n", event);
         }
+
+        return EFI_SUCCESS;
 }
 
 static UINT8 fake_hash[] = {0x12, 0x34, 0x56, 0x78, 0x90, 0xAB};
 
-static VOID test_ux(VOID)
+static EFI_STATUS test_ux(VOID)
 {
         /* TODO: some method of programmatically verifying that these work */
         ux_prompt_user_bootimage_unverified();
@@ -72,27 +81,707 @@ static VOID test_ux(VOID)
         ux_prompt_user_keystore_unverified(fake_hash);
         ux_crash_event_prompt_user_for_boot_target();
         ux_display_low_battery(3);
+
+        return EFI_SUCCESS;
+}
+
+/* Benchmark suites are not interactive so that they can be driven by
+ * a script, under QEMU for instance.  Each measure is reported on a
+ * single line: "BENCH <stage> <duration> us". */
+static VOID bench_report(CHAR16 *stage, UINT64 start)
+{
+        Print(L"BENCH %s %ld us\n", stage, get_time_us() - start);
+}
+
+static VOID bench_load_image(CHAR16 *stage, const CHAR16 *label)
+{
+        VOID *bootimage;
+        EFI_STATUS ret;
+        UINT64 start;
+
+        start = get_time_us();
+        ret = android_image_load_partition(label, &bootimage);
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Failed to load the %s image", label);
+                return;
+        }
+        bench_report(stage, start);
+        FreePool(bootimage);
+}
+
+static EFI_STATUS test_bench_boot(VOID)
+{
+        struct gpt_partition_interface gpart;
+        struct bootloader_message bcb;
+        EFI_STATUS ret;
+        UINT64 start;
+
+        gpt_free_cache();
+        start = get_time_us();
+        ret = gpt_get_partition_by_label(BOOT_LABEL, &gpart, LOGICAL_UNIT_USER);
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Failed to find the boot partition");
+                return ret;
+        }
+        bench_report(L"gpt-lookup-cold", start);
+
+        start = get_time_us();
+        gpt_get_partition_by_label(BOOT_LABEL, &gpart, LOGICAL_UNIT_USER);
+        bench_report(L"gpt-lookup-warm", start);
+
+        start = get_time_us();
+        ret = read_bcb(MISC_LABEL, &bcb);
+        if (EFI_ERROR(ret))
+                efi_perror(ret, L"Failed to read the BCB");
+        else
+                bench_report(L"read-bcb", start);
+
+        bench_load_image(L"load-boot", BOOT_LABEL);
+        bench_load_image(L"load-recovery", RECOVERY_LABEL);
+
+        return EFI_SUCCESS;
+}
+
+/* Load and start the test boot image flashed in the boot partition.
+ * The kernel stage cannot be measured from here: the host driver
+ * script uses the kernel log timestamps instead.  This suite does not
+ * return on success so it must run last. */
+static EFI_STATUS test_bench_kernel(VOID)
+{
+        VOID *bootimage;
+        EFI_STATUS ret;
+        UINT64 start;
+
+        start = get_time_us();
+        ret = android_image_load_partition(BOOT_LABEL, &bootimage);
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Failed to load the boot image");
+                return ret;
+        }
+        bench_report(L"load-kernel", start);
+
+        ret = android_image_start_buffer(g_parent_image, bootimage,
+                                         NORMAL_BOOT, BOOT_STATE_ORANGE, NULL);
+        efi_perror(ret, L"Failed to start the boot image");
+        FreePool(bootimage);
+        return ret;
+}
+
+static EFI_STATUS test_bench_storage(VOID)
+{
+        static const UINTN CHUNK_SIZES[] = { 4 * 1024, 64 * 1024, 1024 * 1024 };
+        const UINT64 MAX_LEN = 16 * 1024 * 1024;
+        struct gpt_partition_interface gpart;
+        EFI_STATUS ret;
+        UINT64 start, offset, len, duration;
+        UINTN i, chunk;
+        VOID *buf;
+        CHAR16 *stage;
+
+        ret = gpt_get_partition_by_label(BOOT_LABEL, &gpart, LOGICAL_UNIT_USER);
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Failed to find the boot partition");
+                return ret;
+        }
+
+        offset = gpart.part.starting_lba * gpart.bio->Media->BlockSize;
+        len = (gpart.part.ending_lba + 1 - gpart.part.starting_lba) *
+                gpart.bio->Media->BlockSize;
+        len = min(len, MAX_LEN);
+
+        buf = AllocatePool(CHUNK_SIZES[ARRAY_SIZE(CHUNK_SIZES) - 1]);
+        if (!buf) {
+                error(L"Failed to allocate the read buffer");
+                return EFI_OUT_OF_RESOURCES;
+        }
+
+        for (i = 0; i < ARRAY_SIZE(CHUNK_SIZES); i++) {
+                start = get_time_us();
+                for (chunk = 0; chunk + CHUNK_SIZES[i] <= len; chunk += CHUNK_SIZES[i]) {
+                        ret = uefi_call_wrapper(gpart.dio->ReadDisk, 5, gpart.dio,
+                                                gpart.bio->Media->MediaId,
+                                                offset + chunk, CHUNK_SIZES[i], buf);
+                        if (EFI_ERROR(ret)) {
+                                efi_perror(ret, L"ReadDisk failed");
+                                goto out;
+                        }
+                }
+                duration = get_time_us() - start;
+
+                stage = PoolPrint(L"read-%dk", CHUNK_SIZES[i] / 1024);
+                if (!stage) {
+                        ret = EFI_OUT_OF_RESOURCES;
+                        goto out;
+                }
+                Print(L"BENCH %s %ld us\n", stage, duration);
+                Print(L"BENCH %s-throughput %ld KB/s\n", stage,
+                      duration ? (chunk / 1024) * 1000000 / duration : 0);
+                FreePool(stage);
+        }
+
+out:
+        FreePool(buf);
+        return ret;
+}
+
+#ifndef USERFASTBOOT
+/* Fastboot protocol load generator.  A fake USB device mode protocol
+ * is installed so that the fastboot state machine runs without any
+ * USB controller nor host.  The fake device plays the host role: it
+ * issues the BENCH_FASTBOOT_STEPS commands back to back and measures
+ * the round trip of each of them.  Download payloads are not copied,
+ * the download buffer keeps whatever it contains.
+ *
+ * This test suite is destructive: the misc partition gets flashed
+ * and erased, wiping the BCB and the A/B slot metadata.  It only runs
+ * when requested by name. */
+#define BENCH_FB_PARTITION      "misc"
+
+static struct bench_fastboot_step {
+        const char *name;
+        const char *cmd;
+        UINTN repeat;
+        UINT32 data_size;
+} BENCH_FASTBOOT_STEPS[] = {
+        { "getvar",             "getvar:version-bootloader",    200, 0 },
+        { "getvar-dynamic",     "getvar:battery-voltage",       200, 0 },
+        { "getvar-all",         "getvar:all",                   10, 0 },
+        { "download-64k",       "download:%08x",                50, 64 * 1024 },
+        { "flash",              "flash:" BENCH_FB_PARTITION,    10, 0 },
+        { "erase",              "erase:" BENCH_FB_PARTITION,    10, 0 },
+        { "download-32m",       "download:%08x",                4, 32 * 1024 * 1024 },
+        { "continue",           "continue",                     1, 0 }
+};
+
+#define BENCH_FB_MSG_LEN        64
+
+static struct bench_fastboot {
+        EFI_USB_DEVICE_MODE_PROTOCOL protocol;
+        USB_DEVICE_OBJ *dev;
+        BOOLEAN configured;
+
+        USB_DEVICE_IO_REQ rx;
+        BOOLEAN rx_pending;
+        char tx[BENCH_FB_MSG_LEN + 1];
+        UINT32 tx_len;
+        BOOLEAN tx_pending;
+
+        UINTN step;
+        UINTN iteration;
+        BOOLEAN waiting;
+        UINT32 data_left;
+        UINT64 start;
+        UINT64 data_start;
+        UINT64 **samples;
+        UINTN failures;
+        UINT64 data_bytes;
+        UINT64 data_time;
+
+        EFI_ALLOCATE_POOL allocate_pool;
+        EFI_FREE_POOL free_pool;
+        UINTN allocations;
+        UINTN frees;
+        UINT64 allocated_bytes;
+} bench_fb;
+
+static EFIAPI EFI_STATUS bench_fb_allocate_pool(EFI_MEMORY_TYPE type, UINTN size,
+                                                VOID **buffer)
+{
+        bench_fb.allocations++;
+        bench_fb.allocated_bytes += size;
+        return uefi_call_wrapper(bench_fb.allocate_pool, 3, type, size, buffer);
+}
+
+static EFIAPI EFI_STATUS bench_fb_free_pool(VOID *buffer)
+{
+        bench_fb.frees++;
+        return uefi_call_wrapper(bench_fb.free_pool, 1, buffer);
+}
+
+/* The boot services table is checksummed, it must be updated along
+ * with the services it holds. */
+static VOID bench_fb_set_pool_services(EFI_ALLOCATE_POOL allocate_pool,
+                                       EFI_FREE_POOL free_pool)
+{
+        BS->AllocatePool = allocate_pool;
+        BS->FreePool = free_pool;
+        BS->Hdr.CRC32 = 0;
+        uefi_call_wrapper(BS->CalculateCrc32, 3, BS, BS->Hdr.HeaderSize,
+                          &BS->Hdr.CRC32);
+}
+
+static EFIAPI EFI_STATUS bench_fb_nop(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *This)
+{
+        return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS bench_fb_bind(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *This,
+                                       USB_DEVICE_OBJ *dev)
+{
+        bench_fb.dev = dev;
+        return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS bench_fb_tx(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *This,
+                                     USB_DEVICE_IO_REQ *req)
+{
+        if (bench_fb.tx_pending)
+                return EFI_NOT_READY;
+
+        /* The message buffer might be freed as soon as we return */
+        bench_fb.tx_len = min(req->IoInfo.Length, (UINT32)BENCH_FB_MSG_LEN);
+        memcpy(bench_fb.tx, req->IoInfo.Buffer, bench_fb.tx_len);
+        bench_fb.tx[bench_fb.tx_len] = '\0';
+        bench_fb.tx_pending = TRUE;
+        return EFI_SUCCESS;
+}
+
+static EFIAPI EFI_STATUS bench_fb_rx(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *This,
+                                     USB_DEVICE_IO_REQ *req)
+{
+        if (bench_fb.rx_pending)
+                return EFI_NOT_READY;
+
+        bench_fb.rx = *req;
+        bench_fb.rx_pending = TRUE;
+        return EFI_SUCCESS;
+}
+
+static void bench_fb_complete(UINT8 dir, VOID *buffer, UINT32 len)
+{
+        EFI_USB_DEVICE_XFER_INFO xfer = {
+                .EndpointDir = dir,
+                .Length = len,
+                .Buffer = buffer
+        };
+
+        uefi_call_wrapper(bench_fb.dev->DataCallback, 1, &xfer);
+}
+
+static void bench_fb_next_iteration(void)
+{
+        struct bench_fastboot_step *step = &BENCH_FASTBOOT_STEPS[bench_fb.step];
+
+        bench_fb.samples[bench_fb.step][bench_fb.iteration++] =
+                get_time_us() - bench_fb.start;
+        bench_fb.waiting = FALSE;
+        if (bench_fb.iteration == step->repeat) {
+                bench_fb.iteration = 0;
+                bench_fb.step++;
+        }
+}
+
+static void bench_fb_send_command(void)
+{
+        struct bench_fastboot_step *step = &BENCH_FASTBOOT_STEPS[bench_fb.step];
+        int len;
+
+        len = snprintf(bench_fb.rx.IoInfo.Buffer, bench_fb.rx.IoInfo.Length,
+                       (CHAR8 *)step->cmd, step->data_size);
+        if (len < 0 || (UINT32)len >= bench_fb.rx.IoInfo.Length) {
+                error(L"Failed to build the '%a' command", step->cmd);
+                return;
+        }
+
+        bench_fb.rx_pending = FALSE;
+        bench_fb.waiting = TRUE;
+        bench_fb.start = get_time_us();
+        bench_fb_complete(USB_ENDPOINT_DIR_OUT, bench_fb.rx.IoInfo.Buffer, len);
+}
+
+static void bench_fb_send_data(void)
+{
+        UINT32 len;
+
+        len = min(bench_fb.data_left, bench_fb.rx.IoInfo.Length);
+        bench_fb.data_left -= len;
+        bench_fb.rx_pending = FALSE;
+        bench_fb_complete(USB_ENDPOINT_DIR_OUT, bench_fb.rx.IoInfo.Buffer, len);
+}
+
+static void bench_fb_receive(void)
+{
+        struct bench_fastboot_step *step = &BENCH_FASTBOOT_STEPS[bench_fb.step];
+        char *msg = bench_fb.tx;
+
+        bench_fb.tx_pending = FALSE;
+
+        if (bench_fb.step == ARRAY_SIZE(BENCH_FASTBOOT_STEPS))
+                goto ack;
+
+        if (!memcmp(msg, "DATA", 4)) {
+                bench_fb.data_left = step->data_size;
+                bench_fb.data_start = get_time_us();
+        } else if (!memcmp(msg, "OKAY", 4) || !memcmp(msg, "FAIL", 4)) {
+                if (msg[0] == 'F') {
+                        bench_fb.failures++;
+                        debug(L"'%a' failed: %a", step->cmd, msg + 4);
+                }
+                if (step->data_size && bench_fb.data_start) {
+                        bench_fb.data_bytes += step->data_size;
+                        bench_fb.data_time += get_time_us() - bench_fb.data_start;
+                        bench_fb.data_start = 0;
+                }
+                bench_fb_next_iteration();
+        }
+
+ack:
+        /* Acknowledge the transmission */
+        bench_fb_complete(USB_ENDPOINT_DIR_IN, msg, bench_fb.tx_len);
+}
+
+static EFIAPI EFI_STATUS bench_fb_run(__attribute__((__unused__)) EFI_USB_DEVICE_MODE_PROTOCOL *This,
+                                      __attribute__((__unused__)) UINT32 timeout)
+{
+        if (!bench_fb.configured) {
+                bench_fb.configured = TRUE;
+                uefi_call_wrapper(bench_fb.dev->ConfigCallback, 1,
+                                  bench_fb.dev->ConfigObjs[0].ConfigDesc->ConfigurationValue);
+                return EFI_SUCCESS;
+        }
+
+        if (bench_fb.tx_pending) {
+                bench_fb_receive();
+                return EFI_SUCCESS;
+        }
+
+        if (!bench_fb.rx_pending || bench_fb.step == ARRAY_SIZE(BENCH_FASTBOOT_STEPS))
+                return EFI_TIMEOUT;
+
+        if (bench_fb.data_left)
+                bench_fb_send_data();
+        else if (!bench_fb.waiting)
+                bench_fb_send_command();
+
+        return EFI_SUCCESS;
+}
+
+static VOID bench_sort(UINT64 *samples, UINTN count)
+{
+        UINTN i, j;
+        UINT64 cur;
+
+        for (i = 1; i < count; i++) {
+                cur = samples[i];
+                for (j = i; j > 0 && samples[j - 1] > cur; j--)
+                        samples[j] = samples[j - 1];
+                samples[j] = cur;
+        }
+}
+
+static VOID bench_fb_report(struct bench_fastboot_step *step, UINT64 *samples)
+{
+        UINT64 total = 0;
+        UINTN i;
+
+        bench_sort(samples, step->repeat);
+        for (i = 0; i < step->repeat; i++)
+                total += samples[i];
+
+        Print(L"BENCH fastboot-%a %ld us (min %ld p50 %ld p99 %ld max %ld, %d runs)\n",
+              step->name, total / step->repeat, samples[0],
+              samples[step->repeat / 2], samples[(step->repeat * 99) / 100],
+              samples[step->repeat - 1], step->repeat);
+}
+
+static EFI_STATUS test_bench_fastboot(VOID)
+{
+        EFI_HANDLE handle = NULL;
+        EFI_USB_DEVICE_MODE_PROTOCOL *usb_device;
+        void *bootimage, *efiimage;
+        UINT64 *samples[ARRAY_SIZE(BENCH_FASTBOOT_STEPS)];
+        UINTN imagesize, i;
+        enum boot_target target;
+        EFI_STATUS ret;
+
+        ret = LibLocateProtocol(&gEfiUsbDeviceModeProtocolGuid, (VOID **)&usb_device);
+        if (!EFI_ERROR(ret)) {
+                error(L"A USB device mode protocol is already installed");
+                return EFI_ALREADY_STARTED;
+        }
+
+        memset(&bench_fb, 0, sizeof(bench_fb));
+        memset(samples, 0, sizeof(samples));
+        for (i = 0; i < ARRAY_SIZE(BENCH_FASTBOOT_STEPS); i++) {
+                samples[i] = AllocatePool(BENCH_FASTBOOT_STEPS[i].repeat * sizeof(**samples));
+                if (!samples[i]) {
+                        error(L"Failed to allocate the samples buffer");
+                        ret = EFI_OUT_OF_RESOURCES;
+                        goto out;
+                }
+        }
+
+        bench_fb.protocol.InitXdci = bench_fb_nop;
+        bench_fb.protocol.Connect = bench_fb_nop;
+        bench_fb.protocol.DisConnect = bench_fb_nop;
+        bench_fb.protocol.EpTxData = bench_fb_tx;
+        bench_fb.protocol.EpRxData = bench_fb_rx;
+        bench_fb.protocol.Bind = bench_fb_bind;
+        bench_fb.protocol.UnBind = bench_fb_nop;
+        bench_fb.protocol.Run = bench_fb_run;
+        bench_fb.protocol.Stop = bench_fb_nop;
+
+        ret = uefi_call_wrapper(BS->InstallProtocolInterface, 4, &handle,
+                                &gEfiUsbDeviceModeProtocolGuid,
+                                EFI_NATIVE_INTERFACE, &bench_fb.protocol);
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Failed to install the fake USB device mode protocol");
+                goto out;
+        }
+
+        bench_fb.allocate_pool = BS->AllocatePool;
+        bench_fb.free_pool = BS->FreePool;
+        bench_fb_set_pool_services(bench_fb_allocate_pool, bench_fb_free_pool);
+
+        bench_fb.samples = samples;
+        ret = fastboot_start(&bootimage, &efiimage, &imagesize, &target);
+
+        bench_fb_set_pool_services(bench_fb.allocate_pool, bench_fb.free_pool);
+
+        uefi_call_wrapper(BS->UninstallProtocolInterface, 3, handle,
+                          &gEfiUsbDeviceModeProtocolGuid, &bench_fb.protocol);
+
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Fastboot failed");
+                goto out;
+        }
+        if (bench_fb.step != ARRAY_SIZE(BENCH_FASTBOOT_STEPS)) {
+                error(L"Fastboot stopped at the '%a' step",
+                      BENCH_FASTBOOT_STEPS[bench_fb.step].name);
+                ret = EFI_ABORTED;
+                goto out;
+        }
+
+        for (i = 0; i < ARRAY_SIZE(BENCH_FASTBOOT_STEPS); i++)
+                bench_fb_report(&BENCH_FASTBOOT_STEPS[i], samples[i]);
+
+        Print(L"BENCH fastboot-download-throughput %ld KB/s\n",
+              bench_fb.data_time ? (bench_fb.data_bytes / 1024) * 1000000 / bench_fb.data_time : 0);
+        Print(L"BENCH fastboot-failures %d\n", bench_fb.failures);
+        Print(L"BENCH fastboot-allocations %d (%ld bytes), %d frees\n",
+              bench_fb.allocations, bench_fb.allocated_bytes, bench_fb.frees);
+
+out:
+        for (i = 0; i < ARRAY_SIZE(BENCH_FASTBOOT_STEPS); i++)
+                if (samples[i])
+                        FreePool(samples[i]);
+        return ret;
+}
+#endif
+
+#ifndef USER
+/* Count the EFI variable operations made by the device state
+ * functions along a factory provisioning flow and check that only
+ * real state changes are written.  This test suite is destructive:
+ * it changes the device lock state.  The device state is restored at
+ * the end of the test suite. */
+#define STATE_VARS_ANY  -1
+
+struct state_vars_step {
+        const char *name;
+        EFI_STATUS (*run)(VOID);
+        INTN writes;            /* Expected writes or STATE_VARS_ANY */
+};
+
+static struct state_vars_count {
+        EFI_GET_VARIABLE get_variable;
+        EFI_SET_VARIABLE set_variable;
+        UINTN reads;
+        UINTN writes;
+} state_vars;
+
+static EFIAPI EFI_STATUS state_vars_get_variable(CHAR16 *name, EFI_GUID *guid,
+                                                 UINT32 *attributes,
+                                                 UINTN *size, VOID *data)
+{
+        state_vars.reads++;
+        return uefi_call_wrapper(state_vars.get_variable, 5, name, guid,
+                                 attributes, size, data);
+}
+
+static EFIAPI EFI_STATUS state_vars_set_variable(CHAR16 *name, EFI_GUID *guid,
+                                                 UINT32 attributes,
+                                                 UINTN size, VOID *data)
+{
+        state_vars.writes++;
+        return uefi_call_wrapper(state_vars.set_variable, 5, name, guid,
+                                 attributes, size, data);
+}
+
+/* The runtime services table is checksummed, it must be updated
+ * along with the services it holds. */
+static VOID state_vars_set_services(EFI_GET_VARIABLE get_variable,
+                                    EFI_SET_VARIABLE set_variable)
+{
+        RT->GetVariable = get_variable;
+        RT->SetVariable = set_variable;
+        RT->Hdr.CRC32 = 0;
+        uefi_call_wrapper(BS->CalculateCrc32, 3, RT, RT->Hdr.HeaderSize,
+                          &RT->Hdr.CRC32);
+}
+
+static EFI_STATUS state_vars_read(VOID)
+{
+        get_current_state();
+        device_is_provisioning();
+        get_current_off_mode_charge();
+        get_current_crash_event_menu();
+        get_oemvars_update();
+        return EFI_SUCCESS;
+}
+
+static EFI_STATUS state_vars_unlock(VOID)
+{
+        return set_current_state(UNLOCKED);
+}
+
+static EFI_STATUS state_vars_lock(VOID)
+{
+        return set_current_state(LOCKED);
+}
+
+static EFI_STATUS state_vars_oemvars_update(VOID)
+{
+        return set_oemvars_update(!get_oemvars_update());
+}
+
+/* Each fastboot entry sets the oemvars update flag to its current
+ * value */
+static EFI_STATUS state_vars_fastboot_entries(VOID)
+{
+        EFI_STATUS ret;
+        UINTN i;
+
+        for (i = 0; i < 10; i++) {
+                ret = set_oemvars_update(get_oemvars_update());
+                if (EFI_ERROR(ret))
+                        return ret;
+        }
+        return EFI_SUCCESS;
+}
+
+static EFI_STATUS state_vars_off_mode_charge(VOID)
+{
+        EFI_STATUS ret;
+        BOOLEAN enabled = !get_current_off_mode_charge();
+
+        ret = set_off_mode_charge(enabled);
+        if (EFI_ERROR(ret))
+                return ret;
+        return set_off_mode_charge(enabled);
+}
+
+static struct state_vars_step STATE_VARS_STEPS[] = {
+        { "reprovision",        reprovision_state_vars,         STATE_VARS_ANY },
+        { "unlock",             state_vars_unlock,              1 },
+        { "oemvars-update",     state_vars_oemvars_update,      1 },
+        { "fastboot-entries",   state_vars_fastboot_entries,    0 },
+        { "off-mode-charge",    state_vars_off_mode_charge,     1 },
+        { "lock",               state_vars_lock,                1 },
+        { "relock",             state_vars_lock,                0 },
+        { "read",               state_vars_read,                0 }
+};
+
+static EFI_STATUS test_state_vars(VOID)
+{
+        BOOLEAN provisioning, off_mode_charge, crash_event_menu, oemvars_update;
+        enum device_state state;
+        struct state_vars_step *step;
+        UINTN i, reads = 0, writes = 0;
+        EFI_STATUS ret, status = EFI_SUCCESS;
+
+        memset(&state_vars, 0, sizeof(state_vars));
+        state_vars.get_variable = RT->GetVariable;
+        state_vars.set_variable = RT->SetVariable;
+        state_vars_set_services(state_vars_get_variable, state_vars_set_variable);
+
+        /* First access, the device state is loaded from NVRAM */
+        provisioning = device_is_provisioning();
+        state = get_current_state();
+        off_mode_charge = get_current_off_mode_charge();
+        crash_event_menu = get_current_crash_event_menu();
+        oemvars_update = get_oemvars_update();
+        Print(L"BENCH state-vars-load-reads %d ops\n", state_vars.reads);
+        Print(L"BENCH state-vars-load-writes %d ops\n", state_vars.writes);
+        reads = state_vars.reads;
+        writes = state_vars.writes;
+
+        for (i = 0; i < ARRAY_SIZE(STATE_VARS_STEPS); i++) {
+                step = &STATE_VARS_STEPS[i];
+                state_vars.reads = state_vars.writes = 0;
+                ret = step->run();
+                if (EFI_ERROR(ret)) {
+                        efi_perror(ret, L"'%a' step failed", step->name);
+                        status = ret;
+                }
+                Print(L"BENCH state-vars-%a-reads %d ops\n",
+                      step->name, state_vars.reads);
+                Print(L"BENCH state-vars-%a-writes %d ops\n",
+                      step->name, state_vars.writes);
+                if (step->writes != STATE_VARS_ANY &&
+                    state_vars.writes != (UINTN)step->writes) {
+                        error(L"'%a' step: %d writes, expected %d",
+                              step->name, state_vars.writes, step->writes);
+                        status = EFI_ABORTED;
+                }
+                reads += state_vars.reads;
+                writes += state_vars.writes;
+        }
+
+        state_vars_set_services(state_vars.get_variable, state_vars.set_variable);
+
+        Print(L"BENCH state-vars-total-reads %d ops\n", reads);
+        Print(L"BENCH state-vars-total-writes %d ops\n", writes);
+
+        set_off_mode_charge(off_mode_charge);
+        set_crash_event_menu(crash_event_menu);
+        set_oemvars_update(oemvars_update);
+        ret = provisioning ? reprovision_state_vars() : set_current_state(state);
+        if (EFI_ERROR(ret)) {
+                efi_perror(ret, L"Failed to restore the device state");
+                status = ret;
+        }
+
+        return status;
 }
+#endif
 
+/* Suites flagged explicit are destructive, they are not part of
+ * "all" and must be requested by name. */
 static struct test_suite {
         CHAR16 *name;
-        VOID (*fun)(VOID);
+        EFI_STATUS (*fun)(VOID);
+        BOOLEAN explicit;
 } TEST_SUITES[] = {
-        { L"ux", test_ux },
-        { L"keys", test_keys },
+        { L"ux", test_ux, FALSE },
+        { L"keys", test_keys, FALSE },
+        { L"bench-boot", test_bench_boot, FALSE },
+        { L"bench-storage", test_bench_storage, FALSE },
+#ifndef USERFASTBOOT
+        { L"bench-fastboot", test_bench_fastboot, TRUE },
+#endif
+#ifndef USER
+        { L"destructive-state-vars", test_state_vars, TRUE },
+#endif
+        { L"bench-kernel", test_bench_kernel, FALSE },
 };
 
 VOID unittest_main(CHAR16 *testname)
 {
         BOOLEAN found = FALSE;
+        EFI_STATUS ret;
         UINTN i;
 
         for (i = 0; i < ARRAY_SIZE(TEST_SUITES); i++)
-                if (!testname || !StrCmp(L"all", testname) ||
-                    !StrCmp(TEST_SUITES[i].name, testname)) {
+                if ((!TEST_SUITES[i].explicit &&
+                     (!testname || !StrCmp(L"all", testname))) ||
+                    (testname && !StrCmp(TEST_SUITES[i].name, testname))) {
                         found = TRUE;
                         Print(L"'%s' test suite begins\n", TEST_SUITES[i].name);
-                        TEST_SUITES[i].fun();
+                        ret = TEST_SUITES[i].fun();
+                        if (EFI_ERROR(ret))
+                                efi_perror(ret, L"'%s' test suite failed",
+                                           TEST_SUITES[i].name);
                         Print(L"'%s' test suite terminated\n", TEST_SUITES[i].name);
                 }
 
@@ -182,7 +182,7 @@ static EFI_STATUS display_text(UINT32 error_code,
 			       const ui_textline_t *text2,
 			       BOOLEAN show_timeout_message)
 {
-	UINTN width, height, x, y, linesarea, colsarea;
+	UINTN width, height, x, y, text_x, text_y, linesarea, colsarea;
 	ui_image_t *vendor;
 	EFI_STATUS ret;
 	const ui_textline_t *texts[] =
@@ -191,8 +191,6 @@ static EFI_STATUS display_text(UINT32 error_code,
 		  build_footer_text(show_timeout_message),
 		  NULL };
 
-	ui_clear_screen();
-
 	vendor = ui_image_get(VENDOR_IMG_NAME);
 	if (!vendor) {
 		efi_perror(EFI_UNSUPPORTED, L"Unable to load '%a' image",
@@ -205,9 +203,10 @@ static EFI_STATUS display_text(UINT32 error_code,
 		 * text area on the right */
 		width = (swidth / 2) - (2 * wmargin);
 		height = vendor->height * width / vendor->width;
+		x = wmargin;
 		y = (sheight / 2) - (height / 2);
-		ui_image_draw_scale(vendor, wmargin, y , width, height);
-		x = swidth / 2 + wmargin;
+		text_x = swidth / 2 + wmargin;
+		text_y = y;
 	} else {		/* Portrait orientation. */
 		/* Display splash on the top third of the screen,
 		 * text area below it */
@@ -215,14 +214,27 @@ static EFI_STATUS display_text(UINT32 error_code,
 		width = vendor->width * height / vendor->height;
 		x = (swidth / 2) - (width / 2);
 		y = hmargin;
-		ui_image_draw_scale(vendor, x, y , width, height);
-		y += height + hmargin;
+		text_x = x;
+		text_y = y + height + hmargin;
 	}
 
-	colsarea = swidth - x - wmargin;
-	linesarea = sheight - y - hmargin;
+	/* All the prompts share the splash screen background, only
+	 * the text area is drawn again.  */
+	ui_fb_begin();
+	if (ui_fb_base_id() == VENDOR_IMG_NAME) {
+		ui_fb_restore_base_area(text_x, text_y, swidth - text_x,
+					sheight - text_y);
+	} else {
+		ui_clear_screen();
+		ui_image_draw_scale(vendor, x, y, width, height);
+		ui_fb_save_base(VENDOR_IMG_NAME);
+	}
 
-	ret = ui_display_texts(texts, x, y, linesarea, colsarea);
+	colsarea = swidth - text_x - wmargin;
+	linesarea = sheight - text_y - hmargin;
+
+	ret = ui_display_texts(texts, text_x, text_y, linesarea, colsarea);
+	ui_fb_end();
 	if (EFI_ERROR(ret))
 		return ret;
 
@@ -323,8 +335,7 @@ enum boot_target ux_crash_event_prompt_user_for_boot_target(VOID) {
 		   boot flow.  */
 		goto error;
 
-	ui_clear_screen();
-
+	ui_fb_begin();
 	ret = EFI_UNSUPPORTED;
 
 	img = ui_image_get(CRASH_IMG_NAME);
@@ -358,9 +369,17 @@ enum boot_target ux_crash_event_prompt_user_for_boot_target(VOID) {
 	linesarea = sheight - area_y - hmargin;
 	colsarea = swidth - area_x - wmargin;
 
-	ret = ui_image_draw_scale(img, img_x, img_y, width, height);
-	if (EFI_ERROR(ret))
-		goto error;
+	/* The scaled image is composed once, the menu and the text are
+	 * drawn over it.  */
+	if (ui_fb_base_id() == CRASH_IMG_NAME) {
+		ui_fb_restore_base_area(0, 0, swidth, sheight);
+	} else {
+		ui_clear_screen();
+		ret = ui_image_draw_scale(img, img_x, img_y, width, height);
+		if (EFI_ERROR(ret))
+			goto error;
+		ui_fb_save_base(CRASH_IMG_NAME);
+	}
 
 	menu = ui_boot_menu_create(BOOT_ACTIONS);
 	if (!menu) {
@@ -379,21 +398,26 @@ enum boot_target ux_crash_event_prompt_user_for_boot_target(VOID) {
 	if (EFI_ERROR(ret))
 		goto error;
 
+	ui_fb_flush();
 	uefi_call_wrapper(ST->ConIn->Reset, 2, ST->ConIn, FALSE);
 
 	while (1) {
 		target = ui_boot_menu_event_handler(menu,
 						    ui_wait_for_input(TIMEOUT_SECS));
 		if (target != UNKNOWN_TARGET) {
+			ui_fb_end();
 			ui_boot_menu_free(menu);
 			ui_clear_screen();
 			return target;
 		}
+		/* Only the menu selection has changed */
+		ui_fb_flush();
 	}
 
 	halt_system();		/* Timer expired, turn-off the device. */
 
 error:
+	ui_fb_end();
 	if (menu)
 		ui_boot_menu_free(menu);
 
@@ -426,6 +450,92 @@ VOID ux_display_img_battery(const char *battery_img_name, UINTN delay) {
 	pause(delay);
 }
 
+/* The charging screen is drawn at a reduced brightness when DIMMED is
+ * set, the GOP does not provide any backlight control.  */
+#define CHARGING_DIM_SHIFT	2
+#define CHARGING_GAUGE_STEPS	10
+
+static EFI_GRAPHICS_OUTPUT_BLT_PIXEL dim_pixel(EFI_GRAPHICS_OUTPUT_BLT_PIXEL pixel,
+					       BOOLEAN dimmed)
+{
+	if (dimmed) {
+		pixel.Blue >>= CHARGING_DIM_SHIFT;
+		pixel.Green >>= CHARGING_DIM_SHIFT;
+		pixel.Red >>= CHARGING_DIM_SHIFT;
+	}
+	return pixel;
+}
+
+static EFI_STATUS draw_charging_image(ui_image_t *image, UINTN x, UINTN y,
+				      BOOLEAN dimmed)
+{
+	EFI_STATUS ret;
+	ui_image_t to_draw;
+	UINTN i;
+
+	memcpy(&to_draw, image, sizeof(to_draw));
+	to_draw.blt = AllocatePool(ui_get_blt_size(image->width, image->height));
+	if (!to_draw.blt)
+		return EFI_OUT_OF_RESOURCES;
+
+	for (i = 0; i < image->width * image->height; i++)
+		to_draw.blt[i] = dim_pixel(image->blt[i], dimmed);
+
+	ret = ui_image_draw(&to_draw, x, y);
+	FreePool(to_draw.blt);
+	return ret;
+}
+
+VOID ux_display_charging(UINTN level, UINTN frame, BOOLEAN dimmed) {
+	static BOOLEAN drawn, drawn_dimmed;
+	EFI_GRAPHICS_OUTPUT_BLT_PIXEL on, off;
+	ui_image_t *battery;
+	UINTN x, y, width, height, step, lit;
+	EFI_STATUS ret;
+
+	battery = ui_image_get(EMPTY_BATTERY_IMG_NAME);
+	if (!battery) {
+		efi_perror(EFI_NOT_FOUND, L"Failed to get '%a' image",
+			   EMPTY_BATTERY_IMG_NAME);
+		return;
+	}
+
+	x = (swidth / 2) - (battery->width / 2);
+	y = (sheight / 2) - (battery->height / 2);
+
+	/* The battery image is only drawn again on brightness change,
+	 * the animation only updates the gauge.  */
+	if (!drawn || drawn_dimmed != dimmed) {
+		ret = ux_init_screen();
+		if (EFI_ERROR(ret))
+			return;
+
+		ui_clear_screen();
+		ret = draw_charging_image(battery, x, y, dimmed);
+		if (EFI_ERROR(ret))
+			return;
+
+		drawn = TRUE;
+		drawn_dimmed = dimmed;
+	}
+
+	/* The gauge is lit up to the battery level, the remaining
+	 * steps light up one after the other.  */
+	lit = level > 100 ? 0 : level * CHARGING_GAUGE_STEPS / 100;
+	lit += frame % (CHARGING_GAUGE_STEPS - lit + 1);
+
+	on = dim_pixel(COLOR_GREEN, dimmed);
+	off = dim_pixel(dim_pixel(COLOR_LIGHTGRAY, TRUE), dimmed);
+	width = battery->width / CHARGING_GAUGE_STEPS;
+	height = max(sheight / 40, (UINTN)4);
+	x = (swidth / 2) - (width * CHARGING_GAUGE_STEPS / 2);
+	y += battery->height + hmargin;
+
+	for (step = 0; step < CHARGING_GAUGE_STEPS; step++)
+		ui_fill_area(x + step * width, y, width - 2, height,
+			     step < lit ? &on : &off);
+}
+
 VOID ux_display_low_battery(UINTN delay) {
 	ux_display_img_battery(LOW_BATTERY_IMG_NAME, delay);
 }
@@ -52,6 +52,12 @@ enum boot_target ux_crash_event_prompt_user_for_boot_target(VOID);
 VOID ux_display_low_battery(UINTN delay);
 VOID ux_display_empty_battery(VOID);
 
+/* Display the charging screen with a gauge animated according to
+ * FRAME from the battery LEVEL (%).  A LEVEL above 100 means that the
+ * battery capacity is unknown.  DIMMED reduces the screen
+ * brightness.  */
+VOID ux_display_charging(UINTN level, UINTN frame, BOOLEAN dimmed);
+
 VOID ux_init(VOID);
 
 #endif